@@ -12,20 +12,30 @@
 
 #include <regex>
 #include <chrono>
+#include <climits>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <fstream>
+#include <sstream>
 #include <iostream>
 #include <algorithm>
 #include <filesystem>
 #include <unordered_map>
 
 #include "ConfigParser.h"
+#include "FFStreamParser.h"
+#include "LadderSource.h"
 #include "Log.h"
+#include "MappedYUVSource.h"
+#include "TraceRecorder.h"
 #include "V4l2Decoder.h"
 #include "V4l2Driver.h"
 #include "V4l2Encoder.h"
 
 #define SUCCESS 0
+#define ALIGN(num, to) (((num) + (to - 1)) & (~(to - 1)))
 #define BACKTRACE_SIZE 1024
 
 #define TEST_APP_VERSION "1.15"
@@ -41,6 +51,7 @@ std::unordered_map<std::string, unsigned int> gCodecIDMap = {
 
 std::unordered_map<std::string, unsigned int> gColorFormatIDMap = {
     {"NV12", V4L2_PIX_FMT_NV12},
+    {"NV12M", V4L2_PIX_FMT_NV12M},
     {"QC08C", V4L2_PIX_FMT_QC08C},
     {"QC10C", V4L2_PIX_FMT_QC10C},
 };
@@ -114,11 +125,16 @@ static int TestingDecoder(ConfigureStruct& config, std::string sessionId) {
     if (ret) {
         return ret;
     }
+    mDecoder->setDmaHeap(config.DmaHeap);
+    ret = mDecoder->setCopyKernel(config.InputCopyKernel);
+    if (ret) {
+        return ret;
+    }
     ret = mDecoder->init();
     if (ret) {
         return ret;
     }
-    ret = mDecoder->initFFStreamParser(config.InputPath);
+    ret = mDecoder->initFFStreamParser(config.InputPath, config.SharedPacketCache);
     if (ret) {
         return ret;
     }
@@ -133,13 +149,48 @@ static int TestingDecoder(ConfigureStruct& config, std::string sessionId) {
     }
 
     mDecoder->setDump(config.DumpInputPath, config.Outputpath);
+    if (!config.ChecksumType.empty()) {
+        ret = mDecoder->setChecksum(config.ChecksumType, config.ChecksumPath,
+                                    config.ChecksumReference);
+        if (ret) {
+            return ret;
+        }
+    }
 
-    ret |= mDecoder->setInputSizeOverWrite(2 * 1024 * 1024);
+    ret |= mDecoder->setInputSizeOverWrite(config.InputBufferSize > 0
+                                               ? config.InputBufferSize
+                                               : mDecoder->getRecommendedInputSize());
     ret |= mDecoder->setInputActualCount(config.InputBufferCount);
     ret |= mDecoder->setOutputActualCount(config.OutputBufferCount);
     ret |= mDecoder->setResolution(config.Width, config.Height);
+    ret |= mDecoder->setMaxResolution(config.MaxWidth, config.MaxHeight, config.MaxBitDepth);
+    if (!config.ReferenceYUV.empty()) {
+        ret |= mDecoder->setQualityReference(config.ReferenceYUV, config.QualityPath,
+                                             config.QualityThreads);
+    }
+    if (!config.PostProcessPath.empty()) {
+        ret |= mDecoder->setPostProcess(config.PostProcessFormat, config.PostProcessWidth,
+                                        config.PostProcessHeight, config.PostProcessFilter,
+                                        config.PostProcessPath, config.PostProcessThreads);
+    }
+    if (config.CrossCheck) {
+        ret |= mDecoder->setCrossCheck(config.InputPath, config.QualityThreads,
+                                       config.CrossCheckCacheDir,
+                                       config.CrossCheckStopOnMismatch);
+    }
+    if (config.DecodeStartFrame > 0 || config.DecodeEndFrame >= 0 ||
+        config.KeyFrameInterval > 0) {
+        ret |= mDecoder->setDecodeRange(config.DecodeStartFrame, config.DecodeEndFrame,
+                                        config.KeyFrameInterval);
+    }
     ret |= mDecoder->configureInput();
     ret |= mDecoder->allocateBuffers(INPUT_PORT);
+    if (!ret && config.InputCopyBenchmark) {
+        mDecoder->benchmarkCopyKernels();
+    }
+    if (!ret && config.DmaHeapBenchmark > 0) {
+        mDecoder->benchmarkDmaHeaps(config.DmaHeapBenchmark);
+    }
     ret |= mDecoder->startInput();
     ret |= mDecoder->queueBuffers(config.NumFrames);
 
@@ -157,7 +208,140 @@ static int TestingDecoder(ConfigureStruct& config, std::string sessionId) {
     return ret;
 }
 
-static int TestingEncoder(ConfigureStruct& config, std::string sessionId) {
+// Appends the chunk files to path in order and removes them.
+static int mergeChunkFiles(const std::string& path, int numChunks) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        printf("Error: cannot open %s\n", path.c_str());
+        return -EIO;
+    }
+    for (int i = 0; i < numChunks; i++) {
+        std::string chunkPath = path + ".chunk" + std::to_string(i);
+        std::ifstream in(chunkPath, std::ios::binary);
+        if (in && in.peek() != std::ifstream::traits_type::eof()) {
+            out << in.rdbuf();
+        }
+        in.close();
+        std::remove(chunkPath.c_str());
+    }
+    return out ? 0 : -EIO;
+}
+
+/*
+ * Splits the decode range at IDR frames into ParallelSessions chunks of about
+ * the same length and decodes them concurrently, one V4l2Decoder session each.
+ * Every session starts on an IDR (the first one at DecodeStartFrame), so the
+ * chunks decode independently; output dumps and digest files are written per
+ * chunk and concatenated in frame order once all sessions are done. The input
+ * is demuxed once into the shared packet cache.
+ */
+static int TestingChunkedDecoder(ConfigureStruct& config, std::string sessionId) {
+    FFStreamParser probe(config.InputPath, sessionId, true);
+    int ret = probe.init();
+    if (!ret) {
+        ret = probe.loopPackets();
+    }
+    if (ret) {
+        probe.deinit();
+        return ret;
+    }
+
+    const std::vector<int>& keyFrames = probe.getKeyFrames();
+    int start = std::max(config.DecodeStartFrame, 0);
+    int end = probe.getTotalFrameCount();
+    if (config.DecodeEndFrame >= 0) {
+        end = std::min(end, config.DecodeEndFrame);
+    }
+    if (config.NumFrames < end - start) {
+        end = start + config.NumFrames;
+    }
+    if (start >= end || keyFrames.empty()) {
+        printf("Error: nothing to decode in [%d, %d)\n", start, end);
+        probe.deinit();
+        return -EINVAL;
+    }
+
+    // Chunk i ends at the first IDR at or after its share of the range.
+    std::vector<int> bounds = {start};
+    for (int i = 1; i < config.ParallelSessions; i++) {
+        int target = start + (int)((int64_t)(end - start) * i / config.ParallelSessions);
+        auto itr = std::lower_bound(keyFrames.begin(), keyFrames.end(), target);
+        if (itr != keyFrames.end() && *itr > bounds.back() && *itr < end) {
+            bounds.push_back(*itr);
+        }
+    }
+    bounds.push_back(end);
+    int numChunks = (int)bounds.size() - 1;
+    printf("Decoding [%d, %d) in %d chunk(s) on parallel sessions\n", start, end, numChunks);
+
+    if (!config.ReferenceYUV.empty() || config.CrossCheck) {
+        printf("Warning: ReferenceYUV and CrossCheck are not supported with chunked decode\n");
+    }
+    if (config.KeyFrameInterval > 0) {
+        printf("Warning: KeyFrameInterval is not supported with chunked decode\n");
+    }
+    std::vector<ConfigureStruct> chunkConfigs(numChunks, config);
+    for (int i = 0; i < numChunks; i++) {
+        ConfigureStruct& chunk = chunkConfigs[i];
+        std::string suffix = ".chunk" + std::to_string(i);
+        chunk.SharedPacketCache = true;
+        chunk.DecodeStartFrame = bounds[i];
+        chunk.DecodeEndFrame = bounds[i + 1];
+        chunk.KeyFrameInterval = 0;
+        chunk.NumFrames = INT_MAX;
+        chunk.ReferenceYUV = "";
+        chunk.CrossCheck = false;
+        chunk.DumpInputPath = "";
+        chunk.dynamicCommands.clear();
+        if (!chunk.Outputpath.empty()) {
+            chunk.Outputpath += suffix;
+        }
+        if (!chunk.ChecksumPath.empty()) {
+            chunk.ChecksumPath += suffix;
+        }
+        if (!chunk.PostProcessPath.empty()) {
+            chunk.PostProcessPath += suffix;
+        }
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<int> results(numChunks, 0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numChunks; i++) {
+        threads.emplace_back([&, i]() {
+            results[i] = TestingDecoder(chunkConfigs[i], sessionId + "_chunk" + std::to_string(i));
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    probe.deinit();
+
+    for (int i = 0; i < numChunks; i++) {
+        if (results[i]) {
+            printf("Error: chunk %d [%d, %d) failed (%d)\n", i, bounds[i], bounds[i + 1],
+                   results[i]);
+            ret = results[i];
+        }
+    }
+    if (!config.Outputpath.empty()) {
+        ret |= mergeChunkFiles(config.Outputpath, numChunks);
+    }
+    if (!config.ChecksumPath.empty()) {
+        ret |= mergeChunkFiles(config.ChecksumPath, numChunks);
+    }
+    if (!config.PostProcessPath.empty()) {
+        ret |= mergeChunkFiles(config.PostProcessPath, numChunks);
+    }
+    printf("Chunked decode: %d frames in %.3fs (%.1f fps) on %d sessions\n", end - start,
+           elapsed, elapsed > 0 ? (end - start) / elapsed : 0.0, numChunks);
+    return ret;
+}
+
+static int TestingEncoder(ConfigureStruct& config, std::string sessionId,
+                          std::shared_ptr<LadderSource> ladder = nullptr, int ladderSlot = 0) {
     std::shared_ptr<V4l2Encoder> mEncoder = nullptr;
     std::shared_ptr<V4l2EncoderCB> mEncoderCB = nullptr;
     unsigned int codecFmt, pixelFmt;
@@ -173,12 +357,38 @@ static int TestingEncoder(ConfigureStruct& config, std::string sessionId) {
     if (ret) {
         return ret;
     }
+    mEncoder->setDmaHeap(config.DmaHeap);
+    ret = mEncoder->setCopyKernel(config.InputCopyKernel);
+    if (ret) {
+        return ret;
+    }
     ret = mEncoder->init();
     if (ret) {
         return ret;
     }
-    ret = mEncoder->initFFYUVParser(config.InputPath, config.Width,
-                                    config.Height, config.PixelFormat);
+    // "synthetic:<pattern>" generates frames instead of reading a YUV file.
+    if (ladder) {
+        ret = mEncoder->initLadderSource(ladder, ladderSlot, config.LadderFilter);
+    } else if (config.InputPath.compare(0, 10, "synthetic:") == 0) {
+        ret = mEncoder->initSyntheticSource(config.InputPath.substr(10), config.Width,
+                                            config.Height, config.SyntheticSeed,
+                                            config.SyntheticMotion, config.SyntheticNoise);
+    } else if (config.SourceWidth > 0) {
+        ret = mEncoder->initMappedSource(config.InputPath, config.SourceWidth,
+                                         config.SourceHeight, config.LoopInput,
+                                         config.ReadaheadFrames, config.InputStartFrame);
+        if (!ret) {
+            ret = mEncoder->setInputRegion(config.InputRegionLeft, config.InputRegionTop,
+                                           config.Width, config.Height);
+        }
+    } else if (config.MappedInput || config.LoopInput || config.InputStartFrame > 0) {
+        ret = mEncoder->initMappedSource(config.InputPath, config.Width, config.Height,
+                                         config.LoopInput, config.ReadaheadFrames,
+                                         config.InputStartFrame);
+    } else {
+        ret = mEncoder->initFFYUVParser(config.InputPath, config.Width,
+                                        config.Height, config.PixelFormat);
+    }
     if (ret) {
         return ret;
     }
@@ -215,11 +425,35 @@ static int TestingEncoder(ConfigureStruct& config, std::string sessionId) {
 
     ret |= mEncoder->setOperatingRate(1, config.OperatingRate);
     ret |= mEncoder->setFrameRate(1, config.FrameRate);
+    if (config.LoopbackEvaluation) {
+        ret |= mEncoder->setLoopbackEvaluation(config.QualityPath, config.QualityThreads);
+    }
+    if (!config.SceneCutDetection.empty()) {
+        ret |= mEncoder->setSceneCutDetection(config.SceneCutDetection, config.SceneCutThreshold,
+                                              config.SceneCutMinInterval);
+    }
+    if (!config.InputPacing.empty()) {
+        ret |= mEncoder->setInputPacing(config.InputPacing, config.PacingJitterUs);
+    }
+    if (!config.BitstreamStats.empty()) {
+        ret |= mEncoder->setBitstreamAnalysis(config.BitstreamStats);
+    }
     ret |= mEncoder->setStaticControls();
+    // After the static controls, so the trace overrides any fixed BitRate.
+    if (!config.BitrateTrace.empty()) {
+        ret |= mEncoder->setBitrateController(config.BitrateTrace, config.PeakBitratePercent,
+                                              config.RateControlLog);
+    }
     ret |= mEncoder->configureInput();
     ret |= mEncoder->configureOutput();
     ret |= mEncoder->allocateBuffers(OUTPUT_PORT);
     ret |= mEncoder->allocateBuffers(INPUT_PORT);
+    if (!ret && config.InputCopyBenchmark) {
+        mEncoder->benchmarkCopyKernels();
+    }
+    if (!ret && config.DmaHeapBenchmark > 0) {
+        mEncoder->benchmarkDmaHeaps(config.DmaHeapBenchmark);
+    }
     ret |= mEncoder->startOutput();
     ret |= mEncoder->startInput();
     ret |= mEncoder->queueBuffers(config.NumFrames);
@@ -238,6 +472,404 @@ static int TestingEncoder(ConfigureStruct& config, std::string sessionId) {
     return ret;
 }
 
+// Copy of controls with id set to the given value, appended if absent.
+static std::list<std::shared_ptr<EventConfig>> overrideControl(
+        const std::list<std::shared_ptr<EventConfig>>& controls, std::string id,
+        ValueType vtype, std::string valueStr, int valueInt) {
+    std::list<std::shared_ptr<EventConfig>> result;
+    for (auto& ctrl : controls) {
+        if (ctrl->Id != id) {
+            result.push_back(ctrl);
+        }
+    }
+    auto ctrl = std::make_shared<EventConfig>();
+    ctrl->Id = id;
+    ctrl->vtype = vtype;
+    ctrl->valueStr = valueStr;
+    ctrl->valueInt = valueInt;
+    ctrl->fnum = 0;
+    result.push_back(ctrl);
+    return result;
+}
+
+/*
+ * Splits the input into ParallelSessions runs of frames and encodes them
+ * concurrently, one V4l2Encoder session each with the same static controls.
+ * Each session starts with an IDR and, with the parameter sets joined to the
+ * first frame and repeated on every IDR, its bitstream decodes on its own, so
+ * the chunks are closed GOPs that concatenate into one elementary stream.
+ * Chunk lengths are rounded up to a multiple of GOPSize to keep the intra
+ * cadence of a single-session encode. Input is read through a mapped source.
+ */
+static int TestingChunkedEncoder(ConfigureStruct& config, std::string sessionId) {
+    if (config.CodecName != "AVC" && config.CodecName != "HEVC") {
+        printf("Error: chunked encode supports AVC and HEVC only\n");
+        return -EINVAL;
+    }
+    if (config.InputPath.compare(0, 10, "synthetic:") == 0 || config.LoopInput) {
+        printf("Error: chunked encode needs a finite YUV file input\n");
+        return -EINVAL;
+    }
+
+    MappedYUVSource probe(config.InputPath, sessionId);
+    int ret = probe.init(config.Width, config.Height, gColorFormatIDMap[config.PixelFormat],
+                         false, 0);
+    int numFrames = (int)probe.getFrameCount();
+    probe.deinit();
+    if (ret) {
+        return ret;
+    }
+    int start = std::max(config.InputStartFrame, 0);
+    numFrames = std::min(numFrames - start, config.NumFrames);
+    if (numFrames <= 0) {
+        printf("Error: no input frames from frame %d\n", start);
+        return -EINVAL;
+    }
+
+    int gopSize = 1;
+    for (auto& ctrl : config.staticControls) {
+        if (ctrl->Id == "GOPSize" && ctrl->vtype == INTEGER && ctrl->valueInt > 0) {
+            gopSize = ctrl->valueInt;
+        }
+    }
+    int chunkLen = (numFrames + config.ParallelSessions - 1) / config.ParallelSessions;
+    chunkLen = (chunkLen + gopSize - 1) / gopSize * gopSize;
+    int numChunks = (numFrames + chunkLen - 1) / chunkLen;
+    printf("Encoding %d frames from frame %d in %d chunk(s) of %d on parallel sessions\n",
+           numFrames, start, numChunks, chunkLen);
+
+    if (!config.dynamicControls.empty() || !config.dynamicCommands.empty() ||
+        !config.BitrateTrace.empty() || config.LoopbackEvaluation) {
+        printf("Warning: dynamic controls, BitrateTrace and LoopbackEvaluation are not "
+               "applied with chunked encode\n");
+    }
+    auto staticControls = overrideControl(config.staticControls, "PrefixHeaderMode", STRING,
+                                          "JOINED", 0);
+    staticControls = overrideControl(staticControls, "PrependPsToIDR", INTEGER, "", 1);
+
+    std::vector<ConfigureStruct> chunkConfigs(numChunks, config);
+    for (int i = 0; i < numChunks; i++) {
+        ConfigureStruct& chunk = chunkConfigs[i];
+        std::string suffix = ".chunk" + std::to_string(i);
+        chunk.MappedInput = true;
+        chunk.InputStartFrame = start + i * chunkLen;
+        chunk.NumFrames = std::min(chunkLen, numFrames - i * chunkLen);
+        chunk.staticControls = staticControls;
+        chunk.dynamicControls.clear();
+        chunk.dynamicCommands.clear();
+        chunk.BitrateTrace = "";
+        chunk.LoopbackEvaluation = false;
+        chunk.DumpInputPath = "";
+        if (!chunk.Outputpath.empty()) {
+            chunk.Outputpath += suffix;
+        }
+        if (!chunk.BitstreamStats.empty()) {
+            chunk.BitstreamStats += suffix;
+        }
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<int> results(numChunks, 0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numChunks; i++) {
+        threads.emplace_back([&, i]() {
+            results[i] = TestingEncoder(chunkConfigs[i], sessionId + "_chunk" + std::to_string(i));
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    for (int i = 0; i < numChunks; i++) {
+        if (results[i]) {
+            printf("Error: chunk %d from frame %d failed (%d)\n", i,
+                   chunkConfigs[i].InputStartFrame, results[i]);
+            ret = results[i];
+        }
+    }
+    if (!config.Outputpath.empty()) {
+        ret |= mergeChunkFiles(config.Outputpath, numChunks);
+    }
+    printf("Chunked encode: %d frames in %.3fs (%.1f fps) on %d sessions\n", numFrames,
+           elapsed, elapsed > 0 ? numFrames / elapsed : 0.0, numChunks);
+    return ret;
+}
+
+static std::mutex gFrameSizesLock;
+static std::map<std::pair<unsigned int, unsigned int>, struct v4l2_frmsizeenum> gFrameSizes;
+
+/*
+ * Encoder frame size range per codec and color format. The device is probed
+ * once per pair; runAndWaitForComplete() does that before any session starts.
+ */
+static int getEncoderFrameSizes(ConfigureStruct& config, std::string sessionId,
+                                struct v4l2_frmsizeenum* fsize) {
+    auto key = std::make_pair(gCodecIDMap[config.CodecName],
+                              gColorFormatIDMap[config.PixelFormat]);
+    std::unique_lock<std::mutex> lock(gFrameSizesLock);
+    auto itr = gFrameSizes.find(key);
+    if (itr != gFrameSizes.end()) {
+        *fsize = itr->second;
+        return 0;
+    }
+    int ret = V4l2Encoder::queryFrameSizes(key.first, key.second, sessionId, fsize);
+    if (ret) {
+        return ret;
+    }
+    gFrameSizes[key] = *fsize;
+    return 0;
+}
+
+static bool isStripeCandidate(ConfigureStruct& config) {
+    return config.Domain.compare("Encoder") == 0 && config.LadderRenditions.empty() &&
+           config.InputPath.compare(0, 10, "synthetic:") != 0;
+}
+
+/*
+ * True when the configured frame is beyond the encoder's maximum frame size,
+ * so it can only be encoded as stripes. Uses the limits probed up front.
+ */
+static bool needsStripeEncode(ConfigureStruct& config) {
+    std::unique_lock<std::mutex> lock(gFrameSizesLock);
+    auto itr = gFrameSizes.find(std::make_pair(gCodecIDMap[config.CodecName],
+                                               gColorFormatIDMap[config.PixelFormat]));
+    if (!isStripeCandidate(config) || itr == gFrameSizes.end()) {
+        return false;
+    }
+    return config.Width > (int)itr->second.stepwise.max_width ||
+           config.Height > (int)itr->second.stepwise.max_height;
+}
+
+/*
+ * Encodes frames too large for one session as columns (or rows) on concurrent
+ * sessions. The stripe count is the smallest that fits the encoder's maximum
+ * frame size, and at least StripeCount. Each session reads its stripe
+ * straight out of the mapped source file into its input buffers, so no
+ * full-size frame is ever staged, and writes its own elementary stream.
+ * Stripe edges are aligned to 16 pixels; BitRate and PeakBitrate are split by
+ * stripe area. A JSON manifest next to Outputpath records the source and
+ * every stripe's rectangle and stream, for reassembly after decode.
+ */
+static int TestingStripeEncoder(ConfigureStruct& config, std::string sessionId) {
+    bool columns = config.StripeLayout != "rows";
+    if (config.StripeLayout != "rows" && config.StripeLayout != "columns") {
+        printf("Error: unknown StripeLayout %s, expected columns or rows\n",
+               config.StripeLayout.c_str());
+        return -EINVAL;
+    }
+    if (config.InputPath.compare(0, 10, "synthetic:") == 0 || config.Outputpath.empty()) {
+        printf("Error: stripe encode needs a YUV file input and an Outputpath\n");
+        return -EINVAL;
+    }
+
+    struct v4l2_frmsizeenum fsize;
+    int ret = getEncoderFrameSizes(config, sessionId, &fsize);
+    if (ret) {
+        printf("Error: failed to query the encoder frame size limits\n");
+        return ret;
+    }
+    int extent = columns ? config.Width : config.Height;
+    int across = columns ? config.Height : config.Width;
+    int minLen = columns ? fsize.stepwise.min_width : fsize.stepwise.min_height;
+    int maxLen = columns ? fsize.stepwise.max_width : fsize.stepwise.max_height;
+    int minAcross = columns ? fsize.stepwise.min_height : fsize.stepwise.min_width;
+    int maxAcross = columns ? fsize.stepwise.max_height : fsize.stepwise.max_width;
+    if (across < minAcross || across > maxAcross) {
+        printf("Error: %s stripes of %dx%d cannot fit the encoder range [%ux%u, %ux%u]\n",
+               config.StripeLayout.c_str(), config.Width, config.Height,
+               fsize.stepwise.min_width, fsize.stepwise.min_height, fsize.stepwise.max_width,
+               fsize.stepwise.max_height);
+        return -EINVAL;
+    }
+    // Fewest stripes whose 16-aligned length fits, StripeCount at the least.
+    int numStripes = std::max(config.StripeCount, 1);
+    int stripeLen = ALIGN((extent + numStripes - 1) / numStripes, 16);
+    while (stripeLen > maxLen && stripeLen > 16) {
+        numStripes++;
+        stripeLen = ALIGN((extent + numStripes - 1) / numStripes, 16);
+    }
+    numStripes = (extent + stripeLen - 1) / stripeLen;
+    for (int i = 0; i < numStripes; i++) {
+        int len = std::min(stripeLen, extent - i * stripeLen);
+        if (len < minLen || len > maxLen) {
+            printf("Error: stripe %d of %d is %d, outside the encoder range [%d, %d]\n", i,
+                   numStripes, len, minLen, maxLen);
+            return -EINVAL;
+        }
+    }
+    printf("Encoding %dx%d as %d %s of %d\n", config.Width, config.Height, numStripes,
+           config.StripeLayout.c_str(), stripeLen);
+
+    if (!config.dynamicControls.empty() || !config.BitrateTrace.empty() ||
+        config.LoopbackEvaluation) {
+        printf("Warning: dynamic controls, BitrateTrace and LoopbackEvaluation are not "
+               "applied with stripe encode\n");
+    }
+    std::vector<ConfigureStruct> stripeConfigs(numStripes, config);
+    for (int i = 0; i < numStripes; i++) {
+        ConfigureStruct& stripe = stripeConfigs[i];
+        int offset = i * stripeLen;
+        int len = std::min(stripeLen, extent - offset);
+        stripe.SourceWidth = config.Width;
+        stripe.SourceHeight = config.Height;
+        stripe.InputRegionLeft = columns ? offset : 0;
+        stripe.InputRegionTop = columns ? 0 : offset;
+        stripe.Width = columns ? len : config.Width;
+        stripe.Height = columns ? config.Height : len;
+        stripe.StripeCount = 0;
+        stripe.dynamicControls.clear();
+        stripe.BitrateTrace = "";
+        stripe.LoopbackEvaluation = false;
+        stripe.DumpInputPath = "";
+        stripe.Outputpath += ".stripe" + std::to_string(i);
+        if (!stripe.BitstreamStats.empty()) {
+            stripe.BitstreamStats += ".stripe" + std::to_string(i);
+        }
+        for (auto id : {"BitRate", "PeakBitrate"}) {
+            for (auto& ctrl : config.staticControls) {
+                if (ctrl->Id == id && ctrl->vtype == INTEGER) {
+                    int bitrate = (int)((int64_t)ctrl->valueInt * len / extent);
+                    stripe.staticControls = overrideControl(stripe.staticControls, id, INTEGER,
+                                                            "", bitrate);
+                }
+            }
+        }
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<int> results(numStripes, 0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numStripes; i++) {
+        threads.emplace_back([&, i]() {
+            results[i] =
+                TestingEncoder(stripeConfigs[i], sessionId + "_stripe" + std::to_string(i));
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    Json::Value manifest;
+    manifest["InputPath"] = config.InputPath;
+    manifest["CodecName"] = config.CodecName;
+    manifest["Width"] = config.Width;
+    manifest["Height"] = config.Height;
+    manifest["StripeLayout"] = config.StripeLayout;
+    for (int i = 0; i < numStripes; i++) {
+        Json::Value entry;
+        entry["Left"] = stripeConfigs[i].InputRegionLeft;
+        entry["Top"] = stripeConfigs[i].InputRegionTop;
+        entry["Width"] = stripeConfigs[i].Width;
+        entry["Height"] = stripeConfigs[i].Height;
+        entry["Path"] = stripeConfigs[i].Outputpath;
+        entry["Result"] = results[i];
+        manifest["Stripes"].append(entry);
+        if (results[i]) {
+            printf("Error: stripe %d failed (%d)\n", i, results[i]);
+            ret = results[i];
+        }
+    }
+    std::string manifestPath = config.Outputpath + ".manifest.json";
+    std::ofstream manifestFile(manifestPath);
+    Json::StreamWriterBuilder writer;
+    manifestFile << Json::writeString(writer, manifest) << std::endl;
+    if (!manifestFile) {
+        printf("Error: failed to write %s\n", manifestPath.c_str());
+        ret |= -EIO;
+    }
+    printf("Stripe encode: %d stripes in %.3fs, manifest %s\n", numStripes, elapsed,
+           manifestPath.c_str());
+    return ret;
+}
+
+/*
+ * ABR ladder: LadderRenditions lists "<width>x<height>:<kbps>" renditions,
+ * comma separated. The source is read once into shared frames that feed one
+ * V4l2Encoder session per rendition; each session scales (or copies) a frame
+ * straight into its input buffer and holds it until that buffer returns.
+ * Rendition streams go to Outputpath.<width>x<height>.
+ */
+static int TestingLadderEncoder(ConfigureStruct& config, std::string sessionId) {
+    std::vector<ConfigureStruct> renditions;
+    std::stringstream spec(config.LadderRenditions);
+    std::string item;
+
+    if (config.PixelFormat != "NV12" && config.PixelFormat != "NV12M") {
+        printf("Error: ladder encode needs an NV12 input\n");
+        return -EINVAL;
+    }
+    while (std::getline(spec, item, ',')) {
+        int width = 0, height = 0, kbps = 0;
+        if (sscanf(item.c_str(), " %dx%d:%d", &width, &height, &kbps) != 3 || width <= 0 ||
+            height <= 0 || kbps <= 0) {
+            printf("Error: bad ladder rendition \"%s\", expected <width>x<height>:<kbps>\n",
+                   item.c_str());
+            return -EINVAL;
+        }
+        ConfigureStruct rendition = config;
+        std::string name = std::to_string(width) + "x" + std::to_string(height);
+        rendition.Width = width;
+        rendition.Height = height;
+        rendition.LadderRenditions = "";
+        rendition.LoopbackEvaluation = false;
+        rendition.DumpInputPath = "";
+        rendition.staticControls = overrideControl(config.staticControls, "BitRate", INTEGER,
+                                                   "", kbps * 1000);
+        if (!rendition.Outputpath.empty()) {
+            rendition.Outputpath += "." + name;
+        }
+        if (!rendition.BitstreamStats.empty()) {
+            rendition.BitstreamStats += "." + name;
+        }
+        renditions.push_back(rendition);
+    }
+    if (renditions.empty() || renditions.size() > 64) {
+        printf("Error: LadderRenditions needs 1 to 64 renditions\n");
+        return -EINVAL;
+    }
+
+    int numSessions = (int)renditions.size();
+    auto ladder = std::make_shared<LadderSource>(config.InputPath, sessionId);
+    int ret = ladder->init(config.Width, config.Height, numSessions,
+                           std::max(config.InputBufferCount, 8) * 2);
+    if (ret) {
+        return ret;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<int> results(numSessions, 0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numSessions; i++) {
+        threads.emplace_back([&, i]() {
+            std::string name = std::to_string(renditions[i].Width) + "x" +
+                               std::to_string(renditions[i].Height);
+            results[i] = TestingEncoder(renditions[i], sessionId + "_" + name, ladder, i);
+            // Also on failure, so the other sessions stop waiting for this one.
+            ladder->leave(i);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    ladder->deinit();
+
+    for (int i = 0; i < numSessions; i++) {
+        if (results[i]) {
+            printf("Error: rendition %dx%d failed (%d)\n", renditions[i].Width,
+                   renditions[i].Height, results[i]);
+            ret = results[i];
+        }
+    }
+    printf("Ladder encode: %d renditions in %.3fs\n", numSessions, elapsed);
+    return ret;
+}
+
 int getRegexMatchFileNames(std::string regexPath,
                            std::vector<std::string>& matched_files,
                            std::string& pathToFile) {
@@ -292,8 +924,16 @@ void runAndWaitForComplete(
         int ret = 0;
         auto& config = mapTestCasesConfig[test];
 
-        if (config.Domain.compare("Decoder") == 0) {
+        if (config.Domain.compare("Decoder") == 0 && config.ParallelSessions > 1) {
+            ret = TestingChunkedDecoder(config, test);
+        } else if (config.Domain.compare("Decoder") == 0) {
             ret = TestingDecoder(config, test);
+        } else if (!config.LadderRenditions.empty()) {
+            ret = TestingLadderEncoder(config, test);
+        } else if (config.StripeCount > 1 || needsStripeEncode(config)) {
+            ret = TestingStripeEncoder(config, test);
+        } else if (config.ParallelSessions > 1) {
+            ret = TestingChunkedEncoder(config, test);
         } else {
             ret = TestingEncoder(config, test);
         }
@@ -310,6 +950,14 @@ void runAndWaitForComplete(
 
     auto waitFunc = [&](std::string test) -> void { return runTest(test); };
 
+    // Probe encoder limits while no session holds the device.
+    for (auto& [test, config] : mapTestCasesConfig) {
+        struct v4l2_frmsizeenum fsize;
+        if (isStripeCandidate(config)) {
+            getEncoderFrameSizes(config, test, &fsize);
+        }
+    }
+
     std::vector<std::shared_ptr<std::thread>> threads;
     if (ExecutionMode == "Concurrent") {
         threads.reserve(mapTestCasesConfig.size());
@@ -341,6 +989,7 @@ static void showUsage() {
     printf("[OPTIONS] : --config     : Argument Required            : Absolute path of config file\n");
     printf("[OPTIONS] : --results    : Optional Argument Required   : Absolute path of Results.csv\n");
     printf("[OPTIONS] : --loglevel   : Optional Argument Required   : Absolute path of config file\n");
+    printf("[OPTIONS] : --trace      : Argument Required            : Absolute path of Chrome trace file\n");
 }
 
 int main(int argc, char** argv) {
@@ -370,10 +1019,11 @@ int main(int argc, char** argv) {
             {"config",      required_argument, 0,  'c' },
             {"results",     optional_argument, 0,  'r' },
             {"loglevel",    optional_argument, 0,  'l' },
+            {"trace",       required_argument, 0,  't' },
             {0,             0,                 0,   0  }
         };
 
-        int opt = getopt_long(argc, argv, "h:c:l:r:",
+        int opt = getopt_long(argc, argv, "h:c:l:r:t:",
                 longOpts, &optIndex);
 
         if (opt == -1) {
@@ -396,6 +1046,10 @@ int main(int argc, char** argv) {
                 gLogLevel = atoi(argv[optind++]);
                 printf("Log Level : 0x%x\n", gLogLevel);
                 break;
+            case 't':
+                TraceRecorder::get().enable(optarg);
+                printf("Trace file path: %s\n", optarg);
+                break;
             default:
                 printf("Error: invalid option. Run \"./iris_v4l2_test --help\" for more info.\n");
                 return -1;
@@ -432,6 +1086,8 @@ int main(int argc, char** argv) {
                 mapTestCasesConfig, std::ref(resultFile));
     }
 
+    TraceRecorder::get().write();
+
     std::cout << "Testapp Version " << TEST_APP_VERSION << std::endl;
 
     return 0;
@@ -0,0 +1,92 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _BITRATE_CONTROLLER_H_
+#define _BITRATE_CONTROLLER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Log.h"
+
+/**
+ * Closed-loop bitrate control for live-streaming experiments. The target
+ * bandwidth comes from a trace file ("<seconds> <kbps>" per line, held until
+ * the next entry) or from "randomwalk:<start>,<min>,<max>[,<seed>]", a seeded
+ * stand-in for a network estimator that moves the target once per second.
+ *
+ * Encoded frame sizes are measured over a one second window of media time and
+ * compared with the target and the command averaged over the same frames.
+ * Every half second the command gain is moved halfway (geometrically) towards
+ * the inverse of the delivered/commanded ratio, so a rate control that over-
+ * or undershoots is pulled onto the target. Tracking error and, for each target change, the time until
+ * the windowed rate is within 10% of the windowed target are reported.
+ */
+class BitrateController {
+  public:
+    BitrateController() = delete;
+    explicit BitrateController(std::string sessionId);
+    ~BitrateController();
+
+    std::string id();
+
+    int init(std::string trace, int peakPercent, std::string logPath);
+    void deinit();
+
+    void getInitialBitrate(uint32_t* bitrate, uint32_t* peak);
+    // Returns true when the encoder should be given a new bitrate/peak (bps).
+    bool onFrameEncoded(int64_t timestampUs, uint32_t bytes, uint32_t* bitrate, uint32_t* peak);
+
+  private:
+    int loadTrace(std::string path);
+    int parseRandomWalk(std::string spec);
+    double targetKbps(double seconds);
+    void command(double target, uint32_t* bitrate, uint32_t* peak);
+
+    std::string mSessionId;
+    FILE* mLogFile = nullptr;
+    int mPeakPercent = 150;
+
+    // Piecewise-constant target; the random walk extends it on demand.
+    std::vector<std::pair<double, double>> mTrace;
+    bool mRandomWalk = false;
+    double mWalkMin = 0;
+    double mWalkMax = 0;
+    uint64_t mWalkState = 0;
+
+    struct WindowEntry {
+        double time;
+        uint32_t bytes;
+        double targetKbps;
+        double commandKbps;
+    };
+    std::deque<WindowEntry> mWindow;
+    uint64_t mWindowBytes = 0;
+    double mWindowTarget = 0;
+    double mWindowCommand = 0;
+    double mStartTime = -1;
+    double mLastUpdate = 0;
+    double mLastTarget = 0;
+    double mLastCommand = 0;
+    double mGain = 1.0;
+
+    double mChangeTime = 0;
+    bool mConverged = true;
+    std::vector<double> mConvergeTimes;
+    uint32_t mTargetChanges = 0;
+
+    double mErrorSum = 0;
+    double mErrorSqSum = 0;
+    uint32_t mErrorCnt = 0;
+};
+
+#endif  // _BITRATE_CONTROLLER_H_
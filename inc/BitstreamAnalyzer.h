@@ -0,0 +1,160 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _BITSTREAM_ANALYZER_H_
+#define _BITSTREAM_ANALYZER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Log.h"
+
+class BitReader;
+
+/**
+ * Per-frame statistics of encoded H.264/HEVC CAPTURE buffers. NAL units are
+ * located with a SIMD start code scan (or by length prefix), parameter sets
+ * are parsed and kept, and the first slice header of each frame is read up
+ * to slice_qp_delta to get the frame type and QP. The temporal layer comes
+ * from the HEVC NAL header or the H.264 SVC prefix NAL. Long-term reference
+ * marking and use are flagged, and the time from input QBUF to output DQBUF
+ * is matched through the buffer timestamp.
+ *
+ * Each frame is written as a CSV line; per-type, per-layer and latency
+ * summaries are logged at deinit().
+ */
+class BitstreamAnalyzer {
+  public:
+    BitstreamAnalyzer() = delete;
+    explicit BitstreamAnalyzer(std::string sessionId);
+    ~BitstreamAnalyzer();
+
+    std::string id();
+
+    int init(unsigned int codecFmt, bool lengthPrefixed, std::string logPath);
+    void deinit();
+
+    void onQueued(int64_t timestampUs);
+    int analyze(const uint8_t* data, uint32_t size, int64_t timestampUs);
+
+  private:
+    enum FrameType {
+        FRAME_IDR = 0,
+        FRAME_I,
+        FRAME_P,
+        FRAME_B,
+        FRAME_HEADER,
+        FRAME_TYPE_MAX,
+    };
+
+    struct FrameInfo {
+        FrameType type = FRAME_HEADER;
+        int temporalId = 0;
+        int qp = -1;
+        int slices = 0;
+        bool ltrMark = false;
+        bool ltrUse = false;
+    };
+
+    struct AvcSps {
+        bool valid = false;
+        bool separateColourPlane = false;
+        int chromaArrayType = 1;
+        int log2MaxFrameNum = 4;
+        int pocType = 0;
+        int log2MaxPocLsb = 4;
+        bool deltaPicOrderAlwaysZero = false;
+        bool frameMbsOnly = true;
+    };
+
+    struct AvcPps {
+        bool valid = false;
+        int spsId = 0;
+        bool cabac = false;
+        bool bottomFieldPicOrder = false;
+        bool sliceGroups = false;
+        int numRefIdxL0 = 1;
+        int numRefIdxL1 = 1;
+        bool weightedPred = false;
+        int weightedBipredIdc = 0;
+        int initQp = 26;
+        bool redundantPicCnt = false;
+    };
+
+    // Short-term RPS as delta POCs, negatives (closest first) then positives.
+    struct HevcRps {
+        std::vector<int> deltas;
+        std::vector<uint8_t> used;
+    };
+
+    struct HevcSps {
+        bool valid = false;
+        bool separateColourPlane = false;
+        int chromaArrayType = 1;
+        int log2MaxPocLsb = 4;
+        std::vector<HevcRps> rps;
+        bool longTermRefsPresent = false;
+        std::vector<uint8_t> ltUsed;
+        bool temporalMvp = false;
+        bool sao = false;
+    };
+
+    struct HevcPps {
+        bool valid = false;
+        int spsId = 0;
+        bool outputFlagPresent = false;
+        int numExtraSliceHeaderBits = 0;
+        bool cabacInitPresent = false;
+        int numRefIdxL0 = 1;
+        int numRefIdxL1 = 1;
+        int initQp = 26;
+        bool weightedPred = false;
+        bool weightedBipred = false;
+        bool listsModification = false;
+    };
+
+    static bool parseHevcRps(BitReader& br, size_t idx, const std::vector<HevcRps>& sets,
+                             HevcRps* rps);
+    void parseNal(const uint8_t* nal, size_t size, FrameInfo* info);
+    void parseAvcNal(const uint8_t* nal, size_t size, FrameInfo* info);
+    void parseHevcNal(const uint8_t* nal, size_t size, FrameInfo* info);
+    void record(const FrameInfo& info, uint32_t size, int64_t timestampUs, int64_t latencyUs);
+
+    std::string mSessionId;
+    bool mHevc = false;
+    bool mLengthPrefixed = false;
+    FILE* mLogFile = nullptr;
+    std::vector<uint8_t> mRbsp;
+
+    std::vector<AvcSps> mAvcSps;
+    std::vector<AvcPps> mAvcPps;
+    std::vector<HevcSps> mHevcSps;
+    std::vector<HevcPps> mHevcPps;
+    int mPrefixTemporalId = -1;
+
+    std::mutex mQueuedLock;
+    std::unordered_map<int64_t, std::chrono::steady_clock::time_point> mQueued;
+
+    uint32_t mFrameCnt = 0;
+    uint32_t mTypeCnt[FRAME_TYPE_MAX] = {0};
+    uint64_t mTypeBytes[FRAME_TYPE_MAX] = {0};
+    uint64_t mTypeQpSum[FRAME_TYPE_MAX] = {0};
+    uint32_t mTypeQpCnt[FRAME_TYPE_MAX] = {0};
+    uint32_t mLayerCnt[8] = {0};
+    uint64_t mLayerBytes[8] = {0};
+    uint32_t mLtrMarkCnt = 0;
+    uint32_t mLtrUseCnt = 0;
+    std::vector<int64_t> mLatencies;
+};
+
+#endif  // _BITSTREAM_ANALYZER_H_
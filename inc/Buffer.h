@@ -15,15 +15,52 @@ struct Buffer {
 };
 
 struct DMABuffer : public Buffer {
-    explicit DMABuffer(uint32_t size, int fd) : mSize(size), mFd(dup(fd)) {}
+    DMABuffer() {
+        for (size_t i = 0; i < VIDEO_MAX_PLANES; i++) {
+            mSize[i] = 0;
+            mFd[i] = -1;
+        }
+    }
+    explicit DMABuffer(uint32_t size, int fd) : DMABuffer() { addPlane(size, fd); }
     ~DMABuffer() {
-        if (mFd >= 0) {
-            close(mFd);
-            mFd = -1;
+        for (size_t i = 0; i < VIDEO_MAX_PLANES; i++) {
+            if (mFd[i] >= 0) {
+                close(mFd[i]);
+                mFd[i] = -1;
+            }
+        }
+    }
+    void addPlane(uint32_t size, int fd) {
+        if (mNumPlanes < VIDEO_MAX_PLANES) {
+            mSize[mNumPlanes] = size;
+            mFd[mNumPlanes] = dup(fd);
+            mNumPlanes++;
+        }
+    }
+    uint32_t mSize[VIDEO_MAX_PLANES];
+    int mFd[VIDEO_MAX_PLANES];
+    uint32_t mNumPlanes = 0;
+};
+
+struct UserPtrBuffer : public Buffer {
+    UserPtrBuffer() {
+        for (size_t i = 0; i < VIDEO_MAX_PLANES; i++) {
+            mAddr[i] = nullptr;
+            mSize[i] = 0;
         }
     }
-    uint32_t mSize;
-    int mFd;
+    explicit UserPtrBuffer(void* addr, uint32_t size) : UserPtrBuffer() { addPlane(addr, size); }
+    void addPlane(void* addr, uint32_t size) {
+        if (mNumPlanes < VIDEO_MAX_PLANES) {
+            mAddr[mNumPlanes] = addr;
+            mSize[mNumPlanes] = size;
+            mNumPlanes++;
+        }
+    }
+    // memory is owned by the session's HugePageArena
+    void* mAddr[VIDEO_MAX_PLANES];
+    uint32_t mSize[VIDEO_MAX_PLANES];
+    uint32_t mNumPlanes = 0;
 };
 
 struct MMAPBuffer : public Buffer {
@@ -31,6 +68,7 @@ struct MMAPBuffer : public Buffer {
         for (size_t i = 0; i < VIDEO_MAX_PLANES; i++) {
             start[i] = nullptr;
             length[i] = 0;
+            mFd[i] = -1;
         }
     }
     ~MMAPBuffer() {
@@ -40,15 +78,16 @@ struct MMAPBuffer : public Buffer {
             }
             start[i] = nullptr;
             length[i] = 0;
-        }
-        if (mFd >= 0) {
-            close(mFd);
-            mFd = -1;
+            if (mFd[i] >= 0) {
+                close(mFd[i]);
+                mFd[i] = -1;
+            }
         }
     }
     void *start[VIDEO_MAX_PLANES];
     size_t length[VIDEO_MAX_PLANES];
-    int mFd;
+    int mFd[VIDEO_MAX_PLANES];
+    uint32_t mNumPlanes = 0;
 };
 
 #endif
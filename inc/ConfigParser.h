@@ -57,6 +57,36 @@ struct ConfigureStruct {
     int PauseDurationMS;
     int InputBufferCount;
     int OutputBufferCount;
+    int MaxWidth;
+    int MaxHeight;
+    int MaxBitDepth;
+    int InputBufferSize;
+    bool SharedPacketCache;
+    bool LoopbackEvaluation;
+    bool MappedInput;
+    bool LoopInput;
+    int ReadaheadFrames;
+    int SceneCutThreshold;
+    int SceneCutMinInterval;
+    int PeakBitratePercent;
+    int PacingJitterUs;
+    int InputStartFrame;
+    int StripeCount;
+    int DecodeStartFrame;
+    int DecodeEndFrame;
+    int KeyFrameInterval;
+    int ParallelSessions;
+    int DmaHeapBenchmark;
+    int PostProcessWidth;
+    int PostProcessHeight;
+    int PostProcessThreads;
+    bool CrossCheck;
+    bool InputCopyBenchmark;
+    bool CrossCheckStopOnMismatch;
+    int QualityThreads;
+    int SyntheticSeed;
+    int SyntheticMotion;
+    int SyntheticNoise;
 
     std::string Domain;
     std::string CodecName;
@@ -64,8 +94,34 @@ struct ConfigureStruct {
     std::string Outputpath;
     std::string PixelFormat;
     std::string MemoryType;
+    std::string InputCopyKernel;
+    std::string DmaHeap;
     std::string VideoDevice;
     std::string DumpInputPath;
+    std::string ChecksumType;
+    std::string ChecksumPath;
+    std::string ChecksumReference;
+    std::string ReferenceYUV;
+    std::string QualityPath;
+    std::string CrossCheckCacheDir;
+    std::string SceneCutDetection;
+    std::string BitrateTrace;
+    std::string RateControlLog;
+    std::string BitstreamStats;
+    std::string InputPacing;
+    std::string StripeLayout;
+    std::string LadderRenditions;
+    std::string LadderFilter;
+    std::string PostProcessPath;
+    std::string PostProcessFormat;
+    std::string PostProcessFilter;
+
+    // Set by the stripe encoder for each stripe session, not parsed: the
+    // session encodes the Width x Height region at this offset of the source.
+    int SourceWidth;
+    int SourceHeight;
+    int InputRegionLeft;
+    int InputRegionTop;
 
     std::list<std::shared_ptr<EventConfig>> staticControls;
     std::list<std::shared_ptr<EventConfig>> dynamicControls;
@@ -0,0 +1,43 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _COPY_KERNEL_H_
+#define _COPY_KERNEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+/**
+ * Copies into device buffers. Cached heaps take plain memcpy. Uncached and
+ * write-combined heaps take non-temporal stores (SSE2/AVX2 stream, NEON STNP),
+ * which write whole lines without reading them first and leave the CPU caches
+ * alone; each copy ends with a store fence so the data is visible before the
+ * buffer is queued.
+ */
+class CopyKernel {
+  public:
+    enum Type {
+        COPY_MEMCPY = 0,
+        COPY_STREAM,
+    };
+
+    static int parseType(std::string name, Type* type);
+    static const char* getName(Type type);
+
+    static void copy(Type type, void* dst, const void* src, size_t size);
+    static void copyPlane(Type type, void* dst, size_t dstStride, const void* src,
+                          size_t srcStride, size_t rowBytes, int rows);
+    static void zero(Type type, void* dst, size_t size);
+
+    // Average milliseconds per copyPlane() of rows x rowBytes into dst.
+    static double benchmark(Type type, void* dst, size_t dstStride, size_t rowBytes, int rows,
+                            int iterations);
+};
+
+#endif  // _COPY_KERNEL_H_
@@ -0,0 +1,138 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _DECODE_CROSS_CHECK_H_
+#define _DECODE_CROSS_CHECK_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Log.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+}
+
+class FrameChecksum;
+class FrameQuality;
+
+/**
+ * Cross-checks hardware decoder output against libavcodec. The same input is
+ * decoded in software (frame threading) on a dedicated thread and each frame
+ * is reduced to a CRC32C of its visible NV12 rows; hardware frames are
+ * compared against those digests in display order. The first mismatch is
+ * reported with its PSNR against the software frame.
+ *
+ * checkFrame() never waits for the software decoder: it hashes the hardware
+ * frame and, when the software digest is not there yet, queues the digest
+ * (with a copy of the pixels while no mismatch has been seen, for the PSNR)
+ * for the decode thread to compare. Mismatches found there are logged as
+ * they happen and returned by later checkFrame() calls; frames the software
+ * decode never produced are reported at deinit().
+ *
+ * With a cache directory, digests are stored in "<dir>/<md5 of input>.crc32c"
+ * once a full software decode completes, and later runs on the same input
+ * load that file instead of decoding. Only the first mismatch then triggers
+ * a software decode, up to that frame, to compute its PSNR.
+ */
+class DecodeCrossCheck {
+  public:
+    DecodeCrossCheck() = delete;
+    explicit DecodeCrossCheck(std::string sessionId);
+    ~DecodeCrossCheck();
+
+    std::string id();
+
+    int init(std::string inputPath, int numThreads, std::string cacheDir, bool stopOnMismatch);
+    void deinit();
+
+    int checkFrame(const uint8_t* y, int yStride, const uint8_t* uv, int uvStride, int width,
+                   int height);
+
+    bool isMismatched() const { return mMismatchCnt > 0; }
+
+  private:
+    // A hardware frame waiting for its software digest or reference frame.
+    struct HwFrame {
+        uint32_t frameIdx = 0;
+        std::string digest;
+        // Visible rows, packed; empty when no copy was taken.
+        std::vector<uint8_t> y;
+        std::vector<uint8_t> uv;
+        int width = 0;
+        int height = 0;
+    };
+
+    int hashInput(std::string* hash);
+    int loadCache();
+    void writeCache();
+    int openDecoder();
+    void closeDecoder();
+    void threadLoop();
+    void decodeLoop(int64_t targetFrame);
+    int onReferenceFrame(AVFrame* frame);
+    void snapshot(HwFrame* hw, const uint8_t* y, int yStride, const uint8_t* uv, int uvStride,
+                  int width, int height);
+    void onMismatch(uint32_t frameIdx, const std::string& got, const std::string& expected,
+                    AVFrame* ref, const uint8_t* y, int yStride, const uint8_t* uv, int uvStride,
+                    int width, int height);
+    void digestFrame(const AVFrame* frame);
+    const uint8_t* interleaveChroma(const AVFrame* frame, std::vector<uint8_t>& scratch,
+                                    int* stride);
+    void reportMismatch(uint32_t frameIdx, const std::string& got, const std::string& expected,
+                        AVFrame* ref, const uint8_t* y, int yStride, const uint8_t* uv,
+                        int uvStride, int width, int height);
+
+    std::string mSessionId;
+    std::string mInputPath;
+    std::string mCachePath;
+    int mNumThreads = 1;
+    bool mStopOnMismatch = false;
+
+    std::shared_ptr<FrameChecksum> mHwDigest;
+    std::shared_ptr<FrameChecksum> mSwDigest;
+    std::shared_ptr<FrameQuality> mQuality;
+
+    AVFormatContext* mFmtCtx = nullptr;
+    AVCodecContext* mCodecCtx = nullptr;
+    int mStreamIdx = -1;
+    std::vector<uint8_t> mUVScratch;
+
+    std::shared_ptr<std::thread> mThread;
+    std::mutex mLock;
+    std::condition_variable mCond;
+    // Software digests in display order, and the latest decoded frames for
+    // the PSNR of a mismatch found in checkFrame() (kept until the first one).
+    std::vector<std::string> mDigests;
+    std::map<uint32_t, AVFrame*> mWindow;
+    // Hardware frames decoded ahead of the software decoder.
+    std::map<uint32_t, HwFrame> mPending;
+    int mNumSnapshots = 0;
+    // First mismatch whose reference frame has to be decoded again.
+    std::unique_ptr<HwFrame> mRefRequest;
+    std::string mRefExpected;
+    bool mDecodeDone = false;
+    bool mHwDone = false;
+    bool mFromCache = false;
+    int64_t mTargetFrame = -1;
+    uint32_t mSwFrameCnt = 0;
+
+    uint32_t mFrameCnt = 0;
+    std::atomic<uint32_t> mMismatchCnt{0};
+};
+
+#endif  // _DECODE_CROSS_CHECK_H_
@@ -0,0 +1,41 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _DMA_HEAP_BENCHMARK_H_
+#define _DMA_HEAP_BENCHMARK_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "Log.h"
+
+/**
+ * Per-frame CPU cost of each heap in /dev/dma_heap for one NV12 frame:
+ * fill (copy into the buffer with the heap's copy kernel), dump (read the
+ * visible rows back, as output dumps and checksums do; file I/O excluded)
+ * and the DMA_BUF_IOCTL_SYNC pairs around both. Sessions skip the sync on
+ * uncached heaps, so it is reported but left out of their total.
+ */
+class DmaHeapBenchmark {
+  public:
+    DmaHeapBenchmark() = delete;
+    explicit DmaHeapBenchmark(std::string sessionId);
+
+    std::string id();
+
+    int run(int width, int height, int stride, int scanline, int iterations);
+
+  private:
+    int runHeap(const std::string& heap, const std::vector<uint8_t>& frame, int width,
+                int height, int stride, int scanline, int iterations);
+
+    std::string mSessionId;
+};
+
+#endif  // _DMA_HEAP_BENCHMARK_H_
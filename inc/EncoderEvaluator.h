@@ -0,0 +1,76 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _ENCODER_EVALUATOR_H_
+#define _ENCODER_EVALUATOR_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Log.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+
+class FrameQuality;
+
+/**
+ * Loopback quality check for the encoder. Every encoded CAPTURE buffer is
+ * decoded by libavcodec on a dedicated thread and the reconstruction is
+ * scored against the source frame retained from FFYUVParser, matched by
+ * buffer timestamp. Per-frame size/PSNR/SSIM and a rate-distortion summary
+ * are reported through FrameQuality.
+ */
+class EncoderEvaluator {
+  public:
+    EncoderEvaluator() = delete;
+    explicit EncoderEvaluator(std::string sessionId);
+    ~EncoderEvaluator();
+
+    std::string id();
+
+    int init(unsigned int codecFmt, int width, int height, double frameRate, int numThreads,
+             std::string logPath);
+    void deinit();
+
+    void pushSource(int64_t timestampUs, AVPacket* frame);
+    int pushEncoded(const uint8_t* data, int size, int64_t timestampUs);
+
+  private:
+    void threadLoop();
+    int receiveFrames();
+    void evaluateFrame(AVFrame* frame);
+
+    std::string mSessionId;
+    std::shared_ptr<FrameQuality> mQuality;
+
+    AVCodecContext* mCodecCtx = nullptr;
+    AVFrame* mFrame = nullptr;
+    int mWidth = 0;
+    int mHeight = 0;
+    std::vector<uint8_t> mUVScratch;
+
+    std::shared_ptr<std::thread> mThread;
+    std::mutex mLock;
+    std::condition_variable mCond;
+    std::deque<AVPacket*> mPackets;
+    std::map<int64_t, AVPacket*> mSources;
+    std::map<int64_t, int> mFrameBytes;
+    bool mFlush = false;
+};
+
+#endif  // _ENCODER_EVALUATOR_H_
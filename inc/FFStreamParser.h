@@ -8,9 +8,12 @@
 #ifndef _FFPARSER_H_
 #define _FFPARSER_H_
 
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "CopyKernel.h"
 #include "Log.h"
 
 extern "C" {
@@ -19,10 +22,15 @@ extern "C" {
 #include <libavformat/avformat.h>
 }
 
+class PacketCache;
+
 class FFStreamParser {
   public:
     FFStreamParser() = delete;
-    explicit FFStreamParser(std::string inputPath, std::string sessionId);
+    // With sharedCache set, packets come from the process-wide PacketCache of
+    // inputPath instead of a private demuxer.
+    explicit FFStreamParser(std::string inputPath, std::string sessionId,
+                            bool sharedCache = false);
     ~FFStreamParser();
 
     std::string id();
@@ -34,9 +42,26 @@ class FFStreamParser {
     int loopPackets();
     int getNextPacket();
     int seekToFrame(int frame);
-    int fillPacketData(void* dst, bool& eos);
+    int fillPacketData(void* dst, int dstSize, bool& eos);
+    int readPacket(std::vector<uint8_t>& dst, bool* keyFrame = nullptr);
+
+    // Decodes [start, end) from the keyframe at or before start; returns
+    // that keyframe, whose frames up to start the caller drops.
+    int setDecodeRange(int start, int end);
+    // Feeds only every Nth keyframe; 0 feeds every packet.
+    void setKeyFrameStride(int stride) { mKeyFrameStride = stride; }
+    bool isKeyFrame(int frame) const;
+    const std::vector<int>& getKeyFrames() const { return mKeyFrameList; }
+    int getTotalFrameCount() const { return mTotalFrameCnt; }
+
+    int getMaxPacketSize() const { return mMaxPktSize; }
+    int getPacketSizePercentile(int percentile);
+    void setCopyKernel(CopyKernel::Type type) { mCopyKernel = type; }
 
   private:
+    bool isKeyPacket();
+    int nextSelectedKeyFrame(int frame);
+
     AVPacket* mPkt = nullptr;
     AVStream* mStream = nullptr;
     AVBSFContext* mBsf = nullptr;
@@ -45,6 +70,10 @@ class FFStreamParser {
     bool mRawVideo = true;
     bool mBsfDataPending = false;
 
+    bool mUseSharedCache = false;
+    std::shared_ptr<const PacketCache> mCache;
+    int mCursor = 0;
+
     std::string mInputPath = "";
     std::string mSessionId = "";
 
@@ -55,7 +84,19 @@ class FFStreamParser {
     int mCodecFmt = 0;
     int mTotalFrameCnt = 0;
 
+    int mMaxPktSize = 0;
+    CopyKernel::Type mCopyKernel = CopyKernel::COPY_MEMCPY;
+
     std::unordered_map<int, uint64_t> mPktPosition;
+    std::vector<int> mPktSizes;
+
+    // Packet index: demux timestamp per packet and the packets that are keyframes.
+    std::vector<int64_t> mPktTimestamps;
+    std::vector<int> mKeyFrameList;
+    int64_t mSkipToTs = AV_NOPTS_VALUE;
+    int mNextFrame = 0;
+    int mEndFrame = -1;
+    int mKeyFrameStride = 0;
 };
 
 #endif
@@ -9,6 +9,7 @@
 #define _FF_YUV_PARSER_H_
 
 #include <string>
+#include "CopyKernel.h"
 #include "Log.h"
 
 extern "C" {
@@ -25,11 +26,20 @@ class FFYUVParser {
 
     std::string id();
     int init();
-    int fillPacketData(void* dst, int width, int height, int stride, int scanline, int colorFormat,
-                       bool& eos);
+    // dstUV receives the chroma plane of multi-planar formats; pass nullptr when
+    // it follows the luma plane at stride * scanline in dst.
+    int fillPacketData(void* dst, void* dstUV, int width, int height, int stride, int scanline,
+                       int colorFormat, bool& eos);
     int deinit();
     int loopPackets();
 
+    // When enabled, the packed frame behind the last fillPacketData() is kept
+    // as a reference-counted packet; the caller owns what takeRetainedFrame()
+    // returns and frees it with av_packet_free().
+    void setRetainFrames(bool retain) { mRetainFrames = retain; }
+    AVPacket* takeRetainedFrame();
+    void setCopyKernel(CopyKernel::Type type) { mCopyKernel = type; }
+
   private:
     FILE* mInputFile = nullptr;
 
@@ -42,6 +52,9 @@ class FFYUVParser {
     std::string mSessionId = "";
 
     AVPacket* mPkt = nullptr;
+    AVPacket* mRetainedPkt = nullptr;
+    bool mRetainFrames = false;
+    CopyKernel::Type mCopyKernel = CopyKernel::COPY_MEMCPY;
     AVFormatContext* mFmtCtx = nullptr;
     AVDictionary* mFmtOptions = nullptr;
 };
@@ -0,0 +1,75 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _FRAME_CHECKSUM_H_
+#define _FRAME_CHECKSUM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "Log.h"
+
+struct AVMD5;
+
+/**
+ * Per-frame digest of decoded output. Callers feed the visible rows of a frame
+ * between begin() and end(); end() appends "<frame> <digest>" to the digest
+ * file and, when a reference file is loaded, compares against its entry.
+ * Reference files may be plain digest lists or ffmpeg framemd5 output: the
+ * last token of every non-comment line is taken as the digest.
+ */
+class FrameChecksum {
+  public:
+    FrameChecksum() = delete;
+    explicit FrameChecksum(std::string sessionId);
+    ~FrameChecksum();
+
+    std::string id();
+
+    int init(std::string type, std::string outputPath, std::string referencePath);
+    void deinit();
+
+    // Numbers digests, and indexes the reference, from frame first on.
+    void setFirstFrame(uint32_t first) { mFirstFrame = mFrameCnt = first; }
+
+    void begin();
+    void update(const uint8_t* data, size_t size);
+    int end();
+
+    bool isMismatched() const { return mMismatchCnt > 0; }
+    // Digest produced by the last end(), as written to the digest file.
+    const std::string& getLastDigest() const { return mLastDigest; }
+
+  private:
+    enum ChecksumType {
+        CHECKSUM_CRC32C = 0,
+        CHECKSUM_MD5,
+    };
+
+    int loadReference(std::string referencePath);
+
+    std::string mSessionId;
+    ChecksumType mType = CHECKSUM_CRC32C;
+
+    uint32_t mCrc = 0;
+    struct AVMD5* mMd5 = nullptr;
+
+    FILE* mOutputFile = nullptr;
+    std::vector<std::string> mExpected;
+    bool mHasReference = false;
+
+    std::string mLastDigest;
+    uint32_t mFirstFrame = 0;
+    uint32_t mFrameCnt = 0;
+    uint32_t mMismatchCnt = 0;
+};
+
+#endif  // _FRAME_CHECKSUM_H_
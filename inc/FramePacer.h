@@ -0,0 +1,74 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _FRAME_PACER_H_
+#define _FRAME_PACER_H_
+
+#include <stdint.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Log.h"
+
+/**
+ * Encoder input pacing. In "realtime" mode frame N is released at its
+ * capture time, start + N * period plus an optional uniform jitter, like a
+ * live camera. Deadlines are absolute on the monotonic clock so sleep
+ * overshoot never accumulates into drift. A frame queued more than one
+ * period after its capture time is counted late, since a camera would have
+ * replaced it by then. In "max" mode frames are queued as soon as an input
+ * buffer is free.
+ *
+ * Both modes report capture-to-bitstream latency, measured from the capture
+ * time (or the QBUF time in "max" mode) to the DQBUF of the encoded frame.
+ */
+class FramePacer {
+  public:
+    FramePacer() = delete;
+    explicit FramePacer(std::string sessionId);
+    ~FramePacer();
+
+    std::string id();
+
+    int init(std::string mode, double frameRate, int jitterUs);
+    void deinit();
+
+    // Sleeps until frame frameIdx is due or maxWaitUs passed; true when due.
+    bool waitForFrame(uint32_t frameIdx, int64_t maxWaitUs);
+    void onQueued(uint32_t frameIdx, int64_t timestampUs);
+    void onFrameEncoded(int64_t timestampUs);
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::time_point captureTime(uint32_t frameIdx);
+
+    std::string mSessionId;
+    bool mRealtime = false;
+    double mPeriodUs = 0;
+    int mJitterUs = 0;
+    uint64_t mJitterState = 0;
+
+    bool mStarted = false;
+    Clock::time_point mStart;
+    bool mScheduledValid = false;
+    uint32_t mScheduledIdx = 0;
+    Clock::time_point mScheduled;
+
+    std::mutex mLock;
+    std::unordered_map<int64_t, Clock::time_point> mCaptured;
+    std::vector<int64_t> mLatencies;
+    uint32_t mQueuedCnt = 0;
+    uint32_t mLateCnt = 0;
+    int64_t mMaxLatenessUs = 0;
+};
+
+#endif  // _FRAME_PACER_H_
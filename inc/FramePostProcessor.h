@@ -0,0 +1,78 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _FRAME_POST_PROCESSOR_H_
+#define _FRAME_POST_PROCESSOR_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FrameScaler.h"
+#include "Log.h"
+#include "WorkerPool.h"
+
+/**
+ * Post-processing of decoded NV12 frames into a raw output file: optional
+ * scaling (FrameScaler, bilinear or box) followed by conversion to NV12,
+ * I420, RGB24 or RGBA. Frames are read in place from the mapped CAPTURE
+ * buffer with their plane strides; rows are split over a WorkerPool.
+ *
+ * RGB uses BT.601 limited range in 6-bit fixed point with saturating 16-bit
+ * arithmetic, so the SSE2/NEON kernels and the scalar tail give identical
+ * results.
+ */
+class FramePostProcessor {
+  public:
+    FramePostProcessor() = delete;
+    explicit FramePostProcessor(std::string sessionId);
+    ~FramePostProcessor();
+
+    std::string id();
+
+    // width/height 0 keep the decoded size.
+    int init(std::string format, int width, int height, std::string filter,
+             std::string outputPath, int numThreads);
+    void deinit();
+
+    int process(const uint8_t* y, int yStride, const uint8_t* uv, int uvStride, int width,
+                int height);
+
+  private:
+    enum Format {
+        FORMAT_NV12 = 0,
+        FORMAT_I420,
+        FORMAT_RGB24,
+        FORMAT_RGBA,
+    };
+
+    void convert(const uint8_t* y, int yStride, const uint8_t* uv, int uvStride, int width,
+                 int height);
+
+    std::string mSessionId;
+    Format mFormat = FORMAT_NV12;
+    FrameScaler::Filter mFilter = FrameScaler::FILTER_BILINEAR;
+    int mDstWidth = 0;
+    int mDstHeight = 0;
+    FILE* mOutputFile = nullptr;
+    std::shared_ptr<WorkerPool> mPool;
+
+    // Rebuilt when the decoded size changes.
+    std::shared_ptr<FrameScaler> mScaler;
+    int mSrcWidth = 0;
+    int mSrcHeight = 0;
+    std::vector<uint8_t> mScaled;
+    std::vector<uint8_t> mOutput;
+
+    uint32_t mFrameCnt = 0;
+    double mTotalMs = 0;
+};
+
+#endif  // _FRAME_POST_PROCESSOR_H_
@@ -0,0 +1,82 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _FRAME_QUALITY_H_
+#define _FRAME_QUALITY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+
+#include "Log.h"
+#include "WorkerPool.h"
+
+enum QualityPlane {
+    QUALITY_PLANE_Y = 0,
+    QUALITY_PLANE_U,
+    QUALITY_PLANE_V,
+    QUALITY_PLANE_MAX,
+};
+
+struct QualityMetrics {
+    uint64_t sse[QUALITY_PLANE_MAX] = {0};
+    uint64_t samples[QUALITY_PLANE_MAX] = {0};
+    double psnr[QUALITY_PLANE_MAX] = {0};
+    double ssim[QUALITY_PLANE_MAX] = {0};
+};
+
+/**
+ * Objective quality of 8-bit NV12 frames: per-plane PSNR and SSIM (8x8
+ * windows on a 4 pixel grid). Rows are split into stripes on a WorkerPool.
+ * A reference file, if opened, is mmap'd and consumed one frame per
+ * measure() call; compare() takes both frames from the caller.
+ */
+class FrameQuality {
+  public:
+    FrameQuality() = delete;
+    explicit FrameQuality(std::string sessionId);
+    ~FrameQuality();
+
+    std::string id();
+
+    int init(int numThreads, std::string logPath);
+    int openReference(std::string referencePath, int width, int height);
+    void deinit();
+
+    int measure(const uint8_t* y, int yStride, const uint8_t* uv, int uvStride, int width,
+                int height);
+    void compare(const uint8_t* y, int yStride, const uint8_t* uv, int uvStride,
+                 const uint8_t* refY, int refYStride, const uint8_t* refUV, int refUVStride,
+                 int width, int height, QualityMetrics* metrics);
+    void record(const QualityMetrics& metrics, int frameBytes = -1);
+
+    uint32_t getFrameCount() const { return mFrameCnt; }
+    // Lets the summary report bitrate for rate-distortion (BD-rate) curves.
+    void setFrameRate(double fps) { mFrameRate = fps; }
+
+  private:
+    std::string mSessionId;
+    std::shared_ptr<WorkerPool> mPool;
+
+    FILE* mLogFile = nullptr;
+
+    const uint8_t* mRefBase = nullptr;
+    size_t mRefSize = 0;
+    int mRefWidth = 0;
+    int mRefHeight = 0;
+    bool mRefExhausted = false;
+
+    uint32_t mFrameCnt = 0;
+    uint64_t mTotalBytes = 0;
+    double mFrameRate = 0;
+    QualityMetrics mTotal;
+};
+
+#endif  // _FRAME_QUALITY_H_
@@ -0,0 +1,85 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _FRAME_SCALER_H_
+#define _FRAME_SCALER_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "Log.h"
+
+class WorkerPool;
+
+/**
+ * Stride-aware NV12 to NV12 scaler. Each destination row is built in two
+ * passes: a vectorized (SSE2/NEON) vertical pass blends two source rows
+ * (bilinear) or sums every source row it covers (box) into a row buffer,
+ * then a horizontal pass resamples that row with precomputed taps. Equal
+ * sizes are copied row by row. Bilinear suits any ratio; box averages the
+ * whole footprint and is the better downscaler at large ratios.
+ *
+ * Rows may be split over a WorkerPool; the object itself is read-only once
+ * initialized, so several threads may scale with it at the same time.
+ */
+class FrameScaler {
+  public:
+    enum Filter {
+        FILTER_BILINEAR = 0,
+        FILTER_BOX,
+    };
+
+    FrameScaler() = delete;
+    explicit FrameScaler(std::string sessionId);
+    ~FrameScaler() = default;
+
+    std::string id();
+
+    static int parseFilter(std::string name, Filter* filter);
+
+    int init(int srcWidth, int srcHeight, int dstWidth, int dstHeight, Filter filter);
+
+    void scaleNV12(const uint8_t* srcY, int srcStride, const uint8_t* srcUV, int srcUVStride,
+                   uint8_t* dstY, int dstStride, uint8_t* dstUV, int dstUVStride,
+                   WorkerPool* pool = nullptr) const;
+
+    int getDstWidth() const { return mLuma.dstW; }
+    int getDstHeight() const { return mLuma.dstH; }
+
+  private:
+    // Sampling of one plane; chroma is a 2-channel plane at half size.
+    struct PlaneMap {
+        int srcW = 0;
+        int srcH = 0;
+        int dstW = 0;
+        int dstH = 0;
+        int channels = 1;
+        // Bilinear: first tap and 7-bit weight of the second one.
+        std::vector<int> x0;
+        std::vector<uint8_t> fx;
+        std::vector<int> y0;
+        std::vector<uint8_t> fy;
+        // Box: footprint [xb, xe) x [yb, ye) of each destination sample.
+        std::vector<int> xb;
+        std::vector<int> xe;
+        std::vector<int> yb;
+        std::vector<int> ye;
+    };
+
+    static void buildMap(PlaneMap* map, int srcW, int srcH, int dstW, int dstH, int channels);
+    void scaleRows(const PlaneMap& map, const uint8_t* src, int srcStride, uint8_t* dst,
+                   int dstStride, int rowBegin, int rowEnd) const;
+
+    std::string mSessionId;
+    Filter mFilter = FILTER_BILINEAR;
+    PlaneMap mLuma;
+    PlaneMap mChroma;
+};
+
+#endif  // _FRAME_SCALER_H_
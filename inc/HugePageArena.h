@@ -0,0 +1,49 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _HUGE_PAGE_ARENA_H_
+#define _HUGE_PAGE_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Log.h"
+
+/**
+ * One contiguous, pre-faulted and mlocked region that V4L2_MEMORY_USERPTR
+ * buffers are carved from. Backed by explicit huge pages (MAP_HUGETLB) when
+ * the hugetlb pool allows it, transparent huge pages otherwise.
+ */
+class HugePageArena {
+  public:
+    HugePageArena() = delete;
+    explicit HugePageArena(std::string sessionId);
+    ~HugePageArena();
+
+    std::string id();
+
+    int init(size_t size);
+    void deinit();
+    void* carve(size_t size);
+
+    bool isHugeTlb() const { return mHugeTlb; }
+    size_t getSize() const { return mSize; }
+
+  private:
+    std::string mSessionId;
+
+    uint8_t* mBase = nullptr;
+    size_t mSize = 0;
+    size_t mUsed = 0;
+
+    bool mHugeTlb = false;
+    bool mLocked = false;
+};
+
+#endif  // _HUGE_PAGE_ARENA_H_
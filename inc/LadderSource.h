@@ -0,0 +1,84 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _LADDER_SOURCE_H_
+#define _LADDER_SOURCE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Log.h"
+
+/**
+ * NV12 source shared by the encoder sessions of an ABR ladder. Each frame is
+ * read from the file once, by whichever session asks for it first, into a
+ * reference-counted buffer that every session scales or copies into its own
+ * input buffers. The source drops its reference once all sessions have
+ * taken the frame; each session holds its reference until the input buffer
+ * the frame went into is dequeued, so a frame is freed when the last of those
+ * buffers returns.
+ *
+ * Sessions may run at different speeds, but no session gets more than
+ * `window` frames ahead of the slowest one, which bounds memory.
+ */
+class LadderSource {
+  public:
+    typedef std::vector<uint8_t> Frame;
+
+    LadderSource() = delete;
+    explicit LadderSource(std::string inputPath, std::string sessionId);
+    ~LadderSource();
+
+    std::string id();
+
+    int init(int width, int height, int numSessions, int window);
+    void deinit();
+
+    // Frame frameIdx for session slot [0, numSessions), packed NV12; nullptr
+    // at the end of the input.
+    std::shared_ptr<const Frame> getFrame(int slot, uint32_t frameIdx);
+    // Session slot is done, or never started; frames stop waiting for it.
+    void leave(int slot);
+
+    int getWidth() const { return mWidth; }
+    int getHeight() const { return mHeight; }
+
+  private:
+    struct Entry {
+        std::shared_ptr<const Frame> frame;
+        uint64_t takenMask = 0;
+    };
+
+    void dropTakenLocked();
+
+    std::string mInputPath;
+    std::string mSessionId;
+    FILE* mInputFile = nullptr;
+    int mWidth = 0;
+    int mHeight = 0;
+    size_t mFrameSize = 0;
+    int mWindow = 0;
+
+    std::mutex mLock;
+    std::condition_variable mProgress;
+    std::map<uint32_t, Entry> mFrames;
+    uint64_t mAllMask = 0;
+    uint64_t mDoneMask = 0;
+    uint32_t mNextRead = 0;
+    bool mEof = false;
+    uint64_t mBytesRead = 0;
+    uint64_t mFramesServed = 0;
+};
+
+#endif  // _LADDER_SOURCE_H_
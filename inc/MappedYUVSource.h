@@ -0,0 +1,86 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _MAPPED_YUV_SOURCE_H_
+#define _MAPPED_YUV_SOURCE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "CopyKernel.h"
+#include "Log.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+/**
+ * Raw encoder input read through a read-only mmap of the whole file instead
+ * of per-frame read() calls. The mapping is advised MADV_SEQUENTIAL and the
+ * next few frames are prefetched with MADV_WILLNEED as each frame is copied
+ * out of the page cache into the V4L2 buffer. With looping enabled the source
+ * wraps to frame 0 at the end of the file, so NumFrames is not bounded by the
+ * clip length.
+ */
+class MappedYUVSource {
+  public:
+    MappedYUVSource() = delete;
+    explicit MappedYUVSource(std::string inputPath, std::string sessionId);
+    ~MappedYUVSource();
+
+    std::string id();
+
+    int init(int width, int height, int colorFormat, bool loop, int readaheadFrames);
+    void deinit();
+
+    // Same contract as FFYUVParser::fillPacketData().
+    int fillPacketData(void* dst, void* dstUV, int width, int height, int stride, int scanline,
+                       int colorFormat, bool& eos);
+
+    void setRetainFrames(bool retain) { mRetainFrames = retain; }
+    void setCopyKernel(CopyKernel::Type type) { mCopyKernel = type; }
+    AVPacket* takeRetainedFrame();
+
+    // Restricts output to a rectangle of each frame, read in place from the
+    // mapping; fillPacketData() then takes the rectangle size. Linear only.
+    int setRegion(int left, int top, int width, int height);
+
+    // Makes frame the next one returned by fillPacketData().
+    int seekToFrame(uint32_t frame);
+    uint32_t getFrameCount() const { return mNumFrames; }
+
+  private:
+    void readahead(uint32_t frameIdx);
+
+    std::string mInputPath;
+    std::string mSessionId;
+
+    int mFd = -1;
+    const uint8_t* mBase = nullptr;
+    size_t mMapSize = 0;
+    size_t mFrameSize = 0;
+    uint32_t mNumFrames = 0;
+    uint32_t mFrameIdx = 0;
+    uint64_t mLoops = 0;
+
+    int mWidth = 0;
+    int mHeight = 0;
+    int mColorFormat = 0;
+    int mRegionLeft = 0;
+    int mRegionTop = 0;
+    bool mCompressed = false;
+    bool mLoop = false;
+    CopyKernel::Type mCopyKernel = CopyKernel::COPY_MEMCPY;
+    int mReadaheadFrames = 0;
+
+    bool mRetainFrames = false;
+    AVPacket* mRetainedPkt = nullptr;
+};
+
+#endif  // _MAPPED_YUV_SOURCE_H_
@@ -0,0 +1,62 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _PACKET_CACHE_H_
+#define _PACKET_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Log.h"
+
+/**
+ * Process-wide, read-only copy of every video packet of one input file.
+ * The first session that asks for a path demuxes it once into a single arena
+ * plus a frame index with keyframe flags; every later session decoding the
+ * same path shares it and only keeps its own cursor. The cache is dropped once
+ * no session holds it.
+ */
+class PacketCache {
+  public:
+    PacketCache() = delete;
+    explicit PacketCache(std::string inputPath);
+    ~PacketCache() = default;
+
+    std::string id();
+
+    static std::shared_ptr<const PacketCache> acquire(const std::string& inputPath,
+                                                      const std::string& sessionId);
+
+    int getPacketCount() const { return (int)mSizes.size(); }
+    const uint8_t* getPacketData(int index) const { return mArena.data() + mOffsets[index]; }
+    int getPacketSize(int index) const { return mSizes[index]; }
+    int getMaxPacketSize() const { return mMaxPktSize; }
+    const std::vector<int>& getPacketSizes() const { return mSizes; }
+    bool isKeyFrame(int index) const { return mKeyFrames[index]; }
+
+  private:
+    int build(const std::string& sessionId);
+
+    std::string mInputPath;
+    std::string mSessionId;
+
+    std::vector<uint8_t> mArena;
+    std::vector<size_t> mOffsets;
+    std::vector<int> mSizes;
+    std::vector<uint8_t> mKeyFrames;
+    int mMaxPktSize = 0;
+
+    std::mutex mBuildLock;
+    bool mBuilt = false;
+};
+
+#endif  // _PACKET_CACHE_H_
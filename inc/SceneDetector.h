@@ -0,0 +1,65 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _SCENE_DETECTOR_H_
+#define _SCENE_DETECTOR_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "Log.h"
+
+/**
+ * Scene cut detection on encoder input luma. Every other row of the frame is
+ * compared with the previous frame, either as a mean absolute difference
+ * (SIMD SAD) or as the share of pixels that moved between 64-bin luma
+ * histograms. A cut needs the score to exceed both the threshold and twice
+ * the running average, and at least minInterval frames since the last cut,
+ * so sustained motion and flashes do not trigger keyframes.
+ */
+class SceneDetector {
+  public:
+    SceneDetector() = delete;
+    explicit SceneDetector(std::string sessionId);
+    ~SceneDetector() = default;
+
+    std::string id();
+
+    int init(std::string method, int threshold, int minInterval);
+    bool analyze(const uint8_t* y, int stride, int width, int height);
+
+    uint32_t getCutCount() const { return mCutCnt; }
+
+  private:
+    enum Method {
+        METHOD_SAD = 0,
+        METHOD_HISTOGRAM,
+    };
+
+    double sadScore(const uint8_t* y, int stride, int width, int height);
+    double histogramScore(const uint8_t* y, int stride, int width, int height);
+
+    std::string mSessionId;
+    Method mMethod = METHOD_SAD;
+    double mThreshold = 0;
+    int mMinInterval = 0;
+
+    std::vector<uint8_t> mPrevRows;
+    std::vector<uint32_t> mPrevHist;
+    bool mHasPrev = false;
+    int mPrevWidth = 0;
+    int mPrevHeight = 0;
+
+    double mAverage = 0;
+    uint32_t mFrameCnt = 0;
+    int64_t mLastCut = 0;
+    uint32_t mCutCnt = 0;
+};
+
+#endif  // _SCENE_DETECTOR_H_
@@ -0,0 +1,71 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _SYNTHETIC_SOURCE_H_
+#define _SYNTHETIC_SOURCE_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "Log.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+/**
+ * Generated NV12 encoder input, written straight into the input buffer at its
+ * stride and scanline so throughput runs are not bound by storage. A periodic
+ * 512x512 texture (gradient, seeded noise or both) is panned by Motion pixels
+ * per frame, fresh film grain of amplitude Noise is added per row, and the
+ * "text" patterns overlay a scrolling banner with the frame number. Frame n
+ * depends only on the seed, the parameters and n.
+ */
+class SyntheticSource {
+  public:
+    SyntheticSource() = delete;
+    explicit SyntheticSource(std::string sessionId);
+    ~SyntheticSource();
+
+    std::string id();
+
+    int init(std::string pattern, int width, int height, uint32_t seed, int motion, int noise);
+    void deinit();
+
+    // Same contract as FFYUVParser::fillPacketData(); never signals eos.
+    int fillPacketData(void* dst, void* dstUV, int width, int height, int stride, int scanline,
+                       int colorFormat, bool& eos);
+
+    void setRetainFrames(bool retain) { mRetainFrames = retain; }
+    AVPacket* takeRetainedFrame();
+
+  private:
+    void buildTextures();
+    void render(uint8_t* y, uint8_t* uv, int stride, uint32_t frameIdx);
+    void drawBanner(uint8_t* y, int stride, uint32_t frameIdx);
+
+    std::string mSessionId;
+    std::string mPattern;
+    int mWidth = 0;
+    int mHeight = 0;
+    uint32_t mSeed = 0;
+    int mMotion = 0;
+    int mNoise = 0;
+    bool mText = false;
+
+    std::vector<uint8_t> mLumaTile;
+    std::vector<uint8_t> mChromaTile;
+    std::vector<uint8_t> mGrain;
+
+    uint32_t mFrameIdx = 0;
+    bool mRetainFrames = false;
+    AVPacket* mRetainedPkt = nullptr;
+};
+
+#endif  // _SYNTHETIC_SOURCE_H_
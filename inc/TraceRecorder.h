@@ -0,0 +1,102 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _TRACE_RECORDER_H_
+#define _TRACE_RECORDER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Process-wide recorder of timestamped begin/end events, written as a Chrome
+ * JSON trace that chrome://tracing and ui.perfetto.dev open. Each session is
+ * shown as a process and each thread as a thread of it; a frame is one flow
+ * arrow from the slice that filled its input buffer to the slice that
+ * dequeued its CAPTURE buffer.
+ *
+ * Every thread appends to its own buffer, so recording takes no lock once the
+ * thread's first event has registered the buffer. Event names must be string
+ * literals. Recording is off, and each call a single load, until enable().
+ */
+class TraceRecorder {
+  public:
+    static TraceRecorder& get();
+    static bool isEnabled() { return sEnabled.load(std::memory_order_relaxed); }
+
+    std::string id() { return "trace"; }
+
+    void enable(std::string outputPath);
+    // Writes every buffer recorded so far; call once sessions are done.
+    int write();
+
+    // Track of a session, by session id; the same id gets the same track.
+    int registerSession(const std::string& sessionId);
+
+    void begin(int session, const char* name);
+    void end(int session, const char* name);
+    void instant(int session, const char* name);
+    // Flow ids are per session; start and end bind to the enclosing slices.
+    void flowStart(int session, uint64_t id);
+    void flowEnd(int session, uint64_t id);
+
+  private:
+    struct Event {
+        uint64_t tsNs;
+        const char* name;
+        uint64_t id;
+        int32_t session;
+        char phase;
+    };
+    struct ThreadBuffer {
+        int tid = 0;
+        std::vector<Event> events;
+    };
+
+    TraceRecorder() = default;
+    void record(int session, char phase, const char* name, uint64_t id);
+    ThreadBuffer* getThreadBuffer();
+
+    static std::atomic_bool sEnabled;
+
+    std::mutex mLock;
+    std::string mOutputPath;
+    uint64_t mStartNs = 0;
+    std::vector<std::unique_ptr<ThreadBuffer>> mBuffers;
+    std::unordered_map<std::string, int> mSessionIds;
+    std::vector<std::string> mSessionNames;
+};
+
+/**
+ * Begin/end pair for the enclosing scope.
+ */
+class TraceScope {
+  public:
+    TraceScope(int session, const char* name) : mSession(session), mName(name) {
+        if (TraceRecorder::isEnabled()) {
+            TraceRecorder::get().begin(mSession, mName);
+            mActive = true;
+        }
+    }
+    ~TraceScope() {
+        if (mActive) {
+            TraceRecorder::get().end(mSession, mName);
+        }
+    }
+
+  private:
+    int mSession;
+    const char* mName;
+    bool mActive = false;
+};
+
+#endif  // _TRACE_RECORDER_H_
@@ -11,12 +11,17 @@
 #include <atomic>
 #include <cstring>
 #include <list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
+#include <vector>
 
 #include "ConfigParser.h"
+#include "CopyKernel.h"
+#include "HugePageArena.h"
 #include "Log.h"
+#include "TraceRecorder.h"
 #include "V4l2Driver.h"
 
 class MapBuf {
@@ -95,6 +100,12 @@ class V4l2Codec {
         mHeight = height;
         return 0;
     }
+    int setMaxResolution(int width, int height, int bitDepth) {
+        mMaxWidth = width;
+        mMaxHeight = height;
+        mMaxBitDepth = bitDepth;
+        return 0;
+    }
     int getFrameWidth() const { return mWidth; }
     int getFrameHeight() const { return mHeight; }
     int getFrameStride() const { return mStride; }
@@ -103,6 +114,7 @@ class V4l2Codec {
     int setDynamicControls(unsigned int currFrame);
     int setDynamicCommands(unsigned int currFrame);
     int setControl(unsigned int ctrlId, int value);
+    int setControls(std::vector<struct v4l2_ext_control>& ctrls);
     int setInputSizeOverWrite(int size);
     int setInputActualCount(int count);
     int setOutputActualCount(int count);
@@ -113,6 +125,15 @@ class V4l2Codec {
     int getOutputSize() const { return mOutputSize; }
     int getOutputBufferWidth() const { return mOBufWidth; }
     int getOubputBufferHeight() const { return mOBufHeight; }
+    int getNumPlanes(enum port_type port) const {
+        return port == INPUT_PORT ? mNumInputPlanes : mNumOutputPlanes;
+    }
+    uint32_t getPlaneSize(enum port_type port, int plane) const {
+        return port == INPUT_PORT ? mInputPlaneSize[plane] : mOutputPlaneSize[plane];
+    }
+    uint32_t getPlaneStride(enum port_type port, int plane) const {
+        return port == INPUT_PORT ? mInputPlaneStride[plane] : mOutputPlaneStride[plane];
+    }
 
     int startInput();
     int startOutput();
@@ -125,8 +146,24 @@ class V4l2Codec {
     int setOutputBufferData(std::shared_ptr<v4l2_buffer> buf);
     int setDump(std::string inputFile, std::string outputFile);
     int setMemoryType(std::string memoryType);
+    // Any entry of /dev/dma_heap, used with DMA_BUF memory.
+    int setDmaHeap(std::string heap);
+    // "auto" picks the kernel for the DMA heap, or memcpy for MMAP and USERPTR.
+    int setCopyKernel(std::string name);
+    // Times each copy kernel into the first input buffer; "auto" keeps the faster.
+    int benchmarkCopyKernels();
+    // Logs fill, dump and sync cost per frame on every DMA heap.
+    int benchmarkDmaHeaps(int iterations);
 
   protected:
+    void updatePlaneInfo(const struct v4l2_format* fmt);
+    // Copy kernel and cache maintenance for the opened heap.
+    void configureHeapAccess();
+    int syncDmaBuf(int fd, uint64_t flags);
+    // Hands mCopyKernel to the sources that fill input buffers.
+    virtual void applyCopyKernel() {}
+    int validateControl(unsigned int ctrlId, int value);
+
     std::mutex mInputBufLock;
     std::mutex mOutputBufLock;
     std::shared_ptr<V4l2Driver> mV4l2Driver;
@@ -136,14 +173,21 @@ class V4l2Codec {
     std::unordered_map<int, std::shared_ptr<Buffer>> mInputBuffersPool;
     std::unordered_map<int, std::shared_ptr<Buffer>> mOutputBuffersPool;
 
+    // USERPTR backing store, one arena per port so DRC can reallocate output alone.
+    std::shared_ptr<HugePageArena> mInputArena;
+    std::shared_ptr<HugePageArena> mOutputArena;
+
     std::list<std::shared_ptr<v4l2_buffer>> mInputBufs;
     std::list<std::shared_ptr<v4l2_buffer>> mPendingInputBufs;
     std::list<std::shared_ptr<v4l2_buffer>> mOutputBufs;
     std::list<std::shared_ptr<v4l2_buffer>> mPendingOutputBufs;
 
     std::list<std::shared_ptr<StaticV4L2CtrlInfo>> mStaticControls;
-    std::list<std::shared_ptr<DynamicV4L2CtrlInfo>> mDynamicControls;
-    std::list<std::shared_ptr<DynamicCommandInfo>> mDynamicCommands;
+    // Frame-indexed timelines; each frame's controls go out as one VIDIOC_S_EXT_CTRLS.
+    std::map<unsigned int, std::vector<struct v4l2_ext_control>> mDynamicControls;
+    std::map<unsigned int, std::list<std::shared_ptr<DynamicCommandInfo>>> mDynamicCommands;
+    // VIDIOC_QUERY_EXT_CTRL results, type 0 when the driver did not answer.
+    std::unordered_map<unsigned int, struct v4l2_query_ext_ctrl> mCtrlRanges;
 
     FILE* mOutputDumpFile = nullptr;
     FILE* mInputDumpFile = nullptr;
@@ -193,6 +237,7 @@ class V4l2Codec {
     std::shared_ptr<V4l2CodecCallback> mCb;
 
     std::string mSessionId = 0;
+    int mTraceSession = 0;
 
     int mInputSizeOverWrite = 0;
     int mMinInputCount = 4;
@@ -206,6 +251,9 @@ class V4l2Codec {
     int mHeight = 0;
     int mOBufWidth = 0;
     int mOBufHeight = 0;
+    int mMaxWidth = 0;
+    int mMaxHeight = 0;
+    int mMaxBitDepth = 8;
     int mStride = 0;
     int mScanline = 0;
     int mCropLeft = 0;
@@ -213,6 +261,14 @@ class V4l2Codec {
     int mCropWidth = 0;
     int mCropHeight = 0;
 
+    // Per-plane layout reported by the driver in pix_mp.plane_fmt[].
+    int mNumInputPlanes = 1;
+    int mNumOutputPlanes = 1;
+    uint32_t mInputPlaneSize[VIDEO_MAX_PLANES] = {0};
+    uint32_t mOutputPlaneSize[VIDEO_MAX_PLANES] = {0};
+    uint32_t mInputPlaneStride[VIDEO_MAX_PLANES] = {0};
+    uint32_t mOutputPlaneStride[VIDEO_MAX_PLANES] = {0};
+
     unsigned int mInputColorPrimaries = V4L2_COLORSPACE_DEFAULT;
     unsigned int mInputMatrixCoeff = V4L2_YCBCR_ENC_DEFAULT;
     unsigned int mInputTransferChar = V4L2_XFER_FUNC_DEFAULT;
@@ -227,6 +283,11 @@ class V4l2Codec {
     unsigned int mCodecFmt = 0;
 
     unsigned int mMemoryType = 0;
+    CopyKernel::Type mCopyKernel = CopyKernel::COPY_MEMCPY;
+    bool mCopyKernelAuto = true;
+    std::string mDmaHeap = "system";
+    // DMA_BUF_IOCTL_SYNC around CPU access; not needed for uncached heaps.
+    bool mDmaSync = true;
 };
 
 #endif
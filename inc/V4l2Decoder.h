@@ -7,6 +7,7 @@
 
 #ifndef _V4L2_DECODER_H_
 #define _V4L2_DECODER_H_
+#include <atomic>
 #include <memory>
 
 #include <deque>
@@ -15,7 +16,11 @@
 #include "V4l2Codec.h"
 #include "V4l2Driver.h"
 
+class DecodeCrossCheck;
 class FFStreamParser;
+class FrameChecksum;
+class FramePostProcessor;
+class FrameQuality;
 
 class V4l2Decoder : public V4l2Codec {
   public:
@@ -49,10 +54,18 @@ class V4l2Decoder : public V4l2Codec {
     int pause();
     int resume();
 
-    int initFFStreamParser(std::string inputPath);
+    int initFFStreamParser(std::string inputPath, bool sharedCache = false);
+    int getRecommendedInputSize();
 
     void deinitFFStreamParser();
+    int setChecksum(std::string type, std::string outputPath, std::string referencePath);
+    int setQualityReference(std::string referencePath, std::string logPath, int numThreads);
+    int setPostProcess(std::string format, int width, int height, std::string filter,
+                       std::string outputPath, int numThreads);
+    int setCrossCheck(std::string inputPath, int numThreads, std::string cacheDir,
+                      bool stopOnMismatch);
     void setPause(int pause, int duration);
+    int setDecodeRange(int start, int end, int keyFrameStride);
 
     int randomSeek();
     int handleSeek(int seekTo);
@@ -60,10 +73,47 @@ class V4l2Decoder : public V4l2Codec {
     int handleRandomSeek(int& seekPos);
     int detectResolutionChange(bool* hasResolutionChanged);
 
+    bool isOutputPreallocated() const { return mMaxWidth > 0 && mMaxHeight > 0; }
+
+  protected:
+    void applyCopyKernel() override;
+
   private:
+    // A dequeued CAPTURE buffer, mapped once for every output stage.
+    struct OutputFrame {
+        std::uint8_t* planeAddr[VIDEO_MAX_PLANES] = {nullptr};
+        std::unique_ptr<MapBuf> maps[VIDEO_MAX_PLANES];
+        uint32_t numPlanes = 0;
+        // Luma and chroma of NV12/NV12M; unset for other formats.
+        std::uint8_t* y = nullptr;
+        int yStride = 0;
+        std::uint8_t* uv = nullptr;
+        int uvStride = 0;
+    };
+
+    int setOutputFormat();
+    uint32_t getMaxOutputSize();
+    uint32_t getMaxPlaneSize(int plane);
+    bool fitsOutputBuffers(const struct v4l2_format* fmt);
+    int mapOutputFrame(struct v4l2_buffer* buf, OutputFrame* frame);
+    int dumpOutputFrame(struct v4l2_buffer* buf, const OutputFrame& frame);
+    int checksumOutputFrame(struct v4l2_buffer* buf, const OutputFrame& frame);
+    int measureOutputFrame(const OutputFrame& frame);
+    int postProcessOutputFrame(const OutputFrame& frame);
+    int crossCheckOutputFrame(const OutputFrame& frame);
+    bool consumeLeadInFrame();
+
     friend class V4l2DecoderCB;
     std::shared_ptr<FFStreamParser> mStreamParser;
+    std::shared_ptr<FrameChecksum> mChecksum;
+    std::shared_ptr<FrameQuality> mQuality;
+    std::shared_ptr<FramePostProcessor> mPostProcessor;
+    std::shared_ptr<DecodeCrossCheck> mCrossCheck;
     bool mWillSeek = true;
+    // Frames decoded from the seek keyframe up to the range start; not output.
+    std::atomic<int> mLeadInFrames{0};
+    // Input timestamps while tracing; the key of each frame's flow.
+    uint64_t mTraceFrameCnt = 0;
 };
 
 class V4l2DecoderCB : public V4l2CodecCallback {
@@ -12,7 +12,9 @@
 #include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include "Buffer.h"
 #include "ConfigParser.h"
@@ -63,8 +65,6 @@ enum v4l2_mpeg_video_intra_refresh_period_type {
 #define INPUT_MPLANE V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE
 #define OUTPUT_MPLANE V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
 
-#define INPUT_PLANES 1
-
 #ifndef VERSION 
 #define VERSION 1.0
 #endif
@@ -203,6 +203,11 @@ class V4l2Driver {
 
     int OpenDMAHeap(std::string device);
     void CloseDMAHeap();
+    std::string getHeapName() const { return mHeapName; }
+    // Entries of /dev/dma_heap, sorted.
+    static std::vector<std::string> listDMAHeaps();
+    // CPU mappings of these heaps bypass the caches, so DMA_BUF_IOCTL_SYNC has no work to do.
+    static bool isUncachedHeap(const std::string& name);
     int AllocDMABuffer(uint64_t size, int* fd);
     int AllocMMAPBuffer(std::shared_ptr<MMAPBuffer> mmapBuf,
                         std::shared_ptr<v4l2_buffer> buf);
@@ -224,6 +229,7 @@ class V4l2Driver {
     int getSelection(struct v4l2_selection* sel);
     int getControl(struct v4l2_control* ctrl);
     int setControl(struct v4l2_control* ctrl);
+    int setExtControls(struct v4l2_ext_controls* ctrls);
     int setMemoryType(unsigned int memoryType);
     int reqBufs(struct v4l2_requestbuffers* reqBufs);
     int queueBuf(v4l2_buffer* buf);
@@ -233,6 +239,7 @@ class V4l2Driver {
 
     int queryCapabilities(struct v4l2_capability* caps);
     int queryControl(struct v4l2_queryctrl* ctrl);
+    int queryExtControl(struct v4l2_query_ext_ctrl* ctrl);
     int enumFormat(struct v4l2_fmtdesc* fmtdesc);
     int enumFramesize(struct v4l2_frmsizeenum* frmsize);
     int enumFrameInterval(struct v4l2_frmivalenum* fival);
@@ -243,8 +250,10 @@ class V4l2Driver {
   private:
     int mFd = -1;
     int mHeapFd = -1;
+    std::string mHeapName;
 
     std::string mSessionId;
+    int mTraceSession = 0;
 
     bool mThreadRunning = false;
     bool mPollThreadExit = false;
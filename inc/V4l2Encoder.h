@@ -9,7 +9,10 @@
 #define _V4L2_ENCODER_H_
 
 #include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "ConfigParser.h"
 #include "V4l2Codec.h"
@@ -17,7 +20,16 @@
 
 #define DUMP_BUF_DATA 0
 
+class BitrateController;
+class BitstreamAnalyzer;
+class EncoderEvaluator;
 class FFYUVParser;
+class FramePacer;
+class FrameScaler;
+class LadderSource;
+class MappedYUVSource;
+class SceneDetector;
+class SyntheticSource;
 
 class V4l2Encoder : public V4l2Codec {
   public:
@@ -48,10 +60,29 @@ class V4l2Encoder : public V4l2Codec {
     bool detectBitDepthChange() override { return false; }
 
     /** V4L2 Encoder Hooks **/
+    // Stepwise frame size range of the encoder for codec/pixel, from a
+    // short-lived device handle; no session is started.
+    static int queryFrameSizes(unsigned int codec, unsigned int pixel, std::string sessionId,
+                               struct v4l2_frmsizeenum* fsize);
     int setFrameRate(unsigned int numer, unsigned int denom);
     int setOperatingRate(unsigned int numer, unsigned int denom);
     int replaceNalSizeWAndWrite(std::uint8_t* basePtr, unsigned int filledLen);
     int initFFYUVParser(std::string inputPath, int width, int height, std::string pixfmt);
+    int initMappedSource(std::string inputPath, int width, int height, bool loop,
+                         int readaheadFrames, int startFrame = 0);
+    int setInputRegion(int left, int top, int width, int height);
+    int initLadderSource(std::shared_ptr<LadderSource> source, int slot, std::string filter);
+    int initSyntheticSource(std::string pattern, int width, int height, uint32_t seed,
+                            int motion, int noise);
+    int setLoopbackEvaluation(std::string logPath, int numThreads);
+    int setSceneCutDetection(std::string method, int threshold, int minInterval);
+    int setBitrateController(std::string trace, int peakPercent, std::string logPath);
+    int updateBitrate(struct v4l2_buffer* buffer);
+    int setBitstreamAnalysis(std::string logPath);
+    int setInputPacing(std::string mode, int jitterUs);
+    // Dump, loopback evaluation and bitstream analysis of a dequeued CAPTURE
+    // buffer, from one mapping; runs before the buffer can be queued again.
+    int processOutputBuffer(struct v4l2_buffer* buffer);
 
     void deinitFFYUVParser();
     void setNALEncoding(bool enable) { mNALEncodingEnabled = enable; }
@@ -59,10 +90,33 @@ class V4l2Encoder : public V4l2Codec {
 
     bool isNALEncodingEnabled() const { return mNALEncodingEnabled; }
 
+  protected:
+    void applyCopyKernel() override;
+
   private:
+    void detectSceneCut(const std::uint8_t* luma, int stride, uint32_t frameCount);
+    int fillFromLadder(int index, void* dst, void* dstUV, bool& eos);
+    std::uint8_t* mapOutputBuffer(struct v4l2_buffer* buf, std::unique_ptr<MapBuf>& map);
+    int writeOutputPayload(struct v4l2_buffer* buf, std::uint8_t* pBuffer);
+
     friend class V4l2EncoderCB;
 
     std::shared_ptr<FFYUVParser> mYUVParser;
+    std::shared_ptr<SyntheticSource> mSyntheticSource;
+    std::shared_ptr<MappedYUVSource> mMappedSource;
+    std::shared_ptr<LadderSource> mLadderSource;
+    std::shared_ptr<FrameScaler> mLadderScaler;
+    std::string mLadderFilter;
+    int mLadderSlot = 0;
+    uint32_t mLadderFrameIdx = 0;
+    // Shared source frame behind each queued input buffer, by buffer index.
+    std::mutex mLadderLock;
+    std::unordered_map<int, std::shared_ptr<const std::vector<uint8_t>>> mLadderFrames;
+    std::shared_ptr<SceneDetector> mSceneDetector;
+    std::shared_ptr<BitrateController> mRateController;
+    std::shared_ptr<BitstreamAnalyzer> mAnalyzer;
+    std::shared_ptr<FramePacer> mPacer;
+    std::shared_ptr<EncoderEvaluator> mEvaluator;
 
     std::unordered_set<int> mLTRIndex;
     std::unordered_map<int, int> mUseLTR;
@@ -0,0 +1,51 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of threads for splitting per-frame work into stripes.
+ * parallelFor() hands out job indices [0, count) and returns once all of
+ * them have run; the calling thread works on jobs as well. Only one
+ * thread may call parallelFor() on a pool at a time.
+ */
+class WorkerPool {
+  public:
+    explicit WorkerPool(int numThreads);
+    ~WorkerPool();
+
+    int getNumThreads() const { return (int)mThreads.size() + 1; }
+    void parallelFor(int count, const std::function<void(int)>& job);
+
+  private:
+    void threadLoop();
+    void runJobs();
+
+    std::vector<std::shared_ptr<std::thread>> mThreads;
+    std::mutex mLock;
+    std::condition_variable mWakeUp;
+    std::condition_variable mDone;
+
+    const std::function<void(int)>* mJob = nullptr;
+    int mJobCount = 0;
+    int mNextJob = 0;
+    int mFinishedJobs = 0;
+    uint64_t mGeneration = 0;
+    bool mExit = false;
+};
+
+#endif  // _WORKER_POOL_H_
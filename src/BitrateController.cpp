@@ -0,0 +1,227 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "BitrateController.h"
+
+#define WINDOW_SEC 1.0
+#define UPDATE_SEC 0.5
+#define CONVERGED_TOLERANCE 0.10
+#define MIN_GAIN 0.5
+#define MAX_GAIN 2.0
+
+static uint64_t splitmix64(uint64_t* state) {
+    uint64_t x = (*state += 0x9E3779B97F4A7C15ULL);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+BitrateController::BitrateController(std::string sessionId) : mSessionId(sessionId) {}
+
+BitrateController::~BitrateController() {
+    deinit();
+}
+
+std::string BitrateController::id() {
+    return mSessionId;
+}
+
+int BitrateController::init(std::string trace, int peakPercent, std::string logPath) {
+    int ret = 0;
+
+    if (trace.compare(0, 11, "randomwalk:") == 0) {
+        ret = parseRandomWalk(trace.substr(11));
+    } else {
+        ret = loadTrace(trace);
+    }
+    if (ret) {
+        return ret;
+    }
+    mPeakPercent = std::max(peakPercent, 100);
+
+    if (!logPath.empty()) {
+        mLogFile = fopen(logPath.c_str(), "w");
+        if (mLogFile == nullptr) {
+            LOGE("Error: failed to open rate control log %s\n", logPath.c_str());
+            return -EINVAL;
+        }
+        fprintf(mLogFile, "# seconds,target_kbps,command_kbps,measured_kbps\n");
+    }
+    LOGI("Bitrate controller: %s, peak %d%%\n", trace.c_str(), mPeakPercent);
+    return 0;
+}
+
+int BitrateController::loadTrace(std::string path) {
+    std::ifstream file(path);
+    std::string line;
+
+    if (!file.is_open()) {
+        LOGE("Error: failed to open bitrate trace %s\n", path.c_str());
+        return -EINVAL;
+    }
+    while (std::getline(file, line)) {
+        std::istringstream tokens(line);
+        double seconds = 0, kbps = 0;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (!(tokens >> seconds >> kbps) || kbps <= 0) {
+            LOGE("Error: bad bitrate trace line \"%s\"\n", line.c_str());
+            return -EINVAL;
+        }
+        mTrace.emplace_back(seconds, kbps);
+    }
+    if (mTrace.empty()) {
+        LOGE("Error: bitrate trace %s is empty\n", path.c_str());
+        return -EINVAL;
+    }
+    std::stable_sort(mTrace.begin(), mTrace.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+    return 0;
+}
+
+int BitrateController::parseRandomWalk(std::string spec) {
+    double start = 0;
+    unsigned long long seed = 1;
+
+    std::replace(spec.begin(), spec.end(), ',', ' ');
+    std::istringstream tokens(spec);
+    if (!(tokens >> start >> mWalkMin >> mWalkMax) || mWalkMin <= 0 || mWalkMax < mWalkMin) {
+        LOGE("Error: expected randomwalk:<start>,<min>,<max>[,<seed>] in kbps\n");
+        return -EINVAL;
+    }
+    tokens >> seed;
+    mWalkState = seed;
+    mRandomWalk = true;
+    mTrace.emplace_back(0.0, std::min(std::max(start, mWalkMin), mWalkMax));
+    return 0;
+}
+
+double BitrateController::targetKbps(double seconds) {
+    while (mRandomWalk && mTrace.back().first < seconds) {
+        // Log-uniform step of up to +-25% per second.
+        double u = (splitmix64(&mWalkState) >> 11) * (1.0 / 9007199254740992.0);
+        double next = mTrace.back().second * exp((u - 0.5) * 0.5);
+        mTrace.emplace_back(mTrace.back().first + 1.0,
+                            std::min(std::max(next, mWalkMin), mWalkMax));
+    }
+    auto itr = std::upper_bound(mTrace.begin(), mTrace.end(), seconds,
+                                [](double t, const auto& entry) { return t < entry.first; });
+    return itr == mTrace.begin() ? mTrace.front().second : std::prev(itr)->second;
+}
+
+void BitrateController::command(double target, uint32_t* bitrate, uint32_t* peak) {
+    double kbps = target * mGain;
+    mLastCommand = kbps;
+    *bitrate = (uint32_t)(kbps * 1000);
+    *peak = (uint32_t)(kbps * 10 * mPeakPercent);
+}
+
+void BitrateController::getInitialBitrate(uint32_t* bitrate, uint32_t* peak) {
+    mLastTarget = targetKbps(0);
+    command(mLastTarget, bitrate, peak);
+}
+
+bool BitrateController::onFrameEncoded(int64_t timestampUs, uint32_t bytes, uint32_t* bitrate,
+                                       uint32_t* peak) {
+    // Reordered (B-frame) output must not move the clock backwards.
+    double now = std::max(timestampUs / 1000000.0, mWindow.empty() ? 0 : mWindow.back().time);
+    if (mStartTime < 0) {
+        mStartTime = now;
+        mLastUpdate = now;
+        mChangeTime = now;
+    }
+    double elapsed = now - mStartTime;
+    double target = targetKbps(elapsed);
+
+    mWindow.push_back({now, bytes, target, mLastCommand});
+    mWindowBytes += bytes;
+    mWindowTarget += target;
+    mWindowCommand += mLastCommand;
+    while (now - mWindow.front().time >= WINDOW_SEC) {
+        mWindowBytes -= mWindow.front().bytes;
+        mWindowTarget -= mWindow.front().targetKbps;
+        mWindowCommand -= mWindow.front().commandKbps;
+        mWindow.pop_front();
+    }
+    bool windowFull = elapsed >= WINDOW_SEC;
+    double measured = mWindowBytes * 8 / WINDOW_SEC / 1000;
+    double windowTarget = mWindowTarget / mWindow.size();
+    double windowCommand = mWindowCommand / mWindow.size();
+
+    if (windowFull) {
+        double error = (measured - windowTarget) / windowTarget;
+        mErrorSum += fabs(error);
+        mErrorSqSum += error * error;
+        mErrorCnt++;
+        if (!mConverged && fabs(error) <= CONVERGED_TOLERANCE) {
+            mConverged = true;
+            mConvergeTimes.push_back(now - mChangeTime);
+        }
+    }
+
+    bool update = false;
+    if (target != mLastTarget) {
+        LOGI("Bitrate target %.0f -> %.0f kbps at %.2fs\n", mLastTarget, target, elapsed);
+        mLastTarget = target;
+        mChangeTime = now;
+        mConverged = false;
+        mTargetChanges++;
+        update = true;
+    }
+    if (now - mLastUpdate >= UPDATE_SEC && windowFull && measured > 0) {
+        // The encoder delivered measured/windowCommand of what it was asked
+        // for; move the gain geometrically halfway towards the inverse.
+        mGain = sqrt(mGain * windowCommand / measured);
+        mGain = std::min(std::max(mGain, MIN_GAIN), MAX_GAIN);
+        update = true;
+    }
+    if (update) {
+        mLastUpdate = now;
+        command(target, bitrate, peak);
+        if (mLogFile) {
+            fprintf(mLogFile, "%.3f,%.0f,%.0f,%.0f\n", elapsed, target, mLastCommand,
+                    windowFull ? measured : 0.0);
+        }
+    }
+    return update;
+}
+
+void BitrateController::deinit() {
+    if (mErrorCnt) {
+        double mean = 0, worst = 0;
+        for (double t : mConvergeTimes) {
+            mean += t;
+            worst = std::max(worst, t);
+        }
+        mean = mConvergeTimes.empty() ? 0 : mean / mConvergeTimes.size();
+        uint32_t unconverged = mTargetChanges - mConvergeTimes.size();
+        LOGI("Bitrate tracking: mean error %.1f%%, rms %.1f%%, final gain %.2f\n",
+             100 * mErrorSum / mErrorCnt, 100 * sqrt(mErrorSqSum / mErrorCnt), mGain);
+        LOGI("Bitrate convergence: %u target changes, mean %.2fs, worst %.2fs, %u never "
+             "converged\n", mTargetChanges, mean, worst, unconverged);
+        if (mLogFile) {
+            fprintf(mLogFile, "# tracking mean_error %.4f rms_error %.4f\n",
+                    mErrorSum / mErrorCnt, sqrt(mErrorSqSum / mErrorCnt));
+            fprintf(mLogFile, "# convergence changes %u mean_s %.3f worst_s %.3f "
+                    "unconverged %u\n", mTargetChanges, mean, worst, unconverged);
+        }
+        mErrorCnt = 0;
+    }
+    if (mLogFile) {
+        fclose(mLogFile);
+        mLogFile = nullptr;
+    }
+}
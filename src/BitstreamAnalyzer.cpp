@@ -0,0 +1,907 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include <linux/videodev2.h>
+
+#include "BitstreamAnalyzer.h"
+
+// Slice headers end well before this; parameter sets are taken whole.
+#define MAX_SLICE_HEADER_BYTES 1024
+
+static const char* sFrameTypeName[] = {"IDR", "I", "P", "B", "HDR"};
+
+// Returns the first 00 00 01 in [p, end), or end.
+static const uint8_t* findStartCode(const uint8_t* p, const uint8_t* end) {
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    while (end - p >= 18) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), zero);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 1)), zero);
+        __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 2)), one);
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), c));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#elif defined(__aarch64__)
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one = vdupq_n_u8(1);
+    while (end - p >= 18) {
+        uint8x16_t a = vceqq_u8(vld1q_u8(p), zero);
+        uint8x16_t b = vceqq_u8(vld1q_u8(p + 1), zero);
+        uint8x16_t c = vceqq_u8(vld1q_u8(p + 2), one);
+        if (vmaxvq_u8(vandq_u8(vandq_u8(a, b), c))) {
+            break;
+        }
+        p += 16;
+    }
+#endif
+    for (; end - p >= 3; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+            return p;
+        }
+    }
+    return end;
+}
+
+// Copies at most maxSize bytes of payload, dropping emulation prevention bytes.
+static void unescape(const uint8_t* src, size_t size, size_t maxSize, std::vector<uint8_t>& dst) {
+    int zeros = 0;
+
+    dst.clear();
+    for (size_t i = 0; i < size && dst.size() < maxSize; i++) {
+        if (zeros >= 2 && src[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = src[i] ? 0 : zeros + 1;
+        dst.push_back(src[i]);
+    }
+}
+
+static int ceilLog2(uint32_t v) {
+    int bits = 0;
+    while ((1u << bits) < v) {
+        bits++;
+    }
+    return bits;
+}
+
+class BitReader {
+  public:
+    BitReader(const std::vector<uint8_t>& data, size_t byteOffset)
+        : mData(data.data()), mBits(data.size() * 8), mPos(byteOffset * 8) {}
+
+    uint32_t u(int n) {
+        uint32_t v = 0;
+        for (int i = 0; i < n; i++) {
+            v = (v << 1) | bit();
+        }
+        return v;
+    }
+    void skip(size_t n) { mPos += n; }
+    uint32_t ue() {
+        int zeros = 0;
+        while (!bit()) {
+            if (++zeros > 31 || mPos > mBits) {
+                mError = true;
+                return 0;
+            }
+        }
+        return zeros ? ((1u << zeros) - 1) + u(zeros) : 0;
+    }
+    int32_t se() {
+        uint32_t v = ue();
+        return (v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+    }
+    bool ok() const { return !mError && mPos <= mBits; }
+
+  private:
+    uint32_t bit() {
+        if (mPos >= mBits) {
+            mPos++;
+            return 0;
+        }
+        uint32_t b = (mData[mPos >> 3] >> (7 - (mPos & 7))) & 1;
+        mPos++;
+        return b;
+    }
+
+    const uint8_t* mData;
+    size_t mBits;
+    size_t mPos;
+    bool mError = false;
+};
+
+static void skipAvcScalingList(BitReader& br, int size) {
+    int last = 8, next = 8;
+    for (int j = 0; j < size; j++) {
+        if (next) {
+            next = (last + br.se() + 256) % 256;
+        }
+        last = next ? next : last;
+    }
+}
+
+static void skipHevcScalingListData(BitReader& br) {
+    for (int sizeId = 0; sizeId < 4; sizeId++) {
+        for (int matrixId = 0; matrixId < 6; matrixId += (sizeId == 3) ? 3 : 1) {
+            if (!br.u(1)) {
+                br.ue();
+                continue;
+            }
+            int coefNum = std::min(64, 1 << (4 + (sizeId << 1)));
+            if (sizeId > 1) {
+                br.se();
+            }
+            for (int i = 0; i < coefNum; i++) {
+                br.se();
+            }
+        }
+    }
+}
+
+static void skipAvcPredWeightTable(BitReader& br, int chromaArrayType, int l0, int l1) {
+    br.ue();
+    if (chromaArrayType) {
+        br.ue();
+    }
+    for (int n : {l0, l1}) {
+        for (int i = 0; i < n; i++) {
+            if (br.u(1)) {
+                br.se();
+                br.se();
+            }
+            if (chromaArrayType && br.u(1)) {
+                for (int j = 0; j < 4; j++) {
+                    br.se();
+                }
+            }
+        }
+    }
+}
+
+static void skipHevcPredWeightTable(BitReader& br, int chromaArrayType, int l0, int l1) {
+    br.ue();
+    if (chromaArrayType) {
+        br.se();
+    }
+    for (int n : {l0, l1}) {
+        std::vector<uint8_t> luma(n), chroma(n, 0);
+        for (int i = 0; i < n; i++) {
+            luma[i] = br.u(1);
+        }
+        for (int i = 0; chromaArrayType && i < n; i++) {
+            chroma[i] = br.u(1);
+        }
+        for (int i = 0; i < n; i++) {
+            if (luma[i]) {
+                br.se();
+                br.se();
+            }
+            for (int j = 0; chroma[i] && j < 4; j++) {
+                br.se();
+            }
+        }
+    }
+}
+
+// st_ref_pic_set(idx); idx == sets.size() for the one coded in a slice header.
+bool BitstreamAnalyzer::parseHevcRps(BitReader& br, size_t idx, const std::vector<HevcRps>& sets,
+                                     HevcRps* rps) {
+    std::vector<std::pair<int, uint8_t>> entries;
+
+    if (idx != 0 && br.u(1)) {
+        size_t deltaIdx = idx == sets.size() ? br.ue() + 1 : 1;
+        if (deltaIdx > idx) {
+            return false;
+        }
+        int sign = br.u(1);
+        int deltaRps = (int)(br.ue() + 1) * (sign ? -1 : 1);
+        const auto& ref = sets[idx - deltaIdx];
+        for (size_t j = 0; j <= ref.deltas.size(); j++) {
+            uint8_t used = br.u(1);
+            bool useDelta = used || br.u(1);
+            int dPoc = (j < ref.deltas.size() ? ref.deltas[j] : 0) + deltaRps;
+            if (useDelta && dPoc) {
+                entries.emplace_back(dPoc, used);
+            }
+        }
+        std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+            if ((a.first < 0) != (b.first < 0)) {
+                return a.first < 0;
+            }
+            return abs(a.first) < abs(b.first);
+        });
+    } else {
+        uint32_t numNegative = br.ue();
+        uint32_t numPositive = br.ue();
+        if (numNegative > 16 || numPositive > 16) {
+            return false;
+        }
+        int poc = 0;
+        for (uint32_t i = 0; i < numNegative; i++) {
+            poc -= br.ue() + 1;
+            entries.emplace_back(poc, br.u(1));
+        }
+        poc = 0;
+        for (uint32_t i = 0; i < numPositive; i++) {
+            poc += br.ue() + 1;
+            entries.emplace_back(poc, br.u(1));
+        }
+    }
+    rps->deltas.clear();
+    rps->used.clear();
+    for (const auto& entry : entries) {
+        rps->deltas.push_back(entry.first);
+        rps->used.push_back(entry.second);
+    }
+    return br.ok();
+}
+
+BitstreamAnalyzer::BitstreamAnalyzer(std::string sessionId) : mSessionId(sessionId) {}
+
+BitstreamAnalyzer::~BitstreamAnalyzer() {
+    deinit();
+}
+
+std::string BitstreamAnalyzer::id() {
+    return mSessionId;
+}
+
+int BitstreamAnalyzer::init(unsigned int codecFmt, bool lengthPrefixed, std::string logPath) {
+    if (codecFmt == V4L2_PIX_FMT_HEVC) {
+        mHevc = true;
+        mHevcSps.resize(16);
+        mHevcPps.resize(64);
+    } else if (codecFmt == V4L2_PIX_FMT_H264) {
+        mHevc = false;
+        mAvcSps.resize(32);
+        mAvcPps.resize(256);
+    } else {
+        LOGE("Error: bitstream analysis supports H.264 and HEVC only\n");
+        return -EINVAL;
+    }
+    mLengthPrefixed = lengthPrefixed;
+
+    if (!logPath.empty()) {
+        mLogFile = fopen(logPath.c_str(), "w");
+        if (mLogFile == nullptr) {
+            LOGE("Error: failed to open bitstream stats %s\n", logPath.c_str());
+            return -EINVAL;
+        }
+        fprintf(mLogFile, "# frame,timestamp_us,bytes,type,temporal_id,qp,slices,ltr_mark,"
+                "ltr_use,latency_us\n");
+    }
+    return 0;
+}
+
+void BitstreamAnalyzer::onQueued(int64_t timestampUs) {
+    std::unique_lock<std::mutex> lock(mQueuedLock);
+    mQueued[timestampUs] = std::chrono::steady_clock::now();
+}
+
+int BitstreamAnalyzer::analyze(const uint8_t* data, uint32_t size, int64_t timestampUs) {
+    const uint8_t* end = data + size;
+    FrameInfo info;
+    int64_t latencyUs = -1;
+
+    mPrefixTemporalId = -1;
+    if (mLengthPrefixed) {
+        const uint8_t* p = data;
+        while (end - p >= 4) {
+            uint32_t nalSize = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+            p += 4;
+            if (nalSize > (size_t)(end - p)) {
+                break;
+            }
+            parseNal(p, nalSize, &info);
+            p += nalSize;
+        }
+    } else {
+        const uint8_t* p = findStartCode(data, end);
+        while (p < end) {
+            const uint8_t* nal = p + 3;
+            p = findStartCode(nal, end);
+            const uint8_t* nalEnd = p;
+            // Trailing zeros belong to the next 4-byte start code.
+            while (nalEnd > nal && nalEnd[-1] == 0) {
+                nalEnd--;
+            }
+            parseNal(nal, nalEnd - nal, &info);
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mQueuedLock);
+        auto itr = mQueued.find(timestampUs);
+        if (itr != mQueued.end() && info.type != FRAME_HEADER) {
+            latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - itr->second).count();
+            mQueued.erase(itr);
+        }
+    }
+    record(info, size, timestampUs, latencyUs);
+    return 0;
+}
+
+void BitstreamAnalyzer::parseNal(const uint8_t* nal, size_t size, FrameInfo* info) {
+    if (size < 2) {
+        return;
+    }
+    if (mHevc) {
+        parseHevcNal(nal, size, info);
+    } else {
+        parseAvcNal(nal, size, info);
+    }
+}
+
+void BitstreamAnalyzer::parseAvcNal(const uint8_t* nal, size_t size, FrameInfo* info) {
+    int nalRefIdc = (nal[0] >> 5) & 3;
+    int nalType = nal[0] & 0x1f;
+
+    if (nalType == 14 && size >= 4) {
+        // SVC prefix NAL; temporal_id sits in the top bits of the third extension byte.
+        mPrefixTemporalId = nal[3] >> 5;
+        return;
+    }
+
+    if (nalType == 7) {
+        unescape(nal, size, size, mRbsp);
+        BitReader br(mRbsp, 1);
+        AvcSps sps;
+        int profile = br.u(8);
+        br.u(16);
+        uint32_t spsId = br.ue();
+        if (spsId >= mAvcSps.size()) {
+            return;
+        }
+        switch (profile) {
+            case 100: case 110: case 122: case 244: case 44: case 83:
+            case 86: case 118: case 128: case 138: case 139: case 134: case 135: {
+                int chromaFormat = br.ue();
+                if (chromaFormat == 3) {
+                    sps.separateColourPlane = br.u(1);
+                }
+                sps.chromaArrayType = sps.separateColourPlane ? 0 : chromaFormat;
+                br.ue();
+                br.ue();
+                br.u(1);
+                if (br.u(1)) {
+                    for (int i = 0; i < (chromaFormat != 3 ? 8 : 12); i++) {
+                        if (br.u(1)) {
+                            skipAvcScalingList(br, i < 6 ? 16 : 64);
+                        }
+                    }
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        sps.log2MaxFrameNum = br.ue() + 4;
+        sps.pocType = br.ue();
+        if (sps.pocType == 0) {
+            sps.log2MaxPocLsb = br.ue() + 4;
+        } else if (sps.pocType == 1) {
+            sps.deltaPicOrderAlwaysZero = br.u(1);
+            br.se();
+            br.se();
+            uint32_t cycle = br.ue();
+            for (uint32_t i = 0; i < cycle && i < 256; i++) {
+                br.se();
+            }
+        }
+        br.ue();
+        br.u(1);
+        br.ue();
+        br.ue();
+        sps.frameMbsOnly = br.u(1);
+        sps.valid = br.ok();
+        mAvcSps[spsId] = sps;
+        return;
+    }
+
+    if (nalType == 8) {
+        unescape(nal, size, size, mRbsp);
+        BitReader br(mRbsp, 1);
+        AvcPps pps;
+        uint32_t ppsId = br.ue();
+        if (ppsId >= mAvcPps.size()) {
+            return;
+        }
+        pps.spsId = br.ue();
+        pps.cabac = br.u(1);
+        pps.bottomFieldPicOrder = br.u(1);
+        // Slice group maps are not parsed; such streams report no QP.
+        pps.sliceGroups = br.ue() > 0;
+        if (!pps.sliceGroups) {
+            pps.numRefIdxL0 = br.ue() + 1;
+            pps.numRefIdxL1 = br.ue() + 1;
+            pps.weightedPred = br.u(1);
+            pps.weightedBipredIdc = br.u(2);
+            pps.initQp = 26 + br.se();
+            br.se();
+            br.se();
+            br.u(1);
+            br.u(1);
+            pps.redundantPicCnt = br.u(1);
+        }
+        pps.valid = br.ok();
+        mAvcPps[ppsId] = pps;
+        return;
+    }
+
+    if (nalType != 1 && nalType != 5) {
+        return;
+    }
+    if (info->slices++) {
+        return;
+    }
+    info->temporalId = mPrefixTemporalId >= 0 ? mPrefixTemporalId : 0;
+
+    unescape(nal, size, MAX_SLICE_HEADER_BYTES, mRbsp);
+    BitReader br(mRbsp, 1);
+    bool idr = nalType == 5;
+    br.ue();
+    int sliceType = br.ue() % 5;
+    bool isP = sliceType == 0 || sliceType == 3;
+    bool isB = sliceType == 1;
+    bool isI = sliceType == 2 || sliceType == 4;
+    info->type = idr ? FRAME_IDR : isI ? FRAME_I : isB ? FRAME_B : FRAME_P;
+
+    uint32_t ppsId = br.ue();
+    if (ppsId >= mAvcPps.size() || !mAvcPps[ppsId].valid || mAvcPps[ppsId].sliceGroups ||
+        mAvcPps[ppsId].spsId >= (int)mAvcSps.size() || !mAvcSps[mAvcPps[ppsId].spsId].valid) {
+        return;
+    }
+    const AvcPps& pps = mAvcPps[ppsId];
+    const AvcSps& sps = mAvcSps[pps.spsId];
+
+    if (sps.separateColourPlane) {
+        br.u(2);
+    }
+    br.u(sps.log2MaxFrameNum);
+    bool field = false;
+    if (!sps.frameMbsOnly) {
+        field = br.u(1);
+        if (field) {
+            br.u(1);
+        }
+    }
+    if (idr) {
+        br.ue();
+    }
+    if (sps.pocType == 0) {
+        br.u(sps.log2MaxPocLsb);
+        if (pps.bottomFieldPicOrder && !field) {
+            br.se();
+        }
+    } else if (sps.pocType == 1 && !sps.deltaPicOrderAlwaysZero) {
+        br.se();
+        if (pps.bottomFieldPicOrder && !field) {
+            br.se();
+        }
+    }
+    if (pps.redundantPicCnt) {
+        br.ue();
+    }
+    if (isB) {
+        br.u(1);
+    }
+    int l0 = pps.numRefIdxL0, l1 = pps.numRefIdxL1;
+    if ((isP || isB) && br.u(1)) {
+        l0 = br.ue() + 1;
+        if (isB) {
+            l1 = br.ue() + 1;
+        }
+    }
+    // ref_pic_list_modification; idc 2 picks a long-term picture.
+    for (int list = 0; !isI && list < (isB ? 2 : 1); list++) {
+        if (!br.u(1)) {
+            continue;
+        }
+        for (int i = 0; i < 64 && br.ok(); i++) {
+            uint32_t idc = br.ue();
+            if (idc == 3) {
+                break;
+            }
+            info->ltrUse |= idc == 2;
+            br.ue();
+        }
+    }
+    if ((pps.weightedPred && isP) || (pps.weightedBipredIdc == 1 && isB)) {
+        skipAvcPredWeightTable(br, sps.chromaArrayType, l0, isB ? l1 : 0);
+    }
+    // dec_ref_pic_marking; MMCO 6 marks the current picture long-term.
+    if (nalRefIdc) {
+        if (idr) {
+            br.u(1);
+            info->ltrMark = br.u(1);
+        } else if (br.u(1)) {
+            for (int i = 0; i < 64 && br.ok(); i++) {
+                uint32_t mmco = br.ue();
+                if (mmco == 0) {
+                    break;
+                }
+                if (mmco == 1 || mmco == 2 || mmco == 3 || mmco == 4 || mmco == 6) {
+                    br.ue();
+                }
+                if (mmco == 3) {
+                    br.ue();
+                }
+                info->ltrMark |= mmco == 6;
+            }
+        }
+    }
+    if (pps.cabac && !isI) {
+        br.ue();
+    }
+    int qp = pps.initQp + br.se();
+    if (br.ok()) {
+        info->qp = qp;
+    }
+}
+
+void BitstreamAnalyzer::parseHevcNal(const uint8_t* nal, size_t size, FrameInfo* info) {
+    int nalType = (nal[0] >> 1) & 0x3f;
+
+    if (nalType == 33) {
+        unescape(nal, size, size, mRbsp);
+        BitReader br(mRbsp, 2);
+        HevcSps sps;
+        br.u(4);
+        int maxSubLayersMinus1 = br.u(3);
+        br.u(1);
+        // profile_tier_level: general profile (88 bits) and level (8 bits).
+        br.skip(96);
+        uint8_t profilePresent[8] = {0}, levelPresent[8] = {0};
+        for (int i = 0; i < maxSubLayersMinus1; i++) {
+            profilePresent[i] = br.u(1);
+            levelPresent[i] = br.u(1);
+        }
+        if (maxSubLayersMinus1 > 0) {
+            br.skip(2 * (8 - maxSubLayersMinus1));
+        }
+        for (int i = 0; i < maxSubLayersMinus1; i++) {
+            br.skip((profilePresent[i] ? 88 : 0) + (levelPresent[i] ? 8 : 0));
+        }
+        uint32_t spsId = br.ue();
+        if (spsId >= mHevcSps.size()) {
+            return;
+        }
+        int chromaFormat = br.ue();
+        if (chromaFormat == 3) {
+            sps.separateColourPlane = br.u(1);
+        }
+        sps.chromaArrayType = sps.separateColourPlane ? 0 : chromaFormat;
+        br.ue();
+        br.ue();
+        if (br.u(1)) {
+            for (int i = 0; i < 4; i++) {
+                br.ue();
+            }
+        }
+        br.ue();
+        br.ue();
+        sps.log2MaxPocLsb = br.ue() + 4;
+        bool subLayerOrdering = br.u(1);
+        for (int i = subLayerOrdering ? 0 : maxSubLayersMinus1; i <= maxSubLayersMinus1; i++) {
+            br.ue();
+            br.ue();
+            br.ue();
+        }
+        for (int i = 0; i < 6; i++) {
+            br.ue();
+        }
+        if (br.u(1) && br.u(1)) {
+            skipHevcScalingListData(br);
+        }
+        br.u(1);
+        sps.sao = br.u(1);
+        if (br.u(1)) {
+            br.u(8);
+            br.ue();
+            br.ue();
+            br.u(1);
+        }
+        uint32_t numRps = br.ue();
+        if (numRps > 64) {
+            return;
+        }
+        for (uint32_t i = 0; i < numRps; i++) {
+            HevcRps rps;
+            if (!parseHevcRps(br, i, sps.rps, &rps)) {
+                return;
+            }
+            sps.rps.push_back(rps);
+        }
+        sps.longTermRefsPresent = br.u(1);
+        if (sps.longTermRefsPresent) {
+            uint32_t numLt = br.ue();
+            for (uint32_t i = 0; i < numLt && i < 33; i++) {
+                br.u(sps.log2MaxPocLsb);
+                sps.ltUsed.push_back(br.u(1));
+            }
+        }
+        sps.temporalMvp = br.u(1);
+        sps.valid = br.ok();
+        mHevcSps[spsId] = sps;
+        return;
+    }
+
+    if (nalType == 34) {
+        unescape(nal, size, size, mRbsp);
+        BitReader br(mRbsp, 2);
+        HevcPps pps;
+        uint32_t ppsId = br.ue();
+        if (ppsId >= mHevcPps.size()) {
+            return;
+        }
+        pps.spsId = br.ue();
+        br.u(1);
+        pps.outputFlagPresent = br.u(1);
+        pps.numExtraSliceHeaderBits = br.u(3);
+        br.u(1);
+        pps.cabacInitPresent = br.u(1);
+        pps.numRefIdxL0 = br.ue() + 1;
+        pps.numRefIdxL1 = br.ue() + 1;
+        pps.initQp = 26 + br.se();
+        br.u(1);
+        br.u(1);
+        if (br.u(1)) {
+            br.ue();
+        }
+        br.se();
+        br.se();
+        br.u(1);
+        pps.weightedPred = br.u(1);
+        pps.weightedBipred = br.u(1);
+        br.u(1);
+        bool tiles = br.u(1);
+        br.u(1);
+        if (tiles) {
+            uint32_t cols = br.ue() + 1;
+            uint32_t rows = br.ue() + 1;
+            if (!br.u(1)) {
+                for (uint32_t i = 0; i + 1 < cols && i < 64; i++) {
+                    br.ue();
+                }
+                for (uint32_t i = 0; i + 1 < rows && i < 64; i++) {
+                    br.ue();
+                }
+            }
+            br.u(1);
+        }
+        br.u(1);
+        if (br.u(1)) {
+            br.u(1);
+            if (!br.u(1)) {
+                br.se();
+                br.se();
+            }
+        }
+        if (br.u(1)) {
+            skipHevcScalingListData(br);
+        }
+        pps.listsModification = br.u(1);
+        pps.valid = br.ok();
+        mHevcPps[ppsId] = pps;
+        return;
+    }
+
+    // VCL NAL units are types 0-31, of which 16-23 are IRAP.
+    if (nalType > 31) {
+        return;
+    }
+    if (info->slices++) {
+        return;
+    }
+    info->temporalId = (nal[1] & 7) - 1;
+
+    unescape(nal, size, MAX_SLICE_HEADER_BYTES, mRbsp);
+    BitReader br(mRbsp, 2);
+    bool idr = nalType == 19 || nalType == 20;
+    if (!br.u(1)) {
+        // Not the first slice segment of a picture.
+        return;
+    }
+    if (nalType >= 16 && nalType <= 23) {
+        br.u(1);
+    }
+    uint32_t ppsId = br.ue();
+    if (ppsId >= mHevcPps.size() || !mHevcPps[ppsId].valid ||
+        mHevcPps[ppsId].spsId >= (int)mHevcSps.size() || !mHevcSps[mHevcPps[ppsId].spsId].valid) {
+        return;
+    }
+    const HevcPps& pps = mHevcPps[ppsId];
+    const HevcSps& sps = mHevcSps[pps.spsId];
+
+    br.u(pps.numExtraSliceHeaderBits);
+    int sliceType = br.ue();
+    bool isB = sliceType == 0;
+    bool isP = sliceType == 1;
+    info->type = idr ? FRAME_IDR : isB ? FRAME_B : isP ? FRAME_P : FRAME_I;
+    if (pps.outputFlagPresent) {
+        br.u(1);
+    }
+    if (sps.separateColourPlane) {
+        br.u(2);
+    }
+
+    int numPicTotalCurr = 0;
+    bool temporalMvp = false;
+    if (!idr) {
+        br.u(sps.log2MaxPocLsb);
+        HevcRps rps;
+        if (!br.u(1)) {
+            if (!parseHevcRps(br, sps.rps.size(), sps.rps, &rps)) {
+                return;
+            }
+        } else {
+            int bits = ceilLog2(sps.rps.size());
+            uint32_t idx = bits ? br.u(bits) : 0;
+            if (idx >= sps.rps.size()) {
+                return;
+            }
+            rps = sps.rps[idx];
+        }
+        numPicTotalCurr = std::count(rps.used.begin(), rps.used.end(), 1);
+        if (sps.longTermRefsPresent) {
+            uint32_t numLtSps = sps.ltUsed.empty() ? 0 : br.ue();
+            uint32_t numLtPics = br.ue();
+            for (uint32_t i = 0; i < numLtSps + numLtPics && i < 33; i++) {
+                bool used = false;
+                if (i < numLtSps) {
+                    int bits = ceilLog2(sps.ltUsed.size());
+                    uint32_t idx = bits ? br.u(bits) : 0;
+                    used = idx < sps.ltUsed.size() && sps.ltUsed[idx];
+                } else {
+                    br.u(sps.log2MaxPocLsb);
+                    used = br.u(1);
+                }
+                if (used) {
+                    numPicTotalCurr++;
+                    info->ltrUse = true;
+                }
+                if (br.u(1)) {
+                    br.ue();
+                }
+            }
+        }
+        if (sps.temporalMvp) {
+            temporalMvp = br.u(1);
+        }
+    }
+    if (sps.sao) {
+        br.u(1);
+        if (sps.chromaArrayType) {
+            br.u(1);
+        }
+    }
+    if (isP || isB) {
+        int l0 = pps.numRefIdxL0, l1 = pps.numRefIdxL1;
+        if (br.u(1)) {
+            l0 = br.ue() + 1;
+            if (isB) {
+                l1 = br.ue() + 1;
+            }
+        }
+        if (pps.listsModification && numPicTotalCurr > 1) {
+            int bits = ceilLog2(numPicTotalCurr);
+            if (br.u(1)) {
+                br.skip((size_t)bits * l0);
+            }
+            if (isB && br.u(1)) {
+                br.skip((size_t)bits * l1);
+            }
+        }
+        if (isB) {
+            br.u(1);
+        }
+        if (pps.cabacInitPresent) {
+            br.u(1);
+        }
+        if (temporalMvp) {
+            bool fromL0 = isB ? br.u(1) : true;
+            if ((fromL0 && l0 > 1) || (!fromL0 && l1 > 1)) {
+                br.ue();
+            }
+        }
+        if ((pps.weightedPred && isP) || (pps.weightedBipred && isB)) {
+            skipHevcPredWeightTable(br, sps.chromaArrayType, l0, isB ? l1 : 0);
+        }
+        br.ue();
+    }
+    int qp = pps.initQp + br.se();
+    if (br.ok()) {
+        info->qp = qp;
+    }
+}
+
+void BitstreamAnalyzer::record(const FrameInfo& info, uint32_t size, int64_t timestampUs,
+                               int64_t latencyUs) {
+    int layer = std::min(std::max(info.temporalId, 0), 7);
+
+    mTypeCnt[info.type]++;
+    mTypeBytes[info.type] += size;
+    if (info.qp >= 0) {
+        mTypeQpSum[info.type] += info.qp;
+        mTypeQpCnt[info.type]++;
+    }
+    if (info.type != FRAME_HEADER) {
+        mLayerCnt[layer]++;
+        mLayerBytes[layer] += size;
+    }
+    mLtrMarkCnt += info.ltrMark;
+    mLtrUseCnt += info.ltrUse;
+    if (latencyUs >= 0) {
+        mLatencies.push_back(latencyUs);
+    }
+
+    if (mLogFile) {
+        fprintf(mLogFile, "%u,%lld,%u,%s,%d,%d,%d,%d,%d,%lld\n", mFrameCnt,
+                (long long)timestampUs, size, sFrameTypeName[info.type], info.temporalId,
+                info.qp, info.slices, info.ltrMark, info.ltrUse, (long long)latencyUs);
+    }
+    mFrameCnt++;
+}
+
+void BitstreamAnalyzer::deinit() {
+    if (mFrameCnt) {
+        uint64_t totalBytes = 0;
+        for (int i = 0; i < 8; i++) {
+            totalBytes += mLayerBytes[i];
+        }
+        LOGI("Bitstream: %u buffers, %u marked long-term, %u using long-term refs\n",
+             mFrameCnt, mLtrMarkCnt, mLtrUseCnt);
+        for (int t = 0; t < FRAME_TYPE_MAX; t++) {
+            if (!mTypeCnt[t]) {
+                continue;
+            }
+            LOGI("  %-3s: %u frames, avg %llu bytes, avg QP %.1f\n", sFrameTypeName[t],
+                 mTypeCnt[t], (unsigned long long)(mTypeBytes[t] / mTypeCnt[t]),
+                 mTypeQpCnt[t] ? (double)mTypeQpSum[t] / mTypeQpCnt[t] : -1.0);
+        }
+        for (int l = 0; l < 8; l++) {
+            if (!mLayerCnt[l]) {
+                continue;
+            }
+            LOGI("  layer %d: %u frames, %.1f%% of bytes\n", l, mLayerCnt[l],
+                 totalBytes ? 100.0 * mLayerBytes[l] / totalBytes : 0.0);
+        }
+        if (!mLatencies.empty()) {
+            std::sort(mLatencies.begin(), mLatencies.end());
+            double mean = 0;
+            for (int64_t v : mLatencies) {
+                mean += v;
+            }
+            mean /= mLatencies.size();
+            LOGI("  QBUF->DQBUF: mean %.0fus, p50 %lldus, p95 %lldus, max %lldus\n", mean,
+                 (long long)mLatencies[mLatencies.size() / 2],
+                 (long long)mLatencies[mLatencies.size() * 95 / 100],
+                 (long long)mLatencies.back());
+        }
+        mFrameCnt = 0;
+    }
+    if (mLogFile) {
+        fclose(mLogFile);
+        mLogFile = nullptr;
+    }
+}
@@ -235,21 +235,76 @@ int parseJsonConfigs(
         CHECK_MANDATORY(testConfig, CodecName, String);
         CHECK_MANDATORY(testConfig, PixelFormat, String);
         CHECK_OPTIONAL(testConfig, MemoryType, String, "");
+        CHECK_OPTIONAL(testConfig, InputCopyKernel, String, "auto");
+        CHECK_OPTIONAL(testConfig, InputCopyBenchmark, Bool, false);
+        CHECK_OPTIONAL(testConfig, DmaHeap, String, "system");
+        CHECK_OPTIONAL(testConfig, DmaHeapBenchmark, Int, 0);
 
         CHECK_MANDATORY(testConfig, Width, Int);
         CHECK_MANDATORY(testConfig, Height, Int);
 
         CHECK_OPTIONAL(testConfig, Outputpath, String, "");
         CHECK_OPTIONAL(testConfig, DumpInputPath, String, "");
+        CHECK_OPTIONAL(testConfig, QualityPath, String, "");
+        CHECK_OPTIONAL(testConfig, QualityThreads, Int, 4);
 
         if (config.Domain.compare("Encoder") == 0) {
             CHECK_MANDATORY(testConfig, OperatingRate, Int);
             CHECK_MANDATORY(testConfig, FrameRate, Int);
             CHECK_OPTIONAL(testConfig, InputBufferCount, Int, 32);
             CHECK_OPTIONAL(testConfig, OutputBufferCount, Int, 32);
+            CHECK_OPTIONAL(testConfig, LoopbackEvaluation, Bool, false);
+            CHECK_OPTIONAL(testConfig, SyntheticSeed, Int, 1);
+            CHECK_OPTIONAL(testConfig, SyntheticMotion, Int, 4);
+            CHECK_OPTIONAL(testConfig, SyntheticNoise, Int, 4);
+            CHECK_OPTIONAL(testConfig, MappedInput, Bool, false);
+            CHECK_OPTIONAL(testConfig, LoopInput, Bool, false);
+            CHECK_OPTIONAL(testConfig, ReadaheadFrames, Int, 4);
+            CHECK_OPTIONAL(testConfig, SceneCutDetection, String, "");
+            CHECK_OPTIONAL(testConfig, SceneCutThreshold, Int, 0);
+            CHECK_OPTIONAL(testConfig, SceneCutMinInterval, Int, 8);
+            CHECK_OPTIONAL(testConfig, BitrateTrace, String, "");
+            CHECK_OPTIONAL(testConfig, PeakBitratePercent, Int, 150);
+            CHECK_OPTIONAL(testConfig, RateControlLog, String, "");
+            CHECK_OPTIONAL(testConfig, BitstreamStats, String, "");
+            CHECK_OPTIONAL(testConfig, InputPacing, String, "");
+            CHECK_OPTIONAL(testConfig, PacingJitterUs, Int, 0);
+            CHECK_OPTIONAL(testConfig, InputStartFrame, Int, 0);
+            CHECK_OPTIONAL(testConfig, ParallelSessions, Int, 1);
+            CHECK_OPTIONAL(testConfig, StripeCount, Int, 0);
+            CHECK_OPTIONAL(testConfig, StripeLayout, String, "columns");
+            CHECK_OPTIONAL(testConfig, LadderRenditions, String, "");
+            CHECK_OPTIONAL(testConfig, LadderFilter, String, "bilinear");
         } else {
             CHECK_OPTIONAL(testConfig, InputBufferCount, Int, 16);
             CHECK_OPTIONAL(testConfig, OutputBufferCount, Int, 16);
+            CHECK_OPTIONAL(testConfig, MaxWidth, Int, 0);
+            CHECK_OPTIONAL(testConfig, MaxHeight, Int, 0);
+            CHECK_OPTIONAL(testConfig, MaxBitDepth, Int, 8);
+            CHECK_OPTIONAL(testConfig, InputBufferSize, Int, 0);
+            CHECK_OPTIONAL(testConfig, SharedPacketCache, Bool, false);
+            CHECK_OPTIONAL(testConfig, ChecksumType, String, "");
+            CHECK_OPTIONAL(testConfig, ChecksumPath, String, "");
+            CHECK_OPTIONAL(testConfig, ChecksumReference, String, "");
+            CHECK_OPTIONAL(testConfig, ReferenceYUV, String, "");
+            CHECK_OPTIONAL(testConfig, CrossCheck, Bool, false);
+            CHECK_OPTIONAL(testConfig, CrossCheckCacheDir, String, "");
+            CHECK_OPTIONAL(testConfig, CrossCheckStopOnMismatch, Bool, false);
+            CHECK_OPTIONAL(testConfig, PostProcessPath, String, "");
+            CHECK_OPTIONAL(testConfig, PostProcessFormat, String, "i420");
+            CHECK_OPTIONAL(testConfig, PostProcessWidth, Int, 0);
+            CHECK_OPTIONAL(testConfig, PostProcessHeight, Int, 0);
+            CHECK_OPTIONAL(testConfig, PostProcessFilter, String, "bilinear");
+            CHECK_OPTIONAL(testConfig, PostProcessThreads, Int, 4);
+            CHECK_OPTIONAL(testConfig, DecodeStartFrame, Int, 0);
+            CHECK_OPTIONAL(testConfig, DecodeEndFrame, Int, -1);
+            CHECK_OPTIONAL(testConfig, KeyFrameInterval, Int, 0);
+            CHECK_OPTIONAL(testConfig, ParallelSessions, Int, 1);
+            // Reference comparisons count frames from 0 of the stream.
+            CHECK_TRUE((config.DecodeStartFrame <= 0 && config.KeyFrameInterval <= 0) ||
+                           (config.ReferenceYUV.empty() && !config.CrossCheck),
+                       "DecodeStartFrame and KeyFrameInterval cannot be combined with "
+                       "ReferenceYUV or CrossCheck");
         }
 
         ret = getConfigs(testConfig, config, "StaticControls");
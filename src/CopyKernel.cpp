@@ -0,0 +1,191 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "CopyKernel.h"
+
+// Below this the alignment head and tail dominate; memcpy is as fast.
+#define STREAM_MIN_BYTES 256
+
+#if defined(__AVX2__)
+#define STREAM_ALIGN 32
+#else
+#define STREAM_ALIGN 16
+#endif
+
+static void storeFence() {
+#if defined(__SSE2__)
+    _mm_sfence();
+#elif defined(__aarch64__)
+    __asm__ volatile("dmb ishst" ::: "memory");
+#endif
+}
+
+static void streamCopy(uint8_t* dst, const uint8_t* src, size_t size) {
+    if (size >= STREAM_MIN_BYTES) {
+        // Non-temporal stores on x86 need aligned destinations.
+        size_t head = (STREAM_ALIGN - ((uintptr_t)dst & (STREAM_ALIGN - 1))) & (STREAM_ALIGN - 1);
+        memcpy(dst, src, head);
+        dst += head;
+        src += head;
+        size -= head;
+#if defined(__AVX2__)
+        for (; size >= 64; size -= 64, dst += 64, src += 64) {
+            __m256i a = _mm256_loadu_si256((const __m256i*)src);
+            __m256i b = _mm256_loadu_si256((const __m256i*)(src + 32));
+            _mm256_stream_si256((__m256i*)dst, a);
+            _mm256_stream_si256((__m256i*)(dst + 32), b);
+        }
+#elif defined(__SSE2__)
+        for (; size >= 64; size -= 64, dst += 64, src += 64) {
+            __m128i a = _mm_loadu_si128((const __m128i*)src);
+            __m128i b = _mm_loadu_si128((const __m128i*)(src + 16));
+            __m128i c = _mm_loadu_si128((const __m128i*)(src + 32));
+            __m128i d = _mm_loadu_si128((const __m128i*)(src + 48));
+            _mm_stream_si128((__m128i*)dst, a);
+            _mm_stream_si128((__m128i*)(dst + 16), b);
+            _mm_stream_si128((__m128i*)(dst + 32), c);
+            _mm_stream_si128((__m128i*)(dst + 48), d);
+        }
+#elif defined(__aarch64__)
+        for (; size >= 64; size -= 64, dst += 64, src += 64) {
+            uint8x16_t a = vld1q_u8(src), b = vld1q_u8(src + 16);
+            uint8x16_t c = vld1q_u8(src + 32), d = vld1q_u8(src + 48);
+            __asm__ volatile("stnp %q[a], %q[b], [%[dst]]\n\t"
+                             "stnp %q[c], %q[d], [%[dst], #32]"
+                             :
+                             : [a] "w"(a), [b] "w"(b), [c] "w"(c), [d] "w"(d), [dst] "r"(dst)
+                             : "memory");
+        }
+#endif
+    }
+    memcpy(dst, src, size);
+}
+
+static void streamZero(uint8_t* dst, size_t size) {
+    if (size >= STREAM_MIN_BYTES) {
+        size_t head = (STREAM_ALIGN - ((uintptr_t)dst & (STREAM_ALIGN - 1))) & (STREAM_ALIGN - 1);
+        memset(dst, 0, head);
+        dst += head;
+        size -= head;
+#if defined(__AVX2__)
+        __m256i z = _mm256_setzero_si256();
+        for (; size >= 64; size -= 64, dst += 64) {
+            _mm256_stream_si256((__m256i*)dst, z);
+            _mm256_stream_si256((__m256i*)(dst + 32), z);
+        }
+#elif defined(__SSE2__)
+        __m128i z = _mm_setzero_si128();
+        for (; size >= 64; size -= 64, dst += 64) {
+            _mm_stream_si128((__m128i*)dst, z);
+            _mm_stream_si128((__m128i*)(dst + 16), z);
+            _mm_stream_si128((__m128i*)(dst + 32), z);
+            _mm_stream_si128((__m128i*)(dst + 48), z);
+        }
+#elif defined(__aarch64__)
+        uint8x16_t z = vdupq_n_u8(0);
+        for (; size >= 64; size -= 64, dst += 64) {
+            __asm__ volatile("stnp %q[z], %q[z], [%[dst]]\n\t"
+                             "stnp %q[z], %q[z], [%[dst], #32]"
+                             :
+                             : [z] "w"(z), [dst] "r"(dst)
+                             : "memory");
+        }
+#endif
+    }
+    memset(dst, 0, size);
+}
+
+int CopyKernel::parseType(std::string name, Type* type) {
+    if (name == "memcpy") {
+        *type = COPY_MEMCPY;
+    } else if (name == "stream") {
+        *type = COPY_STREAM;
+    } else {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+const char* CopyKernel::getName(Type type) {
+    return type == COPY_STREAM ? "stream" : "memcpy";
+}
+
+void CopyKernel::copy(Type type, void* dst, const void* src, size_t size) {
+    if (type == COPY_STREAM) {
+        streamCopy((uint8_t*)dst, (const uint8_t*)src, size);
+        storeFence();
+    } else {
+        memcpy(dst, src, size);
+    }
+}
+
+void CopyKernel::copyPlane(Type type, void* dst, size_t dstStride, const void* src,
+                           size_t srcStride, size_t rowBytes, int rows) {
+    if (rows <= 0) {
+        return;
+    }
+    if (dstStride == rowBytes && srcStride == rowBytes) {
+        copy(type, dst, src, rowBytes * rows);
+        return;
+    }
+    uint8_t* d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
+    for (int i = 0; i < rows; i++, d += dstStride, s += srcStride) {
+        if (type == COPY_STREAM) {
+            streamCopy(d, s, rowBytes);
+        } else {
+            memcpy(d, s, rowBytes);
+        }
+    }
+    if (type == COPY_STREAM) {
+        storeFence();
+    }
+}
+
+void CopyKernel::zero(Type type, void* dst, size_t size) {
+    if (type == COPY_STREAM) {
+        streamZero((uint8_t*)dst, size);
+        storeFence();
+    } else {
+        memset(dst, 0, size);
+    }
+}
+
+double CopyKernel::benchmark(Type type, void* dst, size_t dstStride, size_t rowBytes, int rows,
+                             int iterations) {
+    if (rows <= 0 || iterations <= 0) {
+        return 0;
+    }
+    std::vector<uint8_t> src(rowBytes * rows);
+    for (size_t i = 0; i < src.size(); i++) {
+        src[i] = (uint8_t)(i * 7);
+    }
+    // One untimed pass faults in both sides.
+    copyPlane(type, dst, dstStride, src.data(), rowBytes, rowBytes, rows);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        copyPlane(type, dst, dstStride, src.data(), rowBytes, rowBytes, rows);
+    }
+    double ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+    return ms / iterations;
+}
@@ -0,0 +1,546 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "DecodeCrossCheck.h"
+#include "FrameChecksum.h"
+#include "FrameQuality.h"
+
+// Software frames kept for the PSNR of a mismatch found in checkFrame().
+#define CROSS_CHECK_WINDOW 8
+// Hardware frames copied while they wait for the software decoder.
+#define CROSS_CHECK_SNAPSHOTS 8
+#define CROSS_CHECK_HASH_CHUNK (4 << 20)
+
+DecodeCrossCheck::DecodeCrossCheck(std::string sessionId) : mSessionId(sessionId) {}
+
+DecodeCrossCheck::~DecodeCrossCheck() {
+    deinit();
+}
+
+std::string DecodeCrossCheck::id() {
+    return mSessionId;
+}
+
+int DecodeCrossCheck::init(std::string inputPath, int numThreads, std::string cacheDir,
+                           bool stopOnMismatch) {
+    int ret = 0;
+
+    mInputPath = inputPath;
+    mNumThreads = std::max(numThreads, 1);
+    mStopOnMismatch = stopOnMismatch;
+
+    mHwDigest = std::make_shared<FrameChecksum>(mSessionId);
+    mSwDigest = std::make_shared<FrameChecksum>(mSessionId);
+    mQuality = std::make_shared<FrameQuality>(mSessionId);
+    ret = mHwDigest->init("crc32c", "", "");
+    ret |= mSwDigest->init("crc32c", "", "");
+    ret |= mQuality->init(mNumThreads, "");
+    if (ret) {
+        return ret;
+    }
+
+    if (!cacheDir.empty()) {
+        std::string hash;
+        ret = hashInput(&hash);
+        if (ret) {
+            return ret;
+        }
+        mCachePath = cacheDir + "/" + hash + ".crc32c";
+        if (loadCache() == 0) {
+            mFromCache = true;
+            mDecodeDone = true;
+            LOGI("Cross-check: %zu reference digests from %s\n", mDigests.size(),
+                 mCachePath.c_str());
+        }
+    }
+
+    mThread = std::make_shared<std::thread>(&DecodeCrossCheck::threadLoop, this);
+    return 0;
+}
+
+void DecodeCrossCheck::deinit() {
+    {
+        std::unique_lock<std::mutex> lock(mLock);
+        mHwDone = true;
+    }
+    mCond.notify_all();
+    // The thread compares what is still pending and reports the first
+    // mismatch before it exits.
+    if (mThread) {
+        mThread->join();
+        mThread = nullptr;
+    }
+    for (auto& entry : mWindow) {
+        av_frame_free(&entry.second);
+    }
+    mWindow.clear();
+    mPending.clear();
+    mNumSnapshots = 0;
+    mRefRequest = nullptr;
+    closeDecoder();
+
+    if (mHwDigest) {
+        LOGI("Cross-check: %u frames compared against %zu software frames, %u mismatched\n",
+             mFrameCnt, mDigests.size(), mMismatchCnt.load());
+        mHwDigest->deinit();
+        mHwDigest = nullptr;
+    }
+    if (mSwDigest) {
+        mSwDigest->deinit();
+        mSwDigest = nullptr;
+    }
+    if (mQuality) {
+        mQuality->deinit();
+        mQuality = nullptr;
+    }
+}
+
+int DecodeCrossCheck::hashInput(std::string* hash) {
+    struct stat st;
+    int fd = open(mInputPath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOGE("Error: failed to open %s for hashing\n", mInputPath.c_str());
+        return -errno;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -EINVAL;
+    }
+
+    FrameChecksum md5(mSessionId);
+    int ret = md5.init("md5", "", "");
+    if (ret) {
+        close(fd);
+        return ret;
+    }
+    md5.begin();
+    if (st.st_size > 0) {
+        void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            LOGE("Error: failed to mmap %s for hashing\n", mInputPath.c_str());
+            close(fd);
+            return -ENOMEM;
+        }
+        madvise(base, st.st_size, MADV_SEQUENTIAL);
+        for (off_t off = 0; off < st.st_size; off += CROSS_CHECK_HASH_CHUNK) {
+            md5.update((const uint8_t*)base + off,
+                       std::min<off_t>(CROSS_CHECK_HASH_CHUNK, st.st_size - off));
+        }
+        munmap(base, st.st_size);
+    }
+    md5.end();
+    close(fd);
+    *hash = md5.getLastDigest();
+    return 0;
+}
+
+int DecodeCrossCheck::loadCache() {
+    std::ifstream file(mCachePath);
+    std::string line;
+
+    if (!file.is_open()) {
+        return -ENOENT;
+    }
+    while (std::getline(file, line)) {
+        std::istringstream tokens(line);
+        std::string token, last;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        while (tokens >> token) {
+            last = token;
+        }
+        if (!last.empty()) {
+            mDigests.push_back(last);
+        }
+    }
+    if (mDigests.empty()) {
+        LOGW("Ignoring empty cross-check cache %s\n", mCachePath.c_str());
+        return -EINVAL;
+    }
+    return 0;
+}
+
+void DecodeCrossCheck::writeCache() {
+    // Write aside and rename, so a concurrent session never reads a partial file.
+    std::string tmpPath = mCachePath + ".tmp." + std::to_string(getpid()) + "." + mSessionId;
+    FILE* file = fopen(tmpPath.c_str(), "w");
+    if (file == nullptr) {
+        LOGW("Failed to write cross-check cache %s\n", tmpPath.c_str());
+        return;
+    }
+    fprintf(file, "# crc32c %s\n", mInputPath.c_str());
+    for (size_t i = 0; i < mDigests.size(); i++) {
+        fprintf(file, "%zu %s\n", i, mDigests[i].c_str());
+    }
+    fclose(file);
+    if (rename(tmpPath.c_str(), mCachePath.c_str())) {
+        LOGW("Failed to publish cross-check cache %s\n", mCachePath.c_str());
+        unlink(tmpPath.c_str());
+        return;
+    }
+    LOGI("Cross-check: cached %zu reference digests in %s\n", mDigests.size(),
+         mCachePath.c_str());
+}
+
+int DecodeCrossCheck::openDecoder() {
+    const AVCodec* codec = nullptr;
+    int ret = 0;
+
+    ret = avformat_open_input(&mFmtCtx, mInputPath.c_str(), nullptr, nullptr);
+    if (ret) {
+        LOGE("Error: cross-check failed to open %s\n", mInputPath.c_str());
+        return ret;
+    }
+    ret = avformat_find_stream_info(mFmtCtx, nullptr);
+    if (ret < 0) {
+        LOGE("Error: cross-check cannot find stream information\n");
+        return ret;
+    }
+    ret = av_find_best_stream(mFmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (ret < 0 || codec == nullptr) {
+        LOGE("Error: cross-check found no decodable video stream\n");
+        return ret < 0 ? ret : -EINVAL;
+    }
+    mStreamIdx = ret;
+
+    mCodecCtx = avcodec_alloc_context3(codec);
+    if (mCodecCtx == nullptr) {
+        return -ENOMEM;
+    }
+    ret = avcodec_parameters_to_context(mCodecCtx, mFmtCtx->streams[mStreamIdx]->codecpar);
+    if (ret < 0) {
+        return ret;
+    }
+    mCodecCtx->thread_count = mNumThreads;
+    mCodecCtx->thread_type = FF_THREAD_FRAME;
+    ret = avcodec_open2(mCodecCtx, codec, nullptr);
+    if (ret < 0) {
+        LOGE("Error: cross-check failed to open %s (%d)\n", codec->name, ret);
+        return ret;
+    }
+    LOGI("Cross-check with %s, %d frame threads\n", codec->name, mNumThreads);
+    return 0;
+}
+
+void DecodeCrossCheck::closeDecoder() {
+    if (mCodecCtx) {
+        avcodec_free_context(&mCodecCtx);
+    }
+    if (mFmtCtx) {
+        avformat_close_input(&mFmtCtx);
+    }
+    mStreamIdx = -1;
+}
+
+void DecodeCrossCheck::threadLoop() {
+    if (!mFromCache) {
+        decodeLoop(-1);
+        // Whatever is still pending is beyond the end of the software decode.
+        std::map<uint32_t, HwFrame> missing;
+        {
+            std::unique_lock<std::mutex> lock(mLock);
+            mDecodeDone = true;
+            missing.swap(mPending);
+            mNumSnapshots = 0;
+        }
+        for (auto& entry : missing) {
+            onMismatch(entry.first, entry.second.digest, "", nullptr, nullptr, 0, nullptr, 0,
+                       0, 0);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(mLock);
+    mCond.wait(lock, [&]() { return mRefRequest || mHwDone; });
+    if (!mRefRequest) {
+        return;
+    }
+    uint32_t frameIdx = mRefRequest->frameIdx;
+    lock.unlock();
+
+    // Decode again, just far enough to score the first mismatch.
+    LOGI("Cross-check: decoding reference up to frame %u for PSNR\n", frameIdx);
+    decodeLoop(frameIdx);
+    lock.lock();
+    if (mRefRequest) {
+        const HwFrame& hw = *mRefRequest;
+        reportMismatch(hw.frameIdx, hw.digest, mRefExpected, nullptr, hw.y.data(), hw.width,
+                       hw.uv.data(), hw.width, hw.width, hw.height);
+        mRefRequest = nullptr;
+    }
+}
+
+void DecodeCrossCheck::decodeLoop(int64_t targetFrame) {
+    AVPacket* pkt = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    bool complete = false;
+    int ret = 0;
+
+    mTargetFrame = targetFrame;
+    mSwFrameCnt = 0;
+    ret = (pkt && frame) ? openDecoder() : -ENOMEM;
+    while (ret == 0) {
+        bool eof = av_read_frame(mFmtCtx, pkt) < 0;
+        if (!eof && pkt->stream_index != mStreamIdx) {
+            av_packet_unref(pkt);
+            continue;
+        }
+        // A null packet at end of file drains the frame threads.
+        if (avcodec_send_packet(mCodecCtx, eof ? nullptr : pkt) < 0) {
+            LOGW("Cross-check decoder rejected a packet\n");
+        }
+        av_packet_unref(pkt);
+        bool stop = false;
+        while ((ret = avcodec_receive_frame(mCodecCtx, frame)) == 0) {
+            stop = onReferenceFrame(frame) != 0;
+            av_frame_unref(frame);
+            if (stop) {
+                break;
+            }
+        }
+        if (stop) {
+            break;
+        }
+        if (ret == AVERROR_EOF) {
+            complete = true;
+        } else if (!eof) {
+            // EAGAIN, or a corrupt frame the decoder will conceal; keep feeding.
+            ret = 0;
+        }
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    closeDecoder();
+
+    if (complete && targetFrame < 0 && !mCachePath.empty()) {
+        writeCache();
+    }
+}
+
+int DecodeCrossCheck::onReferenceFrame(AVFrame* frame) {
+    uint32_t frameIdx = mSwFrameCnt++;
+
+    if (frame->format != AV_PIX_FMT_YUV420P && frame->format != AV_PIX_FMT_YUVJ420P &&
+        frame->format != AV_PIX_FMT_NV12) {
+        LOGE("Error: cross-check supports 8-bit 4:2:0 only, got format %d\n", frame->format);
+        return -EINVAL;
+    }
+    if (mTargetFrame >= 0) {
+        if (frameIdx < mTargetFrame) {
+            return 0;
+        }
+        std::unique_lock<std::mutex> lock(mLock);
+        if (mRefRequest) {
+            const HwFrame& hw = *mRefRequest;
+            reportMismatch(hw.frameIdx, hw.digest, mRefExpected, frame, hw.y.data(), hw.width,
+                           hw.uv.data(), hw.width, hw.width, hw.height);
+            mRefRequest = nullptr;
+        }
+        return 1;
+    }
+
+    digestFrame(frame);
+    std::string expected = mSwDigest->getLastDigest();
+    HwFrame hw;
+    bool found = false, stop = false;
+    {
+        std::unique_lock<std::mutex> lock(mLock);
+        mDigests.push_back(expected);
+        if (mMismatchCnt == 0) {
+            mWindow[frameIdx] = av_frame_clone(frame);
+            while (mWindow.size() > CROSS_CHECK_WINDOW) {
+                av_frame_free(&mWindow.begin()->second);
+                mWindow.erase(mWindow.begin());
+            }
+        }
+        auto itr = mPending.find(frameIdx);
+        if (itr != mPending.end()) {
+            hw = std::move(itr->second);
+            mPending.erase(itr);
+            found = true;
+            if (!hw.y.empty()) {
+                mNumSnapshots--;
+            }
+        }
+        // Once the hardware session is done, nothing is left to compare.
+        stop = mHwDone && mPending.empty();
+    }
+    if (found && hw.digest != expected) {
+        bool hasPixels = !hw.y.empty();
+        onMismatch(frameIdx, hw.digest, expected, hasPixels ? frame : nullptr,
+                   hasPixels ? hw.y.data() : nullptr, hw.width,
+                   hasPixels ? hw.uv.data() : nullptr, hw.width, hw.width, hw.height);
+    }
+    return stop ? 1 : 0;
+}
+
+void DecodeCrossCheck::snapshot(HwFrame* hw, const uint8_t* y, int yStride, const uint8_t* uv,
+                                int uvStride, int width, int height) {
+    hw->width = width;
+    hw->height = height;
+    hw->y.resize((size_t)width * height);
+    hw->uv.resize((size_t)width * (height / 2));
+    for (int i = 0; i < height; i++) {
+        memcpy(hw->y.data() + (size_t)i * width, y + (size_t)i * yStride, width);
+    }
+    for (int i = 0; i < height / 2; i++) {
+        memcpy(hw->uv.data() + (size_t)i * width, uv + (size_t)i * uvStride, width);
+    }
+}
+
+void DecodeCrossCheck::onMismatch(uint32_t frameIdx, const std::string& got,
+                                  const std::string& expected, AVFrame* ref, const uint8_t* y,
+                                  int yStride, const uint8_t* uv, int uvStride, int width,
+                                  int height) {
+    if (mMismatchCnt++ > 0) {
+        LOGE("Cross-check mismatch at frame %u: hw %s, sw %s\n", frameIdx, got.c_str(),
+             expected.empty() ? "<none>" : expected.c_str());
+        return;
+    }
+    if (ref == nullptr && y != nullptr && !expected.empty()) {
+        // The software frame is gone; the thread decodes it again for the PSNR.
+        auto hw = std::make_unique<HwFrame>();
+        hw->frameIdx = frameIdx;
+        hw->digest = got;
+        snapshot(hw.get(), y, yStride, uv, uvStride, width, height);
+        {
+            std::unique_lock<std::mutex> lock(mLock);
+            mRefRequest = std::move(hw);
+            mRefExpected = expected;
+        }
+        mCond.notify_all();
+        return;
+    }
+    reportMismatch(frameIdx, got, expected, ref, y, yStride, uv, uvStride, width, height);
+}
+
+const uint8_t* DecodeCrossCheck::interleaveChroma(const AVFrame* frame,
+                                                  std::vector<uint8_t>& scratch, int* stride) {
+    if (frame->format == AV_PIX_FMT_NV12) {
+        *stride = frame->linesize[1];
+        return frame->data[1];
+    }
+    // Planar chroma is interleaved so both sides are hashed and scored as NV12.
+    int chromaWidth = (frame->width + 1) / 2, chromaHeight = (frame->height + 1) / 2;
+    scratch.resize((size_t)chromaWidth * 2 * chromaHeight);
+    for (int y = 0; y < chromaHeight; y++) {
+        const uint8_t* u = frame->data[1] + (size_t)y * frame->linesize[1];
+        const uint8_t* v = frame->data[2] + (size_t)y * frame->linesize[2];
+        uint8_t* dst = scratch.data() + (size_t)y * chromaWidth * 2;
+        for (int x = 0; x < chromaWidth; x++) {
+            dst[2 * x] = u[x];
+            dst[2 * x + 1] = v[x];
+        }
+    }
+    *stride = chromaWidth * 2;
+    return scratch.data();
+}
+
+void DecodeCrossCheck::digestFrame(const AVFrame* frame) {
+    int uvStride = 0;
+    const uint8_t* uv = interleaveChroma(frame, mUVScratch, &uvStride);
+
+    // Same rows as V4l2Decoder::checksumOutputFrame(): visible luma, then
+    // height / 2 rows of width bytes of interleaved chroma.
+    mSwDigest->begin();
+    for (int y = 0; y < frame->height; y++) {
+        mSwDigest->update(frame->data[0] + (size_t)y * frame->linesize[0], frame->width);
+    }
+    for (int y = 0; y < frame->height / 2; y++) {
+        mSwDigest->update(uv + (size_t)y * uvStride, frame->width);
+    }
+    mSwDigest->end();
+}
+
+int DecodeCrossCheck::checkFrame(const uint8_t* y, int yStride, const uint8_t* uv, int uvStride,
+                                 int width, int height) {
+    uint32_t frameIdx = mFrameCnt++;
+    AVFrame* ref = nullptr;
+    std::string expected;
+    bool compare = false;
+
+    mHwDigest->begin();
+    for (int i = 0; i < height; i++) {
+        mHwDigest->update(y + (size_t)i * yStride, width);
+    }
+    for (int i = 0; i < height / 2; i++) {
+        mHwDigest->update(uv + (size_t)i * uvStride, width);
+    }
+    mHwDigest->end();
+    std::string got = mHwDigest->getLastDigest();
+
+    {
+        std::unique_lock<std::mutex> lock(mLock);
+        if (frameIdx < mDigests.size()) {
+            compare = true;
+            expected = mDigests[frameIdx];
+            auto itr = mWindow.find(frameIdx);
+            if (got != expected && itr != mWindow.end()) {
+                ref = av_frame_clone(itr->second);
+            }
+        } else if (mDecodeDone) {
+            compare = true;
+        } else {
+            // The software decoder is behind; it compares this frame later.
+            HwFrame& hw = mPending[frameIdx];
+            hw.frameIdx = frameIdx;
+            hw.digest = got;
+            if (mMismatchCnt == 0 && mNumSnapshots < CROSS_CHECK_SNAPSHOTS) {
+                snapshot(&hw, y, yStride, uv, uvStride, width, height);
+                mNumSnapshots++;
+            }
+        }
+        while (!mWindow.empty() && mWindow.begin()->first < frameIdx) {
+            av_frame_free(&mWindow.begin()->second);
+            mWindow.erase(mWindow.begin());
+        }
+    }
+
+    if (compare && got != expected) {
+        onMismatch(frameIdx, got, expected, ref, y, yStride, uv, uvStride, width, height);
+    }
+    av_frame_free(&ref);
+    return mStopOnMismatch && mMismatchCnt > 0 ? -EBADMSG : 0;
+}
+
+void DecodeCrossCheck::reportMismatch(uint32_t frameIdx, const std::string& got,
+                                      const std::string& expected, AVFrame* ref,
+                                      const uint8_t* y, int yStride, const uint8_t* uv,
+                                      int uvStride, int width, int height) {
+    if (expected.empty()) {
+        LOGE("Cross-check: first mismatch at frame %u, hw %s, software decode has only %zu "
+             "frames\n", frameIdx, got.c_str(), mDigests.size());
+        return;
+    }
+    if (ref == nullptr || ref->width != width || ref->height != height) {
+        LOGE("Cross-check: first mismatch at frame %u, hw %s, sw %s (no comparable "
+             "reference frame)\n", frameIdx, got.c_str(), expected.c_str());
+        return;
+    }
+
+    std::vector<uint8_t> scratch;
+    int refUVStride = 0;
+    const uint8_t* refUV = interleaveChroma(ref, scratch, &refUVStride);
+    QualityMetrics metrics;
+    mQuality->compare(y, yStride, uv, uvStride, ref->data[0], ref->linesize[0], refUV,
+                      refUVStride, width, height, &metrics);
+    LOGE("Cross-check: first mismatch at frame %u, hw %s, sw %s, PSNR Y %.2f U %.2f V %.2f "
+         "dB\n", frameIdx, got.c_str(), expected.c_str(), metrics.psnr[QUALITY_PLANE_Y],
+         metrics.psnr[QUALITY_PLANE_U], metrics.psnr[QUALITY_PLANE_V]);
+}
@@ -0,0 +1,131 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <linux/dma-buf.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "CopyKernel.h"
+#include "DmaHeapBenchmark.h"
+#include "V4l2Codec.h"
+#include "V4l2Driver.h"
+
+#define ALIGN(num, to) (((num) + (to - 1)) & (~(to - 1)))
+
+static int syncBuf(int fd, uint64_t flags) {
+    struct dma_buf_sync sync;
+    sync.flags = flags;
+    return ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+DmaHeapBenchmark::DmaHeapBenchmark(std::string sessionId) : mSessionId(sessionId) {}
+
+std::string DmaHeapBenchmark::id() {
+    return mSessionId;
+}
+
+int DmaHeapBenchmark::run(int width, int height, int stride, int scanline, int iterations) {
+    if (width <= 0 || height <= 0 || stride < width || scanline < height || iterations <= 0) {
+        LOGE("Error: invalid heap benchmark frame %dx%d in %dx%d\n", width, height, stride,
+             scanline);
+        return -EINVAL;
+    }
+    std::vector<std::string> heaps = V4l2Driver::listDMAHeaps();
+    if (heaps.empty()) {
+        LOGE("Error: no DMA heaps in /dev/dma_heap\n");
+        return -ENOENT;
+    }
+
+    // Packed NV12 source frame in system memory.
+    std::vector<uint8_t> frame((size_t)width * height +
+                               (size_t)ALIGN(width, 2) * ((height + 1) / 2));
+    for (size_t i = 0; i < frame.size(); i++) {
+        frame[i] = (uint8_t)(i * 7);
+    }
+    LOGI("Heap benchmark: %dx%d NV12 in %dx%d, %d frames per heap\n", width, height, stride,
+         scanline, iterations);
+    for (auto& heap : heaps) {
+        runHeap(heap, frame, width, height, stride, scanline, iterations);
+    }
+    return 0;
+}
+
+int DmaHeapBenchmark::runHeap(const std::string& heap, const std::vector<uint8_t>& frame,
+                              int width, int height, int stride, int scanline, int iterations) {
+    V4l2Driver driver(mSessionId);
+    int fd = -1;
+    if (driver.OpenDMAHeap(heap)) {
+        LOGW("Heap %s: cannot open, skipped\n", heap.c_str());
+        return -EINVAL;
+    }
+    int uvWidth = ALIGN(width, 2), uvHeight = (height + 1) / 2;
+    size_t size = (size_t)stride * scanline + (size_t)stride * ALIGN(uvHeight, 16);
+    int ret = driver.AllocDMABuffer(size, &fd);
+    driver.CloseDMAHeap();
+    if (ret < 0) {
+        LOGW("Heap %s: cannot allocate %zu bytes, skipped\n", heap.c_str(), size);
+        return ret;
+    }
+
+    {
+        MapBuf map(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (!map.isMapSucess()) {
+            LOGW("Heap %s: cannot map, skipped\n", heap.c_str());
+            close(fd);
+            return -EINVAL;
+        }
+        uint8_t* y = (uint8_t*)map.getMappedAddr();
+        uint8_t* uv = y + (size_t)stride * scanline;
+        bool uncached = V4l2Driver::isUncachedHeap(heap);
+        CopyKernel::Type kernel = uncached ? CopyKernel::COPY_STREAM : CopyKernel::COPY_MEMCPY;
+        std::vector<uint8_t> dump(frame.size());
+        const uint8_t* srcUV = frame.data() + (size_t)width * height;
+
+        typedef std::chrono::steady_clock Clock;
+        auto ms = [](Clock::time_point a, Clock::time_point b) {
+            return std::chrono::duration<double, std::milli>(b - a).count();
+        };
+        double fillMs = 0, dumpMs = 0, syncMs = 0;
+        // The first frame faults the mapping in and is not counted.
+        for (int i = 0; i <= iterations; i++) {
+            auto t0 = Clock::now();
+            syncBuf(fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+            auto t1 = Clock::now();
+            CopyKernel::copyPlane(kernel, y, stride, frame.data(), width, width, height);
+            CopyKernel::copyPlane(kernel, uv, stride, srcUV, uvWidth, uvWidth, uvHeight);
+            auto t2 = Clock::now();
+            syncBuf(fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+            auto t3 = Clock::now();
+            syncBuf(fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+            auto t4 = Clock::now();
+            CopyKernel::copyPlane(CopyKernel::COPY_MEMCPY, dump.data(), width, y, stride, width,
+                                  height);
+            CopyKernel::copyPlane(CopyKernel::COPY_MEMCPY, dump.data() + (size_t)width * height,
+                                  uvWidth, uv, stride, uvWidth, uvHeight);
+            auto t5 = Clock::now();
+            syncBuf(fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+            auto t6 = Clock::now();
+            if (i > 0) {
+                fillMs += ms(t1, t2);
+                dumpMs += ms(t4, t5);
+                syncMs += ms(t0, t1) + ms(t2, t3) + ms(t3, t4) + ms(t5, t6);
+            }
+        }
+        fillMs /= iterations;
+        dumpMs /= iterations;
+        syncMs /= iterations;
+        LOGI("Heap %s (%s, %s): fill %.3f ms, dump %.3f ms, sync %.3f ms%s; %.3f ms per frame\n",
+             heap.c_str(), uncached ? "uncached" : "cached", CopyKernel::getName(kernel), fillMs,
+             dumpMs, syncMs, uncached ? " (skipped)" : "",
+             fillMs + dumpMs + (uncached ? 0 : syncMs));
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#include "EncoderEvaluator.h"
+#include "FrameQuality.h"
+
+EncoderEvaluator::EncoderEvaluator(std::string sessionId) : mSessionId(sessionId) {}
+
+EncoderEvaluator::~EncoderEvaluator() {
+    deinit();
+}
+
+std::string EncoderEvaluator::id() {
+    return mSessionId;
+}
+
+int EncoderEvaluator::init(unsigned int codecFmt, int width, int height, double frameRate,
+                           int numThreads, std::string logPath) {
+    enum AVCodecID codecId = AV_CODEC_ID_NONE;
+    const AVCodec* codec = nullptr;
+    int ret = 0;
+
+    switch (codecFmt) {
+        case V4L2_PIX_FMT_H264:
+            codecId = AV_CODEC_ID_H264;
+            break;
+        case V4L2_PIX_FMT_HEVC:
+            codecId = AV_CODEC_ID_HEVC;
+            break;
+        default:
+            LOGE("Error: no software decoder for codec %#x\n", codecFmt);
+            return -EINVAL;
+    }
+    codec = avcodec_find_decoder(codecId);
+    if (codec == nullptr) {
+        LOGE("Error: libavcodec has no decoder for codec %#x\n", codecFmt);
+        return -EINVAL;
+    }
+    mCodecCtx = avcodec_alloc_context3(codec);
+    mFrame = av_frame_alloc();
+    if (mCodecCtx == nullptr || mFrame == nullptr) {
+        return -ENOMEM;
+    }
+    mCodecCtx->thread_count = numThreads;
+    mCodecCtx->thread_type = FF_THREAD_FRAME;
+    ret = avcodec_open2(mCodecCtx, codec, nullptr);
+    if (ret < 0) {
+        LOGE("Error: failed to open software decoder (%d)\n", ret);
+        return ret;
+    }
+
+    mWidth = width;
+    mHeight = height;
+    mQuality = std::make_shared<FrameQuality>(mSessionId);
+    ret = mQuality->init(numThreads, logPath);
+    if (ret) {
+        return ret;
+    }
+    mQuality->setFrameRate(frameRate);
+
+    mFlush = false;
+    mThread = std::make_shared<std::thread>(&EncoderEvaluator::threadLoop, this);
+    LOGI("Loopback evaluation with %s\n", codec->name);
+    return 0;
+}
+
+void EncoderEvaluator::deinit() {
+    if (mThread) {
+        {
+            std::unique_lock<std::mutex> lock(mLock);
+            mFlush = true;
+        }
+        mCond.notify_all();
+        mThread->join();
+        mThread = nullptr;
+    }
+    for (auto pkt : mPackets) {
+        av_packet_free(&pkt);
+    }
+    mPackets.clear();
+    for (auto& source : mSources) {
+        av_packet_free(&source.second);
+    }
+    mSources.clear();
+    mFrameBytes.clear();
+    if (mQuality) {
+        mQuality->deinit();
+        mQuality = nullptr;
+    }
+    if (mFrame) {
+        av_frame_free(&mFrame);
+    }
+    if (mCodecCtx) {
+        avcodec_free_context(&mCodecCtx);
+    }
+}
+
+void EncoderEvaluator::pushSource(int64_t timestampUs, AVPacket* frame) {
+    std::unique_lock<std::mutex> lock(mLock);
+    auto itr = mSources.find(timestampUs);
+    if (itr != mSources.end()) {
+        av_packet_free(&itr->second);
+    }
+    mSources[timestampUs] = frame;
+}
+
+int EncoderEvaluator::pushEncoded(const uint8_t* data, int size, int64_t timestampUs) {
+    AVPacket* pkt = av_packet_alloc();
+    if (pkt == nullptr || av_new_packet(pkt, size) < 0) {
+        av_packet_free(&pkt);
+        return -ENOMEM;
+    }
+    memcpy(pkt->data, data, size);
+    pkt->pts = timestampUs;
+    pkt->dts = AV_NOPTS_VALUE;
+    {
+        std::unique_lock<std::mutex> lock(mLock);
+        mPackets.push_back(pkt);
+        mFrameBytes[timestampUs] = size;
+    }
+    mCond.notify_all();
+    return 0;
+}
+
+void EncoderEvaluator::threadLoop() {
+    while (1) {
+        AVPacket* pkt = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mLock);
+            mCond.wait(lock, [&]() { return mFlush || !mPackets.empty(); });
+            if (!mPackets.empty()) {
+                pkt = mPackets.front();
+                mPackets.pop_front();
+            }
+        }
+        if (pkt == nullptr) {
+            // Drain frames still held by the decoder.
+            avcodec_send_packet(mCodecCtx, nullptr);
+            receiveFrames();
+            return;
+        }
+        int ret = avcodec_send_packet(mCodecCtx, pkt);
+        av_packet_free(&pkt);
+        if (ret < 0) {
+            LOGW("Software decoder rejected a packet (%d)\n", ret);
+            continue;
+        }
+        receiveFrames();
+    }
+}
+
+int EncoderEvaluator::receiveFrames() {
+    while (1) {
+        int ret = avcodec_receive_frame(mCodecCtx, mFrame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            return 0;
+        }
+        if (ret < 0) {
+            LOGW("Software decode failed (%d)\n", ret);
+            return ret;
+        }
+        evaluateFrame(mFrame);
+        av_frame_unref(mFrame);
+    }
+}
+
+void EncoderEvaluator::evaluateFrame(AVFrame* frame) {
+    int64_t pts = frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp
+                                                                 : frame->pts;
+    AVPacket* source = nullptr;
+    int frameBytes = -1;
+    {
+        std::unique_lock<std::mutex> lock(mLock);
+        // Frames come out in display order; sources before this one were
+        // skipped by the encoder and will never be matched.
+        while (!mSources.empty() && mSources.begin()->first < pts) {
+            av_packet_free(&mSources.begin()->second);
+            mSources.erase(mSources.begin());
+        }
+        auto itr = mSources.find(pts);
+        if (itr != mSources.end()) {
+            source = itr->second;
+            mSources.erase(itr);
+        }
+        auto bytes = mFrameBytes.find(pts);
+        if (bytes != mFrameBytes.end()) {
+            frameBytes = bytes->second;
+            mFrameBytes.erase(bytes);
+        }
+    }
+    if (source == nullptr) {
+        LOGW("No source frame for timestamp %lld\n", (long long)pts);
+        return;
+    }
+    if (frame->width != mWidth || frame->height != mHeight ||
+        (frame->format != AV_PIX_FMT_YUV420P && frame->format != AV_PIX_FMT_NV12)) {
+        LOGW("Unsupported reconstruction %dx%d format %d\n", frame->width, frame->height,
+             frame->format);
+        av_packet_free(&source);
+        return;
+    }
+
+    int chromaWidth = (mWidth + 1) / 2, chromaHeight = (mHeight + 1) / 2;
+    const uint8_t* uv = frame->data[1];
+    int uvStride = frame->linesize[1];
+    if (frame->format == AV_PIX_FMT_YUV420P) {
+        // FrameQuality works on NV12, interleave the planar chroma.
+        mUVScratch.resize((size_t)chromaWidth * 2 * chromaHeight);
+        for (int y = 0; y < chromaHeight; y++) {
+            const uint8_t* u = frame->data[1] + (size_t)y * frame->linesize[1];
+            const uint8_t* v = frame->data[2] + (size_t)y * frame->linesize[2];
+            uint8_t* dst = mUVScratch.data() + (size_t)y * chromaWidth * 2;
+            for (int x = 0; x < chromaWidth; x++) {
+                dst[2 * x] = u[x];
+                dst[2 * x + 1] = v[x];
+            }
+        }
+        uv = mUVScratch.data();
+        uvStride = chromaWidth * 2;
+    }
+
+    QualityMetrics metrics;
+    const uint8_t* srcY = source->data;
+    const uint8_t* srcUV = source->data + (size_t)mWidth * mHeight;
+    mQuality->compare(frame->data[0], frame->linesize[0], uv, uvStride, srcY, mWidth, srcUV,
+                      chromaWidth * 2, mWidth, mHeight, &metrics);
+    mQuality->record(metrics, frameBytes);
+    av_packet_free(&source);
+}
@@ -6,15 +6,17 @@
 */
 
 #include <linux/videodev2.h>
+#include <algorithm>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
 
 #include "V4l2Driver.h"
 #include "FFStreamParser.h"
+#include "PacketCache.h"
 
-FFStreamParser::FFStreamParser(std::string inputPath, std::string sessionId)
-    : mInputPath(inputPath), mSessionId(sessionId) {}
+FFStreamParser::FFStreamParser(std::string inputPath, std::string sessionId, bool sharedCache)
+    : mUseSharedCache(sharedCache), mInputPath(inputPath), mSessionId(sessionId) {}
 
 FFStreamParser::~FFStreamParser() {}
 
@@ -34,6 +36,17 @@ int FFStreamParser::init() {
     const AVBitStreamFilter* filter = nullptr;
     int video_idx = 0, ret = 0;
 
+    if (mUseSharedCache) {
+        mCache = PacketCache::acquire(mInputPath, mSessionId);
+        if (!mCache) {
+            std::cerr << "[" << mSessionId << "]: Error: packet cache unavailable"
+                      << std::endl;
+            return -EINVAL;
+        }
+        mCursor = 0;
+        return 0;
+    }
+
     ret = avformat_open_input(&mFmtCtx, mInputPath.c_str(), nullptr, nullptr);
     if (ret) {
         std::cerr << "[" << mSessionId << "]: Error: Open input file failed"
@@ -127,6 +140,33 @@ int FFStreamParser::init() {
     return 0;
 }
 
+bool FFStreamParser::isKeyPacket() {
+    // Annex-B packets are checked for an IDR slice, so raw streams are
+    // indexed the same way as containers whose demuxer may not flag them.
+    if (mCodecFmt != V4L2_PIX_FMT_H264 && mCodecFmt != V4L2_PIX_FMT_HEVC) {
+        return mPkt->flags & AV_PKT_FLAG_KEY;
+    }
+    const uint8_t* data = mPkt->data;
+    for (int i = 0; i + 3 < mPkt->size; i++) {
+        if (data[i] || data[i + 1] || data[i + 2] != 1) {
+            continue;
+        }
+        uint8_t hdr = data[i + 3];
+        if (mCodecFmt == V4L2_PIX_FMT_H264) {
+            if ((hdr & 0x1f) == 5) {
+                return true;
+            }
+        } else {
+            int type = (hdr >> 1) & 0x3f;
+            if (type == 19 || type == 20) {
+                return true;
+            }
+        }
+        i += 3;
+    }
+    return false;
+}
+
 int FFStreamParser::getNextPacket() {
     int ret = 0;
 
@@ -168,9 +208,43 @@ int FFStreamParser::getNextPacket() {
     return ret;
 }
 
-int FFStreamParser::fillPacketData(void* dst, bool& eos) {
+int FFStreamParser::fillPacketData(void* dst, int dstSize, bool& eos) {
     int pktSize = 0;
 
+    if (mKeyFrameStride > 0) {
+        int next = nextSelectedKeyFrame(mNextFrame);
+        if (next < 0) {
+            mNextFrame = mTotalFrameCnt;
+        } else if (next != mNextFrame && seekToFrame(next)) {
+            return -EINVAL;
+        }
+    }
+    if ((mEndFrame >= 0 && mNextFrame >= mEndFrame) ||
+        (mKeyFrameStride > 0 && mNextFrame >= mTotalFrameCnt)) {
+        std::cout << "[" << mSessionId << "]: End of decode range at frame " << mNextFrame
+                  << std::endl;
+        eos = true;
+        return 0;
+    }
+
+    if (mCache) {
+        if (mCursor >= mCache->getPacketCount()) {
+            std::cout << "[" << mSessionId << "]: EOF." << std::endl;
+            eos = true;
+            return 0;
+        }
+        pktSize = mCache->getPacketSize(mCursor);
+        if (pktSize > dstSize) {
+            std::cerr << "[" << mSessionId << "]: Error: packet size " << pktSize
+                      << " exceeds input buffer size " << dstSize << std::endl;
+            return -ENOSPC;
+        }
+        CopyKernel::copy(mCopyKernel, dst, mCache->getPacketData(mCursor), pktSize);
+        mCursor++;
+        mNextFrame++;
+        return pktSize;
+    }
+
     while (1) {
         int parserRet = getNextPacket();
         if (parserRet == AVERROR(EAGAIN)) {
@@ -186,17 +260,58 @@ int FFStreamParser::fillPacketData(void* dst, bool& eos) {
             }
             break;
         }
+        if (mSkipToTs != AV_NOPTS_VALUE) {
+            // A keyframe seek lands at or before the target; drop the packets
+            // up to it so the next one fed is the requested frame.
+            int64_t ts = mPkt->dts != AV_NOPTS_VALUE ? mPkt->dts : mPkt->pts;
+            if (ts < mSkipToTs) {
+                av_packet_unref(mPkt);
+                continue;
+            }
+            if (ts > mSkipToTs) {
+                std::cerr << "[" << mSessionId << "]: Warning: seek passed frame "
+                          << mNextFrame << std::endl;
+            }
+            mSkipToTs = AV_NOPTS_VALUE;
+        }
 
-        memcpy(dst, mPkt->data, mPkt->size);
+        if (mPkt->size > dstSize) {
+            std::cerr << "[" << mSessionId << "]: Error: packet size " << mPkt->size
+                      << " exceeds input buffer size " << dstSize << std::endl;
+            av_packet_unref(mPkt);
+            return -ENOSPC;
+        }
+        CopyKernel::copy(mCopyKernel, dst, mPkt->data, mPkt->size);
         pktSize = mPkt->size;
         av_packet_unref(mPkt);
+        mNextFrame++;
         break;
     }
 
     return pktSize;
 }
 
+int FFStreamParser::readPacket(std::vector<uint8_t>& dst, bool* keyFrame) {
+    while (1) {
+        int parserRet = getNextPacket();
+        if (parserRet == AVERROR(EAGAIN) || parserRet == -EINVAL) {
+            continue;
+        }
+        if (parserRet < 0) {
+            return parserRet;
+        }
+        int pktSize = mPkt->size;
+        if (keyFrame) {
+            *keyFrame = isKeyPacket();
+        }
+        dst.insert(dst.end(), mPkt->data, mPkt->data + pktSize);
+        av_packet_unref(mPkt);
+        return pktSize;
+    }
+}
+
 void FFStreamParser::deinit() {
+    mCache = nullptr;
     mStream = nullptr;
     if (mBsf) {
         av_bsf_free(&mBsf);
@@ -213,17 +328,32 @@ void FFStreamParser::deinit() {
 }
 
 int FFStreamParser::seekToFrame(int frame) {
+    if (mCache) {
+        if (frame < 0 || frame >= mCache->getPacketCount()) {
+            return -1;
+        }
+        mCursor = frame;
+        mNextFrame = frame;
+        return 0;
+    }
+    if (frame < 0 || frame >= (int)mPktTimestamps.size()) {
+        return -1;
+    }
     if (!mRawVideo) {
-        int64_t seekPos = frame * AV_TIME_BASE * mFps_d / mFps_n;
-        std::cout << "[" << mSessionId << "]: Seek position:" << seekPos
+        // Seek to the keyframe at or before the frame's timestamp, then let
+        // fillPacketData() drop the packets up to it. A plain AVSEEK_FLAG_ANY
+        // seek could start the decoder on a non-IDR packet.
+        int64_t seekTs = mPktTimestamps[frame];
+        std::cout << "[" << mSessionId << "]: Seek timestamp:" << seekTs
                   << std::endl;
-        int ret = av_seek_frame(mFmtCtx, -1, seekPos, AVSEEK_FLAG_ANY | AVSEEK_FLAG_BACKWARD);
+        int ret = av_seek_frame(mFmtCtx, mStream->index, seekTs, AVSEEK_FLAG_BACKWARD);
         if (ret < 0) {
             std::cout << "[" << mSessionId
                       << "]: Error: failed to seek to frame " << frame
                       << std::endl;
             return ret;
         }
+        mSkipToTs = seekTs;
     } else {
         uint64_t pos = 0;
         if (mPktPosition.find(frame) == mPktPosition.end()) {
@@ -242,10 +372,54 @@ int FFStreamParser::seekToFrame(int frame) {
             return ret;
         }
     }
+    if (mBsf) {
+        av_bsf_flush(mBsf);
+        mBsfDataPending = false;
+    }
+    mNextFrame = frame;
 
     return 0;
 }
 
+bool FFStreamParser::isKeyFrame(int frame) const {
+    return std::binary_search(mKeyFrameList.begin(), mKeyFrameList.end(), frame);
+}
+
+int FFStreamParser::nextSelectedKeyFrame(int frame) {
+    auto itr = std::lower_bound(mKeyFrameList.begin(), mKeyFrameList.end(), frame);
+    size_t idx = itr - mKeyFrameList.begin();
+    idx = (idx + mKeyFrameStride - 1) / mKeyFrameStride * mKeyFrameStride;
+    return idx < mKeyFrameList.size() ? mKeyFrameList[idx] : -1;
+}
+
+int FFStreamParser::setDecodeRange(int start, int end) {
+    if (mKeyFrameList.empty()) {
+        std::cerr << "[" << mSessionId << "]: Error: no keyframe in the packet index"
+                  << std::endl;
+        return -EINVAL;
+    }
+    if (start < 0 || start >= mTotalFrameCnt || (end >= 0 && end <= start)) {
+        std::cerr << "[" << mSessionId << "]: Error: invalid decode range [" << start
+                  << ", " << end << ") of " << mTotalFrameCnt << " frames" << std::endl;
+        return -EINVAL;
+    }
+    auto itr = std::upper_bound(mKeyFrameList.begin(), mKeyFrameList.end(), start);
+    if (itr == mKeyFrameList.begin()) {
+        std::cerr << "[" << mSessionId << "]: Error: no keyframe before frame " << start
+                  << std::endl;
+        return -EINVAL;
+    }
+    int keyFrame = *(itr - 1);
+    int ret = seekToFrame(keyFrame);
+    if (ret) {
+        return ret;
+    }
+    mEndFrame = end;
+    std::cout << "[" << mSessionId << "]: Decode range [" << start << ", " << end
+              << ") from keyframe " << keyFrame << std::endl;
+    return keyFrame;
+}
+
 int FFStreamParser::randomSeek() {
     std::srand(std::time(nullptr));
     int rand_seekto = std::rand() % mTotalFrameCnt;
@@ -255,16 +429,37 @@ int FFStreamParser::randomSeek() {
     return rand_seekto;
 }
 
+int FFStreamParser::getPacketSizePercentile(int percentile) {
+    const std::vector<int>& pktSizes = mCache ? mCache->getPacketSizes() : mPktSizes;
+    if (pktSizes.empty()) {
+        return 0;
+    }
+    std::vector<int> sizes(pktSizes);
+    size_t idx = (sizes.size() - 1) * std::clamp(percentile, 0, 100) / 100;
+    std::nth_element(sizes.begin(), sizes.begin() + idx, sizes.end());
+    return sizes[idx];
+}
+
 int FFStreamParser::loopPackets() {
     int framecnt = 0;
-    if (!mRawVideo) {
-        std::cout << "[" << mSessionId << "]: Container format, just exit."
-                  << std::endl;
+    if (mCache) {
+        // The cache was indexed when it was built; nothing to scan.
+        mTotalFrameCnt = mCache->getPacketCount();
+        mMaxPktSize = mCache->getMaxPacketSize();
+        for (int i = 0; i < mTotalFrameCnt; i++) {
+            if (mCache->isKeyFrame(i)) {
+                mKeyFrameList.push_back(i);
+            }
+        }
+        std::cout << "[" << mSessionId << "]: Total frame count:" << mTotalFrameCnt
+                  << " (shared packet cache)" << std::endl;
+        seekToFrame(0);
         return 0;
     }
     while (1) {
         int parserRet = getNextPacket();
-        if (parserRet == AVERROR(EAGAIN)) {
+        if (parserRet == AVERROR(EAGAIN) || parserRet == -EINVAL) {
+            // -EINVAL: packet of a non-video stream in a container.
             continue;
         }
         if (parserRet < 0) {
@@ -276,12 +471,25 @@ int FFStreamParser::loopPackets() {
             }
             break;
         }
-        mPktPosition[framecnt++] = mPkt->pos;
+        if (mRawVideo) {
+            mPktPosition[framecnt] = mPkt->pos;
+        }
+        mPktTimestamps.push_back(mPkt->dts != AV_NOPTS_VALUE ? mPkt->dts : mPkt->pts);
+        if (isKeyPacket()) {
+            mKeyFrameList.push_back(framecnt);
+        }
+        mPktSizes.push_back(mPkt->size);
+        mMaxPktSize = std::max(mMaxPktSize, mPkt->size);
+        framecnt++;
         av_packet_unref(mPkt);
     }
     mTotalFrameCnt = framecnt;
     std::cout << "[" << mSessionId << "]: Total frame count:" << mTotalFrameCnt
-              << std::endl;
+              << ", keyframes:" << mKeyFrameList.size() << std::endl;
+    std::cout << "[" << mSessionId << "]: Packet size max:" << mMaxPktSize
+              << ", p50:" << getPacketSizePercentile(50)
+              << ", p95:" << getPacketSizePercentile(95)
+              << ", p99:" << getPacketSizePercentile(99) << std::endl;
     seekToFrame(0);
     return 0;
 }
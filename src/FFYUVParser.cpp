@@ -53,7 +53,9 @@ int FFYUVParser::init() {
                   << std::endl;
     } else {
         av_dict_set(&mFmtOptions, "video_size", mVideoSize.c_str(), 0);
-        av_dict_set(&mFmtOptions, "pixel_format", mPixelFmt.c_str(), 0);
+        // NV12M only differs in how planes are placed in memory; the file is plain NV12.
+        std::string fileFmt = mPixelFmt == "nv12m" ? std::string("nv12") : mPixelFmt;
+        av_dict_set(&mFmtOptions, "pixel_format", fileFmt.c_str(), 0);
         ret = avformat_open_input(&mFmtCtx, mInputPath.c_str(), nullptr, &mFmtOptions);
         if (ret) {
             std::cerr << "[" << mSessionId << "]: Error: Open input file failed"
@@ -82,11 +84,9 @@ int FFYUVParser::init() {
     return ret;
 }
 
-int FFYUVParser::fillPacketData(void* dst, int width, int height, int stride, int scanline,
-                                int colorFormat, bool& eos) {
-    uint8_t* pbuf = nullptr;
-    uint8_t* ptarget = nullptr;
-    int uvScanline, bufSize;
+int FFYUVParser::fillPacketData(void* dst, void* dstUV, int width, int height, int stride,
+                                int scanline, int colorFormat, bool& eos) {
+    int uvScanline, bufSize = 0;
     auto fillCompressedPacketData = [&]() -> int {
         int parserRet, pktSize = 0;
         // fill ubwc data
@@ -124,7 +124,8 @@ int FFYUVParser::fillPacketData(void* dst, int width, int height, int stride, in
                 break;
             }
             switch (colorFormat) {
-                case V4L2_PIX_FMT_NV12: {
+                case V4L2_PIX_FMT_NV12:
+                case V4L2_PIX_FMT_NV12M: {
                     uint8_t* pData = mPkt->data;
 
                     std::cout << "[" << mSessionId
@@ -134,46 +135,23 @@ int FFYUVParser::fillPacketData(void* dst, int width, int height, int stride, in
                               << ", scanline:" << scanline << std::endl;
                     uvScanline = ALIGN((height + 1) >> 1, 16);
                     bufSize = stride * scanline + stride * uvScanline;
-                    pbuf = new (std::nothrow) uint8_t[bufSize];
-                    if (pbuf == nullptr) {
-                        std::cerr << "[" << mSessionId
-                                  << "]: Error: failed to allocate pbuf."
-                                  << std::endl;
-                        return 0;
-                    }
-                    memset(pbuf, 0, bufSize);
-                    ptarget = pbuf;
-                    if (width == stride) {
-                        // Y Plane
-                        memcpy(ptarget, pData, width * height);
-                        // UV Plane
-                        ptarget += stride * scanline;
-                        pData += width * height;
-                        memcpy(ptarget, pData, width * height / 2);
-                    } else {
-                        // Y Plane
-                        for (int i = 0; i < height; i++) {
-                            memcpy(ptarget, pData, width);
-                            ptarget += stride;
-                            pData += width;
-                        }
-                        ptarget += (scanline - height) * stride;
-                        // UV Plane
-                        for (int i = 0; i < height / 2; i++) {
-                            memcpy(ptarget, pData, width);
-                            ptarget += stride;
-                            pData += width;
-                        }
-                    }
-                    memcpy(dst, pbuf, bufSize);
-                    delete[] pbuf;
-                    pbuf = nullptr;
+                    // Rows go straight into the device buffer; its padding is
+                    // left as the caller cleared it.
+                    uint8_t* y = (uint8_t*)dst;
+                    uint8_t* uv = dstUV ? (uint8_t*)dstUV : y + stride * scanline;
+                    CopyKernel::copyPlane(mCopyKernel, y, stride, pData, width, width, height);
+                    CopyKernel::copyPlane(mCopyKernel, uv, stride, pData + width * height, width,
+                                          width, height / 2);
                     break;
                 }
                 default:
                     break;
             }
             pktSize = mPkt->size ? bufSize : mPkt->size;
+            if (mRetainFrames && pktSize) {
+                av_packet_free(&mRetainedPkt);
+                mRetainedPkt = av_packet_clone(mPkt);
+            }
             av_packet_unref(mPkt);
             break;
         }
@@ -200,6 +178,10 @@ int FFYUVParser::deinit() {
         av_packet_free(&mPkt);
         mPkt = nullptr;
     }
+    if (mRetainedPkt) {
+        av_packet_free(&mRetainedPkt);
+        mRetainedPkt = nullptr;
+    }
     if (mInputFile) {
         fclose(mInputFile);
         mInputFile = nullptr;
@@ -207,6 +189,12 @@ int FFYUVParser::deinit() {
     return 0;
 }
 
+AVPacket* FFYUVParser::takeRetainedFrame() {
+    AVPacket* pkt = mRetainedPkt;
+    mRetainedPkt = nullptr;
+    return pkt;
+}
+
 int FFYUVParser::loopPackets() {
     int frameCnt = 0;
 
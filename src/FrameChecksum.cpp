@@ -0,0 +1,238 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+extern "C" {
+#include <libavutil/md5.h>
+#include <libavutil/mem.h>
+}
+
+#include "FrameChecksum.h"
+
+#define CRC32C_POLY 0x82F63B78  // Castagnoli, reflected
+
+static uint32_t sCrc32cTable[256];
+static std::once_flag sCrc32cTableOnce;
+
+static void initCrc32cTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        sCrc32cTable[i] = crc;
+    }
+}
+
+static uint32_t crc32cSoft(uint32_t crc, const uint8_t* p, size_t n) {
+    while (n--) {
+        crc = sCrc32cTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t crc32cHw(uint32_t crc, const uint8_t* p,
+                                                            size_t n) {
+    uint64_t crc64 = crc;
+    while (n >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        n -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (n--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+static bool hasHwCrc32c() {
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__)
+__attribute__((target("+crc"))) static uint32_t crc32cHw(uint32_t crc, const uint8_t* p,
+                                                          size_t n) {
+    while (n >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = __crc32cd(crc, v);
+        p += 8;
+        n -= 8;
+    }
+    while (n--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+
+static bool hasHwCrc32c() {
+    return getauxval(AT_HWCAP) & HWCAP_CRC32;
+}
+#else
+static uint32_t crc32cHw(uint32_t crc, const uint8_t* p, size_t n) {
+    return crc32cSoft(crc, p, n);
+}
+
+static bool hasHwCrc32c() {
+    return false;
+}
+#endif
+
+static uint32_t crc32cUpdate(uint32_t crc, const uint8_t* p, size_t n) {
+    static const bool sHwCrc = hasHwCrc32c();
+    return sHwCrc ? crc32cHw(crc, p, n) : crc32cSoft(crc, p, n);
+}
+
+FrameChecksum::FrameChecksum(std::string sessionId) : mSessionId(sessionId) {}
+
+FrameChecksum::~FrameChecksum() {
+    deinit();
+}
+
+std::string FrameChecksum::id() {
+    return mSessionId;
+}
+
+int FrameChecksum::init(std::string type, std::string outputPath, std::string referencePath) {
+    std::transform(type.begin(), type.end(), type.begin(),
+                   [](unsigned char c) { return std::toupper(c); });
+    if (type == "CRC32C") {
+        mType = CHECKSUM_CRC32C;
+        std::call_once(sCrc32cTableOnce, initCrc32cTable);
+        LOGI("Frame checksum: CRC32C (%s)\n", hasHwCrc32c() ? "hardware" : "table");
+    } else if (type == "MD5") {
+        mType = CHECKSUM_MD5;
+        mMd5 = av_md5_alloc();
+        if (mMd5 == nullptr) {
+            return -ENOMEM;
+        }
+        LOGI("Frame checksum: MD5\n");
+    } else {
+        LOGE("Error: unsupported checksum type %s\n", type.c_str());
+        return -EINVAL;
+    }
+
+    if (!outputPath.empty()) {
+        mOutputFile = fopen(outputPath.c_str(), "w");
+        if (mOutputFile == nullptr) {
+            LOGE("Error: failed to open checksum file %s\n", outputPath.c_str());
+            return -EINVAL;
+        }
+    }
+    if (!referencePath.empty()) {
+        return loadReference(referencePath);
+    }
+    return 0;
+}
+
+int FrameChecksum::loadReference(std::string referencePath) {
+    std::ifstream file(referencePath);
+    std::string line;
+
+    if (!file.is_open()) {
+        LOGE("Error: failed to open checksum reference %s\n", referencePath.c_str());
+        return -EINVAL;
+    }
+    while (std::getline(file, line)) {
+        std::istringstream tokens(line);
+        std::string token, last;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        while (tokens >> token) {
+            last = token;
+        }
+        if (last.empty()) {
+            continue;
+        }
+        std::transform(last.begin(), last.end(), last.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+        mExpected.push_back(last);
+    }
+    mHasReference = true;
+    LOGI("Loaded %zu reference checksums from %s\n", mExpected.size(), referencePath.c_str());
+    return 0;
+}
+
+void FrameChecksum::deinit() {
+    if (mHasReference) {
+        LOGI("Checksum: %u frames checked against %zu references, %u mismatched\n",
+             mFrameCnt - mFirstFrame, mExpected.size(), mMismatchCnt);
+        mHasReference = false;
+    }
+    if (mOutputFile) {
+        fclose(mOutputFile);
+        mOutputFile = nullptr;
+    }
+    if (mMd5) {
+        av_freep(&mMd5);
+    }
+}
+
+void FrameChecksum::begin() {
+    if (mType == CHECKSUM_MD5) {
+        av_md5_init(mMd5);
+    } else {
+        mCrc = 0xFFFFFFFF;
+    }
+}
+
+void FrameChecksum::update(const uint8_t* data, size_t size) {
+    if (mType == CHECKSUM_MD5) {
+        av_md5_update(mMd5, data, size);
+    } else {
+        mCrc = crc32cUpdate(mCrc, data, size);
+    }
+}
+
+int FrameChecksum::end() {
+    char digest[33] = {0};
+
+    if (mType == CHECKSUM_MD5) {
+        uint8_t md5[16];
+        av_md5_final(mMd5, md5);
+        for (int i = 0; i < 16; i++) {
+            snprintf(digest + i * 2, 3, "%02x", md5[i]);
+        }
+    } else {
+        snprintf(digest, sizeof(digest), "%08x", mCrc ^ 0xFFFFFFFF);
+    }
+    mLastDigest = digest;
+
+    if (mOutputFile) {
+        fprintf(mOutputFile, "%u %s\n", mFrameCnt, digest);
+    }
+    if (mHasReference) {
+        if (mFrameCnt >= mExpected.size() || mExpected[mFrameCnt] != digest) {
+            LOGE("Checksum mismatch at frame %u: got %s, expected %s\n", mFrameCnt, digest,
+                 mFrameCnt < mExpected.size() ? mExpected[mFrameCnt].c_str() : "<none>");
+            mMismatchCnt++;
+            mFrameCnt++;
+            return -EBADMSG;
+        }
+    }
+    mFrameCnt++;
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "FramePacer.h"
+
+#define JITTER_SEED 0x6A09E667F3BCC909ULL
+
+static uint64_t splitmix64(uint64_t* state) {
+    uint64_t x = (*state += 0x9E3779B97F4A7C15ULL);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+FramePacer::FramePacer(std::string sessionId) : mSessionId(sessionId) {}
+
+FramePacer::~FramePacer() {
+    deinit();
+}
+
+std::string FramePacer::id() {
+    return mSessionId;
+}
+
+int FramePacer::init(std::string mode, double frameRate, int jitterUs) {
+    if (mode == "realtime") {
+        mRealtime = true;
+    } else if (mode == "max") {
+        mRealtime = false;
+    } else {
+        LOGE("Error: unknown input pacing %s, expected realtime or max\n", mode.c_str());
+        return -EINVAL;
+    }
+    if (frameRate <= 0) {
+        LOGE("Error: input pacing needs a frame rate\n");
+        return -EINVAL;
+    }
+    mPeriodUs = 1000000.0 / frameRate;
+    // Beyond half a period, jittered frames could swap order.
+    mJitterUs = std::min(std::max(jitterUs, 0), (int)(mPeriodUs / 2));
+    mJitterState = JITTER_SEED;
+    mStarted = false;
+    mScheduledValid = false;
+    LOGI("Input pacing: %s at %.3f fps, jitter +-%dus\n", mode.c_str(), frameRate, mJitterUs);
+    return 0;
+}
+
+FramePacer::Clock::time_point FramePacer::captureTime(uint32_t frameIdx) {
+    if (mScheduledValid && frameIdx == mScheduledIdx) {
+        return mScheduled;
+    }
+    int64_t offsetUs = (int64_t)(frameIdx * mPeriodUs);
+    if (mJitterUs) {
+        double u = (splitmix64(&mJitterState) >> 11) * (1.0 / 9007199254740992.0);
+        offsetUs += (int64_t)((2 * u - 1) * mJitterUs);
+        offsetUs = std::max<int64_t>(offsetUs, 0);
+    }
+    mScheduledValid = true;
+    mScheduledIdx = frameIdx;
+    mScheduled = mStart + std::chrono::microseconds(offsetUs);
+    return mScheduled;
+}
+
+bool FramePacer::waitForFrame(uint32_t frameIdx, int64_t maxWaitUs) {
+    if (!mRealtime) {
+        return true;
+    }
+    Clock::time_point now = Clock::now();
+    if (!mStarted) {
+        mStart = now;
+        mStarted = true;
+    }
+    Clock::time_point due = captureTime(frameIdx);
+    if (due <= now) {
+        return true;
+    }
+    Clock::time_point limit = now + std::chrono::microseconds(maxWaitUs);
+    std::this_thread::sleep_until(std::min(due, limit));
+    return due <= limit;
+}
+
+void FramePacer::onQueued(uint32_t frameIdx, int64_t timestampUs) {
+    Clock::time_point now = Clock::now();
+    Clock::time_point captured = now;
+
+    if (mRealtime) {
+        captured = captureTime(frameIdx);
+        int64_t latenessUs =
+            std::chrono::duration_cast<std::chrono::microseconds>(now - captured).count();
+        if (latenessUs > mPeriodUs) {
+            LOGD("Frame %u queued %lldus after capture\n", frameIdx, (long long)latenessUs);
+            mLateCnt++;
+        }
+        mMaxLatenessUs = std::max(mMaxLatenessUs, latenessUs);
+    }
+    std::unique_lock<std::mutex> lock(mLock);
+    mCaptured[timestampUs] = captured;
+    mQueuedCnt++;
+}
+
+void FramePacer::onFrameEncoded(int64_t timestampUs) {
+    std::unique_lock<std::mutex> lock(mLock);
+    auto itr = mCaptured.find(timestampUs);
+    if (itr == mCaptured.end()) {
+        return;
+    }
+    int64_t latencyUs =
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - itr->second).count();
+    LOGD("Frame at %lldus: capture to bitstream %lldus\n", (long long)timestampUs,
+         (long long)latencyUs);
+    mLatencies.push_back(latencyUs);
+    mCaptured.erase(itr);
+}
+
+void FramePacer::deinit() {
+    if (mQueuedCnt) {
+        if (mRealtime) {
+            LOGI("Input pacing: %u frames, %u late, worst %lldus after capture\n", mQueuedCnt,
+                 mLateCnt, (long long)mMaxLatenessUs);
+        }
+        if (!mLatencies.empty()) {
+            std::sort(mLatencies.begin(), mLatencies.end());
+            double mean = 0;
+            for (int64_t v : mLatencies) {
+                mean += v;
+            }
+            mean /= mLatencies.size();
+            LOGI("Capture to bitstream: mean %.0fus, p50 %lldus, p95 %lldus, max %lldus\n",
+                 mean, (long long)mLatencies[mLatencies.size() / 2],
+                 (long long)mLatencies[mLatencies.size() * 95 / 100],
+                 (long long)mLatencies.back());
+        }
+        mQueuedCnt = 0;
+    }
+    mLatencies.clear();
+    mCaptured.clear();
+}
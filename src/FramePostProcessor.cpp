@@ -0,0 +1,316 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "FramePostProcessor.h"
+
+#define ALIGN(num, to) (((num) + (to - 1)) & (~(to - 1)))
+
+// BT.601 limited range in 6-bit fixed point; 1.164 is applied as 149 / 2 so
+// the luma term stays exact within unsigned 16-bit lanes.
+#define COEF_Y 149
+#define COEF_RV 102
+#define COEF_GU 25
+#define COEF_GV 52
+#define COEF_BU 129
+
+static inline int16_t sat16(int v) {
+    return (int16_t)std::min(std::max(v, -32768), 32767);
+}
+
+static inline uint8_t clampRgb(int16_t v) {
+    return (uint8_t)std::min(std::max(v >> 6, 0), 255);
+}
+
+static void rowToRgb(const uint8_t* y, const uint8_t* uv, uint8_t* dst, int width, bool alpha) {
+    int bpp = alpha ? 4 : 3;
+    int x = 0;
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i bias = _mm_set1_epi16(128);
+    __m128i round = _mm_set1_epi16(32);
+    __m128i opaque = _mm_set1_epi8((char)0xFF);
+    for (; x + 16 <= width; x += 16) {
+        __m128i yv = _mm_subs_epu8(_mm_loadu_si128((const __m128i*)(y + x)), _mm_set1_epi8(16));
+        __m128i ylo = _mm_srli_epi16(
+            _mm_mullo_epi16(_mm_unpacklo_epi8(yv, zero), _mm_set1_epi16(COEF_Y)), 1);
+        __m128i yhi = _mm_srli_epi16(
+            _mm_mullo_epi16(_mm_unpackhi_epi8(yv, zero), _mm_set1_epi16(COEF_Y)), 1);
+        __m128i uvv = _mm_loadu_si128((const __m128i*)(uv + x));
+        __m128i d = _mm_sub_epi16(_mm_and_si128(uvv, _mm_set1_epi16(0xFF)), bias);
+        __m128i e = _mm_sub_epi16(_mm_srli_epi16(uvv, 8), bias);
+        __m128i rc = _mm_mullo_epi16(e, _mm_set1_epi16(COEF_RV));
+        __m128i gc = _mm_sub_epi16(zero, _mm_add_epi16(_mm_mullo_epi16(d, _mm_set1_epi16(COEF_GU)),
+                                                       _mm_mullo_epi16(e, _mm_set1_epi16(COEF_GV))));
+        __m128i bc = _mm_mullo_epi16(d, _mm_set1_epi16(COEF_BU));
+        auto channel = [&](__m128i c) -> __m128i {
+            __m128i lo = _mm_adds_epi16(_mm_adds_epi16(ylo, _mm_unpacklo_epi16(c, c)), round);
+            __m128i hi = _mm_adds_epi16(_mm_adds_epi16(yhi, _mm_unpackhi_epi16(c, c)), round);
+            return _mm_packus_epi16(_mm_srai_epi16(lo, 6), _mm_srai_epi16(hi, 6));
+        };
+        __m128i r = channel(rc), g = channel(gc), b = channel(bc);
+        uint8_t* out = dst + x * bpp;
+        if (alpha) {
+            __m128i rg = _mm_unpacklo_epi8(r, g), ba = _mm_unpacklo_epi8(b, opaque);
+            _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi16(rg, ba));
+            _mm_storeu_si128((__m128i*)(out + 16), _mm_unpackhi_epi16(rg, ba));
+            rg = _mm_unpackhi_epi8(r, g);
+            ba = _mm_unpackhi_epi8(b, opaque);
+            _mm_storeu_si128((__m128i*)(out + 32), _mm_unpacklo_epi16(rg, ba));
+            _mm_storeu_si128((__m128i*)(out + 48), _mm_unpackhi_epi16(rg, ba));
+        } else {
+            // SSE2 has no byte shuffle; interleave the three channels in scalar code.
+            uint8_t rs[16], gs[16], bs[16];
+            _mm_storeu_si128((__m128i*)rs, r);
+            _mm_storeu_si128((__m128i*)gs, g);
+            _mm_storeu_si128((__m128i*)bs, b);
+            for (int i = 0; i < 16; i++) {
+                out[i * 3] = rs[i];
+                out[i * 3 + 1] = gs[i];
+                out[i * 3 + 2] = bs[i];
+            }
+        }
+    }
+#elif defined(__aarch64__)
+    int16x8_t round = vdupq_n_s16(32);
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t yv = vqsubq_u8(vld1q_u8(y + x), vdupq_n_u8(16));
+        int16x8_t ylo = vreinterpretq_s16_u16(
+            vshrq_n_u16(vmulq_n_u16(vmovl_u8(vget_low_u8(yv)), COEF_Y), 1));
+        int16x8_t yhi = vreinterpretq_s16_u16(
+            vshrq_n_u16(vmulq_n_u16(vmovl_u8(vget_high_u8(yv)), COEF_Y), 1));
+        uint8x8x2_t uvv = vld2_u8(uv + x);
+        int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uvv.val[0])), vdupq_n_s16(128));
+        int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uvv.val[1])), vdupq_n_s16(128));
+        int16x8_t rc = vmulq_n_s16(e, COEF_RV);
+        int16x8_t gc = vnegq_s16(vmlaq_n_s16(vmulq_n_s16(d, COEF_GU), e, COEF_GV));
+        int16x8_t bc = vmulq_n_s16(d, COEF_BU);
+        auto channel = [&](int16x8_t c) -> uint8x16_t {
+            int16x8_t lo = vqaddq_s16(vqaddq_s16(ylo, vzip1q_s16(c, c)), round);
+            int16x8_t hi = vqaddq_s16(vqaddq_s16(yhi, vzip2q_s16(c, c)), round);
+            return vcombine_u8(vqshrun_n_s16(lo, 6), vqshrun_n_s16(hi, 6));
+        };
+        if (alpha) {
+            uint8x16x4_t px = {{channel(rc), channel(gc), channel(bc), vdupq_n_u8(0xFF)}};
+            vst4q_u8(dst + x * 4, px);
+        } else {
+            uint8x16x3_t px = {{channel(rc), channel(gc), channel(bc)}};
+            vst3q_u8(dst + x * 3, px);
+        }
+    }
+#endif
+    for (; x < width; x++) {
+        int16_t y6 = (int16_t)((COEF_Y * std::max(y[x] - 16, 0)) >> 1);
+        int d = uv[x & ~1] - 128, e = uv[(x & ~1) + 1] - 128;
+        uint8_t* out = dst + x * bpp;
+        out[0] = clampRgb(sat16(sat16(y6 + COEF_RV * e) + 32));
+        out[1] = clampRgb(sat16(sat16(y6 - (COEF_GU * d + COEF_GV * e)) + 32));
+        out[2] = clampRgb(sat16(sat16(y6 + COEF_BU * d) + 32));
+        if (alpha) {
+            out[3] = 0xFF;
+        }
+    }
+}
+
+static void splitUVRow(const uint8_t* uv, uint8_t* u, uint8_t* v, int samples) {
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i mask = _mm_set1_epi16(0xFF);
+    for (; i + 16 <= samples; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(uv + i * 2));
+        __m128i b = _mm_loadu_si128((const __m128i*)(uv + i * 2 + 16));
+        _mm_storeu_si128((__m128i*)(u + i),
+                         _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+        _mm_storeu_si128((__m128i*)(v + i),
+                         _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    }
+#elif defined(__aarch64__)
+    for (; i + 16 <= samples; i += 16) {
+        uint8x16x2_t px = vld2q_u8(uv + i * 2);
+        vst1q_u8(u + i, px.val[0]);
+        vst1q_u8(v + i, px.val[1]);
+    }
+#endif
+    for (; i < samples; i++) {
+        u[i] = uv[i * 2];
+        v[i] = uv[i * 2 + 1];
+    }
+}
+
+FramePostProcessor::FramePostProcessor(std::string sessionId) : mSessionId(sessionId) {}
+
+FramePostProcessor::~FramePostProcessor() {
+    deinit();
+}
+
+std::string FramePostProcessor::id() {
+    return mSessionId;
+}
+
+int FramePostProcessor::init(std::string format, int width, int height, std::string filter,
+                             std::string outputPath, int numThreads) {
+    if (format == "nv12") {
+        mFormat = FORMAT_NV12;
+    } else if (format == "i420") {
+        mFormat = FORMAT_I420;
+    } else if (format == "rgb24") {
+        mFormat = FORMAT_RGB24;
+    } else if (format == "rgba") {
+        mFormat = FORMAT_RGBA;
+    } else {
+        LOGE("Error: unknown post-process format %s\n", format.c_str());
+        return -EINVAL;
+    }
+    if (FrameScaler::parseFilter(filter, &mFilter)) {
+        LOGE("Error: unknown scale filter %s, expected bilinear or box\n", filter.c_str());
+        return -EINVAL;
+    }
+    if (width < 0 || height < 0 || (width > 0) != (height > 0)) {
+        LOGE("Error: invalid post-process size %dx%d\n", width, height);
+        return -EINVAL;
+    }
+    mOutputFile = fopen(outputPath.c_str(), "wb");
+    if (mOutputFile == nullptr) {
+        LOGE("Error: failed to open %s\n", outputPath.c_str());
+        return -errno;
+    }
+    mDstWidth = width;
+    mDstHeight = height;
+    mPool = std::make_shared<WorkerPool>(std::max(numThreads, 1));
+    mScaler = nullptr;
+    mSrcWidth = mSrcHeight = 0;
+    mFrameCnt = 0;
+    mTotalMs = 0;
+    LOGI("Post-processing to %s at %dx%d on %d thread(s)\n", format.c_str(), width, height,
+         mPool->getNumThreads());
+    return 0;
+}
+
+void FramePostProcessor::convert(const uint8_t* y, int yStride, const uint8_t* uv, int uvStride,
+                                 int width, int height) {
+    int cw = (width + 1) / 2, ch = (height + 1) / 2;
+    size_t lumaSize = (size_t)width * height;
+    size_t outSize = 0;
+
+    switch (mFormat) {
+        case FORMAT_NV12:
+            outSize = lumaSize + (size_t)cw * 2 * ch;
+            break;
+        case FORMAT_I420:
+            outSize = lumaSize + (size_t)cw * ch * 2;
+            break;
+        case FORMAT_RGB24:
+            outSize = lumaSize * 3;
+            break;
+        case FORMAT_RGBA:
+            outSize = lumaSize * 4;
+            break;
+    }
+    mOutput.resize(outSize);
+    uint8_t* out = mOutput.data();
+
+    // Bands of an even number of rows, so each owns whole chroma rows.
+    int numBands = mPool->getNumThreads() * 2;
+    int bandRows = ALIGN((height + numBands - 1) / numBands, 2);
+    numBands = (height + bandRows - 1) / bandRows;
+    mPool->parallelFor(numBands, [&](int band) {
+        int begin = band * bandRows;
+        int end = std::min(begin + bandRows, height);
+        for (int row = begin; row < end; row++) {
+            const uint8_t* yRow = y + (size_t)row * yStride;
+            const uint8_t* uvRow = uv + (size_t)(row / 2) * uvStride;
+            switch (mFormat) {
+                case FORMAT_NV12:
+                    memcpy(out + (size_t)row * width, yRow, width);
+                    if (!(row & 1)) {
+                        memcpy(out + lumaSize + (size_t)(row / 2) * cw * 2, uvRow, cw * 2);
+                    }
+                    break;
+                case FORMAT_I420:
+                    memcpy(out + (size_t)row * width, yRow, width);
+                    if (!(row & 1)) {
+                        uint8_t* u = out + lumaSize + (size_t)(row / 2) * cw;
+                        splitUVRow(uvRow, u, u + (size_t)cw * ch, cw);
+                    }
+                    break;
+                case FORMAT_RGB24:
+                case FORMAT_RGBA: {
+                    bool alpha = mFormat == FORMAT_RGBA;
+                    rowToRgb(yRow, uvRow, out + (size_t)row * width * (alpha ? 4 : 3), width,
+                             alpha);
+                    break;
+                }
+            }
+        }
+    });
+}
+
+int FramePostProcessor::process(const uint8_t* y, int yStride, const uint8_t* uv, int uvStride,
+                                int width, int height) {
+    auto start = std::chrono::steady_clock::now();
+    int dstWidth = mDstWidth ? mDstWidth : width;
+    int dstHeight = mDstHeight ? mDstHeight : height;
+
+    if (width != mSrcWidth || height != mSrcHeight) {
+        mSrcWidth = width;
+        mSrcHeight = height;
+        mScaler = nullptr;
+        if (dstWidth != width || dstHeight != height) {
+            mScaler = std::make_shared<FrameScaler>(mSessionId);
+            int ret = mScaler->init(width, height, dstWidth, dstHeight, mFilter);
+            if (ret) {
+                mScaler = nullptr;
+                return ret;
+            }
+            mScaled.resize((size_t)dstWidth * dstHeight +
+                           (size_t)ALIGN(dstWidth, 2) * ((dstHeight + 1) / 2));
+        }
+    }
+
+    if (mScaler) {
+        uint8_t* scaledUV = mScaled.data() + (size_t)dstWidth * dstHeight;
+        mScaler->scaleNV12(y, yStride, uv, uvStride, mScaled.data(), dstWidth, scaledUV,
+                           ALIGN(dstWidth, 2), mPool.get());
+        convert(mScaled.data(), dstWidth, scaledUV, ALIGN(dstWidth, 2), dstWidth, dstHeight);
+    } else {
+        convert(y, yStride, uv, uvStride, width, height);
+    }
+
+    if (fwrite(mOutput.data(), 1, mOutput.size(), mOutputFile) != mOutput.size()) {
+        LOGE("Error: failed to write post-processed frame %u\n", mFrameCnt);
+        return -EIO;
+    }
+    mTotalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                          start).count();
+    mFrameCnt++;
+    return 0;
+}
+
+void FramePostProcessor::deinit() {
+    if (mFrameCnt) {
+        LOGI("Post-processing: %u frames, %.3f ms per frame\n", mFrameCnt,
+             mTotalMs / mFrameCnt);
+        mFrameCnt = 0;
+    }
+    if (mOutputFile) {
+        fclose(mOutputFile);
+        mOutputFile = nullptr;
+    }
+    mPool = nullptr;
+    mScaler = nullptr;
+}
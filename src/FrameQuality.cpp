@@ -0,0 +1,469 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "FrameQuality.h"
+
+#define MAX_PSNR 100.0     // reported for identical planes
+#define STRIPE_ROWS 64     // luma rows per job, multiple of the 8 row SSIM window
+#define SSIM_WINDOW 8
+#define SSIM_STEP 4
+
+static const double kSsimC1 = (0.01 * 255) * (0.01 * 255);
+static const double kSsimC2 = (0.03 * 255) * (0.03 * 255);
+
+/* Sum of squared differences of one row of n samples. */
+static uint64_t sseRow(const uint8_t* a, const uint8_t* b, int n) {
+    uint64_t sum = 0;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i dlo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+        __m128i dhi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(dlo, dlo));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(dhi, dhi));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    sum = (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__aarch64__)
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+        acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(d), vget_high_u8(d)));
+    }
+    sum = vaddlvq_u32(acc);
+#endif
+    for (; i < n; i++) {
+        int d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+/* Same as sseRow() for n interleaved UV pairs, split per component. */
+static void sseRowInterleaved(const uint8_t* a, const uint8_t* b, int n, uint64_t* sseU,
+                              uint64_t* sseV) {
+    uint64_t sumU = 0, sumV = 0;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i mask = _mm_set1_epi16(0x00FF);
+    __m128i accU = _mm_setzero_si128();
+    __m128i accV = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + 2 * i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + 2 * i));
+        __m128i du = _mm_sub_epi16(_mm_and_si128(va, mask), _mm_and_si128(vb, mask));
+        __m128i dv = _mm_sub_epi16(_mm_srli_epi16(va, 8), _mm_srli_epi16(vb, 8));
+        accU = _mm_add_epi32(accU, _mm_madd_epi16(du, du));
+        accV = _mm_add_epi32(accV, _mm_madd_epi16(dv, dv));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, accU);
+    sumU = (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_si128((__m128i*)lanes, accV);
+    sumV = (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__aarch64__)
+    uint32x4_t accU = vdupq_n_u32(0);
+    uint32x4_t accV = vdupq_n_u32(0);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x2_t va = vld2q_u8(a + 2 * i);
+        uint8x16x2_t vb = vld2q_u8(b + 2 * i);
+        uint8x16_t du = vabdq_u8(va.val[0], vb.val[0]);
+        uint8x16_t dv = vabdq_u8(va.val[1], vb.val[1]);
+        accU = vpadalq_u16(accU, vmull_u8(vget_low_u8(du), vget_low_u8(du)));
+        accU = vpadalq_u16(accU, vmull_u8(vget_high_u8(du), vget_high_u8(du)));
+        accV = vpadalq_u16(accV, vmull_u8(vget_low_u8(dv), vget_low_u8(dv)));
+        accV = vpadalq_u16(accV, vmull_u8(vget_high_u8(dv), vget_high_u8(dv)));
+    }
+    sumU = vaddlvq_u32(accU);
+    sumV = vaddlvq_u32(accV);
+#endif
+    for (; i < n; i++) {
+        int du = a[2 * i] - b[2 * i];
+        int dv = a[2 * i + 1] - b[2 * i + 1];
+        sumU += du * du;
+        sumV += dv * dv;
+    }
+    *sseU += sumU;
+    *sseV += sumV;
+}
+
+/* Sums over one 8x8 window that SSIM is computed from. */
+struct SsimSums {
+    uint32_t s1, s2, ss1, ss2, s12;
+};
+
+#if defined(__SSE2__)
+static inline uint32_t sumLanes(__m128i v) {
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+struct SsimAcc {
+    __m128i s1 = _mm_setzero_si128(), s2 = _mm_setzero_si128();
+    __m128i ss1 = _mm_setzero_si128(), ss2 = _mm_setzero_si128(), s12 = _mm_setzero_si128();
+
+    /* Adds one window row of 8 samples held in 16 bit lanes. */
+    void add(__m128i a, __m128i b) {
+        const __m128i ones = _mm_set1_epi16(1);
+        s1 = _mm_add_epi32(s1, _mm_madd_epi16(a, ones));
+        s2 = _mm_add_epi32(s2, _mm_madd_epi16(b, ones));
+        ss1 = _mm_add_epi32(ss1, _mm_madd_epi16(a, a));
+        ss2 = _mm_add_epi32(ss2, _mm_madd_epi16(b, b));
+        s12 = _mm_add_epi32(s12, _mm_madd_epi16(a, b));
+    }
+    SsimSums sums() const {
+        return {sumLanes(s1), sumLanes(s2), sumLanes(ss1), sumLanes(ss2), sumLanes(s12)};
+    }
+};
+#elif defined(__aarch64__)
+struct SsimAcc {
+    uint16x8_t s1 = vdupq_n_u16(0), s2 = vdupq_n_u16(0);
+    uint32x4_t ss1 = vdupq_n_u32(0), ss2 = vdupq_n_u32(0), s12 = vdupq_n_u32(0);
+
+    /* Adds one window row of 8 samples. */
+    void add(uint8x8_t a, uint8x8_t b) {
+        s1 = vaddw_u8(s1, a);
+        s2 = vaddw_u8(s2, b);
+        ss1 = vpadalq_u16(ss1, vmull_u8(a, a));
+        ss2 = vpadalq_u16(ss2, vmull_u8(b, b));
+        s12 = vpadalq_u16(s12, vmull_u8(a, b));
+    }
+    SsimSums sums() const {
+        return {vaddvq_u16(s1), vaddvq_u16(s2), vaddvq_u32(ss1), vaddvq_u32(ss2), vaddvq_u32(s12)};
+    }
+};
+#else
+/* step is 1 for luma and 2 for an interleaved chroma component. */
+static SsimSums ssimSums(const uint8_t* a, int aStride, const uint8_t* b, int bStride, int step) {
+    SsimSums s = {0, 0, 0, 0, 0};
+    for (int y = 0; y < SSIM_WINDOW; y++) {
+        for (int x = 0; x < SSIM_WINDOW; x++) {
+            uint32_t pa = a[x * step], pb = b[x * step];
+            s.s1 += pa;
+            s.s2 += pb;
+            s.ss1 += pa * pa;
+            s.ss2 += pb * pb;
+            s.s12 += pa * pb;
+        }
+        a += aStride;
+        b += bStride;
+    }
+    return s;
+}
+#endif
+
+static double ssimFromSums(const SsimSums& s) {
+    const double n = SSIM_WINDOW * SSIM_WINDOW;
+    double mu1 = s.s1 / n, mu2 = s.s2 / n;
+    double var1 = s.ss1 / n - mu1 * mu1;
+    double var2 = s.ss2 / n - mu2 * mu2;
+    double cov = s.s12 / n - mu1 * mu2;
+    return ((2 * mu1 * mu2 + kSsimC1) * (2 * cov + kSsimC2)) /
+           ((mu1 * mu1 + mu2 * mu2 + kSsimC1) * (var1 + var2 + kSsimC2));
+}
+
+/* SSIM of one 8x8 luma window. */
+static double ssimWindow(const uint8_t* a, int aStride, const uint8_t* b, int bStride) {
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    SsimAcc acc;
+    for (int y = 0; y < SSIM_WINDOW; y++, a += aStride, b += bStride) {
+        acc.add(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)a), zero),
+                _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)b), zero));
+    }
+    return ssimFromSums(acc.sums());
+#elif defined(__aarch64__)
+    SsimAcc acc;
+    for (int y = 0; y < SSIM_WINDOW; y++, a += aStride, b += bStride) {
+        acc.add(vld1_u8(a), vld1_u8(b));
+    }
+    return ssimFromSums(acc.sums());
+#else
+    return ssimFromSums(ssimSums(a, aStride, b, bStride, 1));
+#endif
+}
+
+/* SSIM of the U and V 8x8 windows starting at an interleaved UV pair. */
+static void ssimWindowUV(const uint8_t* a, int aStride, const uint8_t* b, int bStride,
+                         double* ssimU, double* ssimV) {
+#if defined(__SSE2__)
+    __m128i mask = _mm_set1_epi16(0x00FF);
+    SsimAcc accU, accV;
+    for (int y = 0; y < SSIM_WINDOW; y++, a += aStride, b += bStride) {
+        __m128i va = _mm_loadu_si128((const __m128i*)a);
+        __m128i vb = _mm_loadu_si128((const __m128i*)b);
+        accU.add(_mm_and_si128(va, mask), _mm_and_si128(vb, mask));
+        accV.add(_mm_srli_epi16(va, 8), _mm_srli_epi16(vb, 8));
+    }
+    *ssimU = ssimFromSums(accU.sums());
+    *ssimV = ssimFromSums(accV.sums());
+#elif defined(__aarch64__)
+    SsimAcc accU, accV;
+    for (int y = 0; y < SSIM_WINDOW; y++, a += aStride, b += bStride) {
+        uint8x8x2_t va = vld2_u8(a);
+        uint8x8x2_t vb = vld2_u8(b);
+        accU.add(va.val[0], vb.val[0]);
+        accV.add(va.val[1], vb.val[1]);
+    }
+    *ssimU = ssimFromSums(accU.sums());
+    *ssimV = ssimFromSums(accV.sums());
+#else
+    *ssimU = ssimFromSums(ssimSums(a, aStride, b, bStride, 2));
+    *ssimV = ssimFromSums(ssimSums(a + 1, aStride, b + 1, bStride, 2));
+#endif
+}
+
+static double toPsnr(uint64_t sse, uint64_t samples) {
+    if (sse == 0 || samples == 0) {
+        return MAX_PSNR;
+    }
+    return std::min(MAX_PSNR, 10.0 * log10(255.0 * 255.0 * samples / sse));
+}
+
+FrameQuality::FrameQuality(std::string sessionId) : mSessionId(sessionId) {}
+
+FrameQuality::~FrameQuality() {
+    deinit();
+}
+
+std::string FrameQuality::id() {
+    return mSessionId;
+}
+
+int FrameQuality::init(int numThreads, std::string logPath) {
+    mPool = std::make_shared<WorkerPool>(std::max(numThreads, 1));
+    if (!logPath.empty()) {
+        mLogFile = fopen(logPath.c_str(), "w");
+        if (mLogFile == nullptr) {
+            LOGE("Error: failed to open quality log %s\n", logPath.c_str());
+            return -EINVAL;
+        }
+    }
+    LOGI("Quality measurement on %d thread(s)\n", mPool->getNumThreads());
+    return 0;
+}
+
+int FrameQuality::openReference(std::string referencePath, int width, int height) {
+    struct stat st;
+    int fd = open(referencePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("Error: failed to open reference %s (%s)\n", referencePath.c_str(),
+             strerror(errno));
+        return -errno;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        LOGE("Error: reference %s is empty\n", referencePath.c_str());
+        close(fd);
+        return -EINVAL;
+    }
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        LOGE("Error: failed to map reference %s (%s)\n", referencePath.c_str(),
+             strerror(errno));
+        return -ENOMEM;
+    }
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+    mRefBase = (const uint8_t*)addr;
+    mRefSize = st.st_size;
+    mRefWidth = width;
+    mRefHeight = height;
+    LOGI("Reference %s mapped, %zu bytes\n", referencePath.c_str(), mRefSize);
+    return 0;
+}
+
+void FrameQuality::deinit() {
+    if (mFrameCnt) {
+        double psnr[QUALITY_PLANE_MAX], ssim[QUALITY_PLANE_MAX];
+        for (int p = 0; p < QUALITY_PLANE_MAX; p++) {
+            psnr[p] = mTotal.psnr[p] / mFrameCnt;
+            ssim[p] = mTotal.ssim[p] / mFrameCnt;
+        }
+        double globalPsnr = toPsnr(mTotal.sse[QUALITY_PLANE_Y], mTotal.samples[QUALITY_PLANE_Y]);
+        LOGI("Quality over %u frames: PSNR Y/U/V %.3f/%.3f/%.3f (global Y %.3f), "
+             "SSIM Y/U/V %.5f/%.5f/%.5f, %llu bytes\n",
+             mFrameCnt, psnr[0], psnr[1], psnr[2], globalPsnr, ssim[0], ssim[1], ssim[2],
+             (unsigned long long)mTotalBytes);
+        if (mLogFile) {
+            fprintf(mLogFile, "# frames %u bytes %llu psnr_y %.4f psnr_u %.4f psnr_v %.4f "
+                    "global_psnr_y %.4f ssim_y %.6f ssim_u %.6f ssim_v %.6f\n",
+                    mFrameCnt, (unsigned long long)mTotalBytes, psnr[0], psnr[1], psnr[2],
+                    globalPsnr, ssim[0], ssim[1], ssim[2]);
+        }
+        if (mFrameRate > 0 && mTotalBytes > 0) {
+            // One rate-distortion point; PSNR weighted 6:1:1 as in common BD-rate tooling.
+            double kbps = mTotalBytes * 8.0 * mFrameRate / mFrameCnt / 1000.0;
+            double yuvPsnr = (6 * psnr[0] + psnr[1] + psnr[2]) / 8;
+            LOGI("RD point: %.3f kbps, PSNR YUV %.4f, SSIM Y %.6f\n", kbps, yuvPsnr, ssim[0]);
+            if (mLogFile) {
+                fprintf(mLogFile, "# rd kbps %.4f psnr_yuv %.4f psnr_y %.4f ssim_y %.6f\n", kbps,
+                        yuvPsnr, psnr[0], ssim[0]);
+            }
+        }
+        mFrameCnt = 0;
+    }
+    if (mLogFile) {
+        fclose(mLogFile);
+        mLogFile = nullptr;
+    }
+    if (mRefBase) {
+        munmap((void*)mRefBase, mRefSize);
+        mRefBase = nullptr;
+        mRefSize = 0;
+    }
+    mPool = nullptr;
+}
+
+int FrameQuality::measure(const uint8_t* y, int yStride, const uint8_t* uv, int uvStride,
+                          int width, int height) {
+    QualityMetrics metrics;
+    int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    size_t frameSize = (size_t)width * height + (size_t)chromaWidth * 2 * chromaHeight;
+    size_t offset = (size_t)mFrameCnt * frameSize;
+
+    if (mRefBase == nullptr) {
+        return -EINVAL;
+    }
+    if (width != mRefWidth || height != mRefHeight) {
+        LOGE("Error: frame %u is %dx%d, reference is %dx%d\n", mFrameCnt, width, height,
+             mRefWidth, mRefHeight);
+        return -EINVAL;
+    }
+    if (offset + frameSize > mRefSize) {
+        if (!mRefExhausted) {
+            LOGW("Reference exhausted at frame %u\n", mFrameCnt);
+            mRefExhausted = true;
+        }
+        return -ENODATA;
+    }
+
+    const uint8_t* refY = mRefBase + offset;
+    const uint8_t* refUV = refY + (size_t)width * height;
+    compare(y, yStride, uv, uvStride, refY, width, refUV, chromaWidth * 2, width, height,
+            &metrics);
+    record(metrics);
+    return 0;
+}
+
+void FrameQuality::compare(const uint8_t* y, int yStride, const uint8_t* uv, int uvStride,
+                           const uint8_t* refY, int refYStride, const uint8_t* refUV,
+                           int refUVStride, int width, int height, QualityMetrics* metrics) {
+    struct Partial {
+        uint64_t sse[QUALITY_PLANE_MAX] = {0};
+        double ssim[QUALITY_PLANE_MAX] = {0};
+        uint64_t windows[QUALITY_PLANE_MAX] = {0};
+    };
+    int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    int stripes = (height + STRIPE_ROWS - 1) / STRIPE_ROWS;
+    std::vector<Partial> partials(stripes);
+
+    mPool->parallelFor(stripes, [&](int job) {
+        Partial& part = partials[job];
+        int rowStart = job * STRIPE_ROWS;
+        int rowEnd = std::min(rowStart + STRIPE_ROWS, height);
+        int cRowStart = rowStart / 2;
+        int cRowEnd = std::min(cRowStart + STRIPE_ROWS / 2, chromaHeight);
+
+        for (int r = rowStart; r < rowEnd; r++) {
+            part.sse[QUALITY_PLANE_Y] +=
+                sseRow(y + (size_t)r * yStride, refY + (size_t)r * refYStride, width);
+        }
+        for (int r = cRowStart; r < cRowEnd; r++) {
+            sseRowInterleaved(uv + (size_t)r * uvStride, refUV + (size_t)r * refUVStride,
+                              chromaWidth, &part.sse[QUALITY_PLANE_U],
+                              &part.sse[QUALITY_PLANE_V]);
+        }
+
+        // Windows are owned by the stripe holding their first row.
+        for (int r = rowStart; r < rowEnd && r + SSIM_WINDOW <= height; r += SSIM_STEP) {
+            for (int x = 0; x + SSIM_WINDOW <= width; x += SSIM_STEP) {
+                part.ssim[QUALITY_PLANE_Y] +=
+                    ssimWindow(y + (size_t)r * yStride + x, yStride,
+                               refY + (size_t)r * refYStride + x, refYStride);
+                part.windows[QUALITY_PLANE_Y]++;
+            }
+        }
+        for (int r = cRowStart; r < cRowEnd && r + SSIM_WINDOW <= chromaHeight;
+             r += SSIM_STEP) {
+            for (int x = 0; x + SSIM_WINDOW <= chromaWidth; x += SSIM_STEP) {
+                double ssimU, ssimV;
+                ssimWindowUV(uv + (size_t)r * uvStride + 2 * x, uvStride,
+                             refUV + (size_t)r * refUVStride + 2 * x, refUVStride, &ssimU, &ssimV);
+                part.ssim[QUALITY_PLANE_U] += ssimU;
+                part.ssim[QUALITY_PLANE_V] += ssimV;
+                part.windows[QUALITY_PLANE_U]++;
+                part.windows[QUALITY_PLANE_V]++;
+            }
+        }
+    });
+
+    uint64_t windows[QUALITY_PLANE_MAX] = {0};
+    *metrics = QualityMetrics();
+    for (auto& part : partials) {
+        for (int p = 0; p < QUALITY_PLANE_MAX; p++) {
+            metrics->sse[p] += part.sse[p];
+            metrics->ssim[p] += part.ssim[p];
+            windows[p] += part.windows[p];
+        }
+    }
+    metrics->samples[QUALITY_PLANE_Y] = (uint64_t)width * height;
+    metrics->samples[QUALITY_PLANE_U] = (uint64_t)chromaWidth * chromaHeight;
+    metrics->samples[QUALITY_PLANE_V] = (uint64_t)chromaWidth * chromaHeight;
+    for (int p = 0; p < QUALITY_PLANE_MAX; p++) {
+        metrics->psnr[p] = toPsnr(metrics->sse[p], metrics->samples[p]);
+        metrics->ssim[p] = windows[p] ? metrics->ssim[p] / windows[p] : 1.0;
+    }
+}
+
+void FrameQuality::record(const QualityMetrics& metrics, int frameBytes) {
+    LOGD("Frame %u: PSNR Y/U/V %.3f/%.3f/%.3f SSIM Y/U/V %.5f/%.5f/%.5f\n", mFrameCnt,
+         metrics.psnr[0], metrics.psnr[1], metrics.psnr[2], metrics.ssim[0], metrics.ssim[1],
+         metrics.ssim[2]);
+    if (mLogFile) {
+        if (mFrameCnt == 0) {
+            fprintf(mLogFile, "frame,bytes,psnr_y,psnr_u,psnr_v,ssim_y,ssim_u,ssim_v\n");
+        }
+        fprintf(mLogFile, "%u,%d,%.4f,%.4f,%.4f,%.6f,%.6f,%.6f\n", mFrameCnt, frameBytes,
+                metrics.psnr[0], metrics.psnr[1], metrics.psnr[2], metrics.ssim[0],
+                metrics.ssim[1], metrics.ssim[2]);
+    }
+    for (int p = 0; p < QUALITY_PLANE_MAX; p++) {
+        mTotal.sse[p] += metrics.sse[p];
+        mTotal.samples[p] += metrics.samples[p];
+        mTotal.psnr[p] += metrics.psnr[p];
+        mTotal.ssim[p] += metrics.ssim[p];
+    }
+    if (frameBytes > 0) {
+        mTotalBytes += frameBytes;
+    }
+    mFrameCnt++;
+}
@@ -0,0 +1,244 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "FrameScaler.h"
+#include "WorkerPool.h"
+
+// Bilinear weights are 7-bit so that 255 * 128 sums fit 16-bit lanes.
+#define WEIGHT_BITS 7
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+// Box sums of up to this many rows fit 16-bit lanes.
+#define MAX_BOX_ROWS 256
+
+// dst = (r0 * (128 - w1) + r1 * w1 + 64) >> 7
+static void blendRows(const uint8_t* r0, const uint8_t* r1, int w1, uint8_t* dst, int n) {
+    int w0 = WEIGHT_ONE - w1;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i vw0 = _mm_set1_epi16(w0);
+    __m128i vw1 = _mm_set1_epi16(w1);
+    __m128i half = _mm_set1_epi16(WEIGHT_ONE / 2);
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(r0 + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(r1 + i));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), vw0),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), vw1));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), vw0),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), vw1));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, half), WEIGHT_BITS);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, half), WEIGHT_BITS);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#elif defined(__aarch64__)
+    uint8x8_t vw0 = vdup_n_u8(w0);
+    uint8x8_t vw1 = vdup_n_u8(w1);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t a = vld1q_u8(r0 + i);
+        uint8x16_t b = vld1q_u8(r1 + i);
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(a), vw0), vget_low_u8(b), vw1);
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(a), vw0), vget_high_u8(b), vw1);
+        vst1q_u8(dst + i,
+                 vcombine_u8(vrshrn_n_u16(lo, WEIGHT_BITS), vrshrn_n_u16(hi, WEIGHT_BITS)));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = (r0[i] * w0 + r1[i] * w1 + WEIGHT_ONE / 2) >> WEIGHT_BITS;
+    }
+}
+
+// acc += row
+static void accumulateRow(const uint8_t* row, uint16_t* acc, int n) {
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i lo = _mm_loadu_si128((const __m128i*)(acc + i));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(acc + i + 8));
+        _mm_storeu_si128((__m128i*)(acc + i), _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero)));
+        _mm_storeu_si128((__m128i*)(acc + i + 8),
+                         _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero)));
+    }
+#elif defined(__aarch64__)
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(row + i);
+        vst1q_u16(acc + i, vaddw_u8(vld1q_u16(acc + i), vget_low_u8(v)));
+        vst1q_u16(acc + i + 8, vaddw_u8(vld1q_u16(acc + i + 8), vget_high_u8(v)));
+    }
+#endif
+    for (; i < n; i++) {
+        acc[i] += row[i];
+    }
+}
+
+FrameScaler::FrameScaler(std::string sessionId) : mSessionId(sessionId) {}
+
+std::string FrameScaler::id() {
+    return mSessionId;
+}
+
+int FrameScaler::parseFilter(std::string name, Filter* filter) {
+    if (name.empty() || name == "bilinear") {
+        *filter = FILTER_BILINEAR;
+    } else if (name == "box") {
+        *filter = FILTER_BOX;
+    } else {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+void FrameScaler::buildMap(PlaneMap* map, int srcW, int srcH, int dstW, int dstH,
+                           int channels) {
+    map->srcW = srcW;
+    map->srcH = srcH;
+    map->dstW = dstW;
+    map->dstH = dstH;
+    map->channels = channels;
+
+    // Pixel centers are aligned; the last source sample is duplicated past the
+    // edge so the second tap is always readable.
+    auto bilinear = [](int src, int dst, std::vector<int>* first,
+                       std::vector<uint8_t>* weight) {
+        first->resize(dst);
+        weight->resize(dst);
+        double ratio = (double)src / dst;
+        for (int i = 0; i < dst; i++) {
+            double pos = std::min(std::max((i + 0.5) * ratio - 0.5, 0.0), (double)(src - 1));
+            int i0 = (int)pos;
+            (*first)[i] = i0;
+            (*weight)[i] = (uint8_t)std::lround((pos - i0) * WEIGHT_ONE);
+        }
+    };
+    // Upscaled samples cover at least one source sample.
+    auto box = [](int src, int dst, std::vector<int>* begin, std::vector<int>* end) {
+        begin->resize(dst);
+        end->resize(dst);
+        for (int i = 0; i < dst; i++) {
+            (*begin)[i] = std::min((int)((int64_t)i * src / dst), src - 1);
+            (*end)[i] = std::max((int)((int64_t)(i + 1) * src / dst), (*begin)[i] + 1);
+        }
+    };
+    bilinear(srcW, dstW, &map->x0, &map->fx);
+    bilinear(srcH, dstH, &map->y0, &map->fy);
+    box(srcW, dstW, &map->xb, &map->xe);
+    box(srcH, dstH, &map->yb, &map->ye);
+}
+
+int FrameScaler::init(int srcWidth, int srcHeight, int dstWidth, int dstHeight, Filter filter) {
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0) {
+        LOGE("Error: invalid scale %dx%d -> %dx%d\n", srcWidth, srcHeight, dstWidth, dstHeight);
+        return -EINVAL;
+    }
+    if (filter == FILTER_BOX &&
+        (srcHeight > dstHeight * MAX_BOX_ROWS || srcWidth > dstWidth * MAX_BOX_ROWS)) {
+        LOGE("Error: box downscale %dx%d -> %dx%d beyond %d:1\n", srcWidth, srcHeight,
+             dstWidth, dstHeight, MAX_BOX_ROWS);
+        return -EINVAL;
+    }
+    mFilter = filter;
+    buildMap(&mLuma, srcWidth, srcHeight, dstWidth, dstHeight, 1);
+    buildMap(&mChroma, (srcWidth + 1) / 2, (srcHeight + 1) / 2, (dstWidth + 1) / 2,
+             (dstHeight + 1) / 2, 2);
+    LOGI("Scaler: %dx%d -> %dx%d, %s\n", srcWidth, srcHeight, dstWidth, dstHeight,
+         filter == FILTER_BOX ? "box" : "bilinear");
+    return 0;
+}
+
+void FrameScaler::scaleRows(const PlaneMap& map, const uint8_t* src, int srcStride,
+                            uint8_t* dst, int dstStride, int rowBegin, int rowEnd) const {
+    int ch = map.channels;
+    int srcBytes = map.srcW * ch;
+    int dstBytes = map.dstW * ch;
+
+    if (map.srcW == map.dstW && map.srcH == map.dstH) {
+        for (int y = rowBegin; y < rowEnd; y++) {
+            memcpy(dst + (size_t)y * dstStride, src + (size_t)y * srcStride, dstBytes);
+        }
+        return;
+    }
+
+    std::vector<uint8_t> row(srcBytes + ch);
+    std::vector<uint16_t> acc;
+    if (mFilter == FILTER_BOX) {
+        acc.resize(srcBytes);
+    }
+    for (int y = rowBegin; y < rowEnd; y++) {
+        uint8_t* out = dst + (size_t)y * dstStride;
+        if (mFilter == FILTER_BILINEAR) {
+            int y0 = map.y0[y];
+            int y1 = std::min(y0 + 1, map.srcH - 1);
+            blendRows(src + (size_t)y0 * srcStride, src + (size_t)y1 * srcStride, map.fy[y],
+                      row.data(), srcBytes);
+            memcpy(row.data() + srcBytes, row.data() + srcBytes - ch, ch);
+            for (int x = 0; x < map.dstW; x++) {
+                const uint8_t* tap = row.data() + map.x0[x] * ch;
+                int w1 = map.fx[x];
+                int w0 = WEIGHT_ONE - w1;
+                for (int c = 0; c < ch; c++) {
+                    out[x * ch + c] =
+                        (tap[c] * w0 + tap[c + ch] * w1 + WEIGHT_ONE / 2) >> WEIGHT_BITS;
+                }
+            }
+        } else {
+            std::fill(acc.begin(), acc.end(), 0);
+            int yb = map.yb[y], ye = map.ye[y];
+            for (int r = yb; r < ye; r++) {
+                accumulateRow(src + (size_t)r * srcStride, acc.data(), srcBytes);
+            }
+            for (int x = 0; x < map.dstW; x++) {
+                int xb = map.xb[x], xe = map.xe[x];
+                uint32_t area = (uint32_t)(xe - xb) * (ye - yb);
+                for (int c = 0; c < ch; c++) {
+                    uint32_t sum = 0;
+                    for (int i = xb; i < xe; i++) {
+                        sum += acc[i * ch + c];
+                    }
+                    out[x * ch + c] = (sum + area / 2) / area;
+                }
+            }
+        }
+    }
+}
+
+void FrameScaler::scaleNV12(const uint8_t* srcY, int srcStride, const uint8_t* srcUV,
+                            int srcUVStride, uint8_t* dstY, int dstStride, uint8_t* dstUV,
+                            int dstUVStride, WorkerPool* pool) const {
+    // Bands of an even number of luma rows, so each owns whole chroma rows.
+    int numBands = pool ? pool->getNumThreads() * 2 : 1;
+    int bandRows = (mLuma.dstH + numBands - 1) / numBands;
+    bandRows = (bandRows + 1) & ~1;
+    numBands = (mLuma.dstH + bandRows - 1) / bandRows;
+
+    auto band = [&](int i) {
+        int begin = i * bandRows;
+        int end = std::min(begin + bandRows, mLuma.dstH);
+        scaleRows(mLuma, srcY, srcStride, dstY, dstStride, begin, end);
+        scaleRows(mChroma, srcUV, srcUVStride, dstUV, dstUVStride, begin / 2,
+                  std::min((end + 1) / 2, mChroma.dstH));
+    };
+    if (pool && numBands > 1) {
+        pool->parallelFor(numBands, band);
+    } else {
+        for (int i = 0; i < numBands; i++) {
+            band(i);
+        }
+    }
+}
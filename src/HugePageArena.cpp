@@ -0,0 +1,96 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "HugePageArena.h"
+
+#define ALIGN(num, to) (((num) + (to - 1)) & (~(to - 1)))
+
+static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+static constexpr size_t kBufferAlignment = 4096;
+
+HugePageArena::HugePageArena(std::string sessionId) : mSessionId(sessionId) {}
+
+HugePageArena::~HugePageArena() {
+    deinit();
+}
+
+std::string HugePageArena::id() {
+    return mSessionId;
+}
+
+int HugePageArena::init(size_t size) {
+    void* addr = MAP_FAILED;
+
+    deinit();
+    mSize = ALIGN(size, kHugePageSize);
+
+    addr = mmap(nullptr, mSize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (addr != MAP_FAILED) {
+        mHugeTlb = true;
+    } else {
+        LOGW("MAP_HUGETLB failed (%s), falling back to transparent huge pages\n",
+            strerror(errno));
+        addr = mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            LOGE("Error: failed to map %zu bytes arena (%s)\n", mSize, strerror(errno));
+            mSize = 0;
+            return -ENOMEM;
+        }
+        if (madvise(addr, mSize, MADV_HUGEPAGE)) {
+            LOGW("MADV_HUGEPAGE failed (%s)\n", strerror(errno));
+        }
+        mHugeTlb = false;
+    }
+    mBase = (uint8_t*)addr;
+
+    /* pre-fault every page so no fill ever takes a page fault */
+    long pageSize = sysconf(_SC_PAGESIZE);
+    for (size_t off = 0; off < mSize; off += pageSize) {
+        ((volatile uint8_t*)mBase)[off] = 0;
+    }
+
+    if (mlock(mBase, mSize)) {
+        LOGW("mlock of %zu bytes arena failed (%s)\n", mSize, strerror(errno));
+    } else {
+        mLocked = true;
+    }
+
+    LOGI("Arena of %zu bytes mapped, %s\n", mSize,
+        mHugeTlb ? "hugetlb backed" : "THP backed");
+    return 0;
+}
+
+void HugePageArena::deinit() {
+    if (mBase == nullptr) {
+        return;
+    }
+    if (mLocked) {
+        munlock(mBase, mSize);
+        mLocked = false;
+    }
+    munmap(mBase, mSize);
+    mBase = nullptr;
+    mSize = 0;
+    mUsed = 0;
+}
+
+void* HugePageArena::carve(size_t size) {
+    size_t aligned = ALIGN(size, kBufferAlignment);
+    if (mBase == nullptr || mUsed + aligned > mSize) {
+        LOGE("Error: arena exhausted, used %zu of %zu, requested %zu\n", mUsed, mSize, size);
+        return nullptr;
+    }
+    void* addr = mBase + mUsed;
+    mUsed += aligned;
+    return addr;
+}
@@ -0,0 +1,108 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+
+#include "LadderSource.h"
+
+#define ALIGN(num, to) (((num) + (to - 1)) & (~(to - 1)))
+
+LadderSource::LadderSource(std::string inputPath, std::string sessionId)
+    : mInputPath(inputPath), mSessionId(sessionId) {}
+
+LadderSource::~LadderSource() {
+    deinit();
+}
+
+std::string LadderSource::id() {
+    return mSessionId;
+}
+
+int LadderSource::init(int width, int height, int numSessions, int window) {
+    if (width <= 0 || height <= 0 || numSessions <= 0 || numSessions > 64) {
+        LOGE("Error: invalid ladder source %dx%d for %d sessions\n", width, height,
+             numSessions);
+        return -EINVAL;
+    }
+    mInputFile = fopen(mInputPath.c_str(), "rb");
+    if (mInputFile == nullptr) {
+        LOGE("Error: failed to open input %s\n", mInputPath.c_str());
+        return -errno;
+    }
+    mWidth = width;
+    mHeight = height;
+    mFrameSize = (size_t)width * height + (size_t)ALIGN(width, 2) * ((height + 1) / 2);
+    mAllMask = numSessions == 64 ? ~0ULL : (1ULL << numSessions) - 1;
+    mDoneMask = 0;
+    mWindow = window > 0 ? window : 1;
+    mNextRead = 0;
+    mEof = false;
+    LOGI("Ladder source %s: %dx%d NV12 for %d sessions, window %d frames\n",
+         mInputPath.c_str(), width, height, numSessions, mWindow);
+    return 0;
+}
+
+std::shared_ptr<const LadderSource::Frame> LadderSource::getFrame(int slot, uint32_t frameIdx) {
+    std::unique_lock<std::mutex> lock(mLock);
+
+    mProgress.wait(lock, [&]() {
+        uint32_t oldest = mFrames.empty() ? mNextRead : mFrames.begin()->first;
+        return frameIdx < oldest + mWindow;
+    });
+
+    // Frames are read in order; the session asking for the newest one reads it.
+    while (!mEof && mNextRead <= frameIdx) {
+        auto frame = std::make_shared<Frame>(mFrameSize);
+        if (fread(frame->data(), 1, mFrameSize, mInputFile) != mFrameSize) {
+            LOGI("Ladder source EOF after %u frames\n", mNextRead);
+            mEof = true;
+            break;
+        }
+        mBytesRead += mFrameSize;
+        mFrames[mNextRead++].frame = frame;
+    }
+
+    auto itr = mFrames.find(frameIdx);
+    if (itr == mFrames.end()) {
+        return nullptr;
+    }
+    std::shared_ptr<const Frame> frame = itr->second.frame;
+    mFramesServed++;
+    itr->second.takenMask |= 1ULL << slot;
+    if ((itr->second.takenMask | mDoneMask) == mAllMask) {
+        mFrames.erase(itr);
+        mProgress.notify_all();
+    }
+    return frame;
+}
+
+void LadderSource::dropTakenLocked() {
+    for (auto itr = mFrames.begin(); itr != mFrames.end();) {
+        if ((itr->second.takenMask | mDoneMask) == mAllMask) {
+            itr = mFrames.erase(itr);
+        } else {
+            itr++;
+        }
+    }
+}
+
+void LadderSource::leave(int slot) {
+    std::unique_lock<std::mutex> lock(mLock);
+    mDoneMask |= 1ULL << slot;
+    dropTakenLocked();
+    mProgress.notify_all();
+}
+
+void LadderSource::deinit() {
+    if (mInputFile) {
+        LOGI("Ladder source: %llu bytes read once for %llu frames served\n",
+             (unsigned long long)mBytesRead, (unsigned long long)mFramesServed);
+        fclose(mInputFile);
+        mInputFile = nullptr;
+    }
+    mFrames.clear();
+}
@@ -0,0 +1,221 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include "MappedYUVSource.h"
+#include "UBWC_Utils.h"
+
+#define ALIGN(num, to) (((num) + (to - 1)) & (~(to - 1)))
+
+MappedYUVSource::MappedYUVSource(std::string inputPath, std::string sessionId)
+    : mInputPath(inputPath), mSessionId(sessionId) {}
+
+MappedYUVSource::~MappedYUVSource() {
+    deinit();
+}
+
+std::string MappedYUVSource::id() {
+    return mSessionId;
+}
+
+int MappedYUVSource::init(int width, int height, int colorFormat, bool loop,
+                          int readaheadFrames) {
+    struct stat st;
+
+    switch (colorFormat) {
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV12M:
+            mFrameSize = (size_t)width * height + (size_t)ALIGN(width, 2) * ((height + 1) / 2);
+            break;
+        case V4L2_PIX_FMT_QC08C:
+        case V4L2_PIX_FMT_QC10C:
+            mCompressed = true;
+            mFrameSize = getBufferSizeUsed(colorFormat, width, height);
+            break;
+        default:
+            LOGE("Error: mapped input does not support format %#x\n", colorFormat);
+            return -EINVAL;
+    }
+    mWidth = width;
+    mHeight = height;
+    mColorFormat = colorFormat;
+    mLoop = loop;
+    mReadaheadFrames = readaheadFrames > 0 ? readaheadFrames : 0;
+
+    mFd = open(mInputPath.c_str(), O_RDONLY);
+    if (mFd < 0) {
+        LOGE("Error: failed to open input %s\n", mInputPath.c_str());
+        return -errno;
+    }
+    if (fstat(mFd, &st) < 0) {
+        return -errno;
+    }
+    mNumFrames = mFrameSize ? st.st_size / mFrameSize : 0;
+    if (mNumFrames == 0) {
+        LOGE("Error: %s is smaller than one %dx%d frame\n", mInputPath.c_str(), width, height);
+        return -EINVAL;
+    }
+    if ((size_t)st.st_size % mFrameSize) {
+        LOGW("Ignoring %zu trailing bytes of %s\n", (size_t)st.st_size % mFrameSize,
+             mInputPath.c_str());
+    }
+
+    mMapSize = st.st_size;
+    void* base = mmap(nullptr, mMapSize, PROT_READ, MAP_SHARED, mFd, 0);
+    if (base == MAP_FAILED) {
+        LOGE("Error: failed to mmap input %s\n", mInputPath.c_str());
+        mMapSize = 0;
+        return -errno;
+    }
+    mBase = (const uint8_t*)base;
+    madvise(base, mMapSize, MADV_SEQUENTIAL);
+    for (int i = 0; i < mReadaheadFrames; i++) {
+        readahead(i);
+    }
+    mFrameIdx = 0;
+    mLoops = 0;
+
+    LOGI("Mapped input %s: %u frames of %zu bytes%s, readahead %d\n", mInputPath.c_str(),
+         mNumFrames, mFrameSize, mLoop ? ", looping" : "", mReadaheadFrames);
+    return 0;
+}
+
+void MappedYUVSource::deinit() {
+    if (mLoops) {
+        LOGI("Mapped input wrapped %llu times\n", (unsigned long long)mLoops);
+        mLoops = 0;
+    }
+    if (mRetainedPkt) {
+        av_packet_free(&mRetainedPkt);
+    }
+    if (mBase) {
+        munmap((void*)mBase, mMapSize);
+        mBase = nullptr;
+        mMapSize = 0;
+    }
+    if (mFd >= 0) {
+        close(mFd);
+        mFd = -1;
+    }
+}
+
+void MappedYUVSource::readahead(uint32_t frameIdx) {
+    if (frameIdx >= mNumFrames) {
+        if (!mLoop) {
+            return;
+        }
+        frameIdx %= mNumFrames;
+    }
+    // madvise() wants a page aligned start.
+    static const size_t sPageSize = sysconf(_SC_PAGESIZE);
+    size_t start = (size_t)frameIdx * mFrameSize;
+    size_t aligned = start & ~(sPageSize - 1);
+    madvise((void*)(mBase + aligned), start + mFrameSize - aligned, MADV_WILLNEED);
+}
+
+int MappedYUVSource::fillPacketData(void* dst, void* dstUV, int width, int height, int stride,
+                                    int scanline, int colorFormat, bool& eos) {
+    if (mBase == nullptr) {
+        LOGE("Error: mapped input not initialized\n");
+        return 0;
+    }
+    // NV12 and NV12M share the file layout; only the buffer planes differ.
+    if (colorFormat != mColorFormat &&
+        (mCompressed || (colorFormat != V4L2_PIX_FMT_NV12 && colorFormat != V4L2_PIX_FMT_NV12M))) {
+        LOGE("Error: mapped input is %#x, buffer wants %#x\n", mColorFormat, colorFormat);
+        return 0;
+    }
+    if (mFrameIdx >= mNumFrames) {
+        if (!mLoop) {
+            LOGI("Mapped input EOF after %u frames\n", mNumFrames);
+            eos = true;
+            return 0;
+        }
+        mFrameIdx = 0;
+        mLoops++;
+    }
+
+    const uint8_t* frame = mBase + (size_t)mFrameIdx * mFrameSize;
+    int pktSize = 0;
+    if (mCompressed) {
+        CopyKernel::copy(mCopyKernel, dst, frame, mFrameSize);
+        pktSize = mFrameSize;
+    } else {
+        // Source rows are mWidth wide; width x height may be a region of them.
+        int uvSrcStride = ALIGN(mWidth, 2);
+        const uint8_t* src = frame + (size_t)mRegionTop * mWidth + mRegionLeft;
+        const uint8_t* srcUV = frame + (size_t)mWidth * mHeight +
+                               (size_t)(mRegionTop / 2) * uvSrcStride + mRegionLeft;
+        uint8_t* y = (uint8_t*)dst;
+        uint8_t* uv = dstUV ? (uint8_t*)dstUV : y + (size_t)stride * scanline;
+        int uvWidth = ALIGN(width, 2);
+        CopyKernel::copyPlane(mCopyKernel, y, stride, src, mWidth, width, height);
+        CopyKernel::copyPlane(mCopyKernel, uv, stride, srcUV, uvSrcStride, uvWidth,
+                              (height + 1) / 2);
+        pktSize = stride * scanline + stride * ALIGN((height + 1) >> 1, 16);
+    }
+
+    if (mRetainFrames) {
+        // Copied, since consumers may outlive the mapping.
+        av_packet_free(&mRetainedPkt);
+        mRetainedPkt = av_packet_alloc();
+        if (mRetainedPkt == nullptr || av_new_packet(mRetainedPkt, mFrameSize) < 0) {
+            av_packet_free(&mRetainedPkt);
+        } else {
+            memcpy(mRetainedPkt->data, frame, mFrameSize);
+        }
+    }
+
+    readahead(mFrameIdx + mReadaheadFrames);
+    mFrameIdx++;
+    return pktSize;
+}
+
+int MappedYUVSource::setRegion(int left, int top, int width, int height) {
+    if (mCompressed) {
+        LOGE("Error: mapped input regions need a linear format\n");
+        return -EINVAL;
+    }
+    if (left < 0 || top < 0 || (left | top) & 1 || width <= 0 || height <= 0 ||
+        left + width > mWidth || top + height > mHeight) {
+        LOGE("Error: region %dx%d+%d+%d is outside the %dx%d input\n", width, height, left,
+             top, mWidth, mHeight);
+        return -EINVAL;
+    }
+    mRegionLeft = left;
+    mRegionTop = top;
+    LOGI("Mapped input region %dx%d+%d+%d of %dx%d\n", width, height, left, top, mWidth,
+         mHeight);
+    return 0;
+}
+
+int MappedYUVSource::seekToFrame(uint32_t frame) {
+    if (frame >= mNumFrames) {
+        LOGE("Error: frame %u is beyond the %u frames of %s\n", frame, mNumFrames,
+             mInputPath.c_str());
+        return -EINVAL;
+    }
+    mFrameIdx = frame;
+    for (int i = 0; i < mReadaheadFrames; i++) {
+        readahead(frame + i);
+    }
+    return 0;
+}
+
+AVPacket* MappedYUVSource::takeRetainedFrame() {
+    AVPacket* pkt = mRetainedPkt;
+    mRetainedPkt = nullptr;
+    return pkt;
+}
@@ -0,0 +1,87 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "FFStreamParser.h"
+#include "PacketCache.h"
+
+static std::mutex sCacheLock;
+static std::unordered_map<std::string, std::weak_ptr<PacketCache>> sCaches;
+
+PacketCache::PacketCache(std::string inputPath) : mInputPath(inputPath) {}
+
+std::string PacketCache::id() {
+    return mSessionId;
+}
+
+std::shared_ptr<const PacketCache> PacketCache::acquire(const std::string& inputPath,
+                                                        const std::string& sessionId) {
+    std::shared_ptr<PacketCache> cache = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(sCacheLock);
+        cache = sCaches[inputPath].lock();
+        if (!cache) {
+            cache = std::make_shared<PacketCache>(inputPath);
+            sCaches[inputPath] = cache;
+        }
+    }
+
+    // Sessions racing on the same path wait here for the first one to finish;
+    // other paths are built in parallel.
+    std::unique_lock<std::mutex> lock(cache->mBuildLock);
+    if (!cache->mBuilt) {
+        if (cache->build(sessionId)) {
+            return nullptr;
+        }
+        cache->mBuilt = true;
+    }
+    return cache;
+}
+
+int PacketCache::build(const std::string& sessionId) {
+    int ret = 0;
+    FFStreamParser parser(mInputPath, sessionId);
+
+    mSessionId = sessionId;
+    mArena.clear();
+    mOffsets.clear();
+    mSizes.clear();
+    mKeyFrames.clear();
+    mMaxPktSize = 0;
+
+    ret = parser.init();
+    if (ret) {
+        parser.deinit();
+        return ret;
+    }
+    while (1) {
+        size_t offset = mArena.size();
+        bool keyFrame = false;
+        ret = parser.readPacket(mArena, &keyFrame);
+        if (ret < 0) {
+            break;
+        }
+        mOffsets.push_back(offset);
+        mSizes.push_back(ret);
+        mKeyFrames.push_back(keyFrame);
+        mMaxPktSize = std::max(mMaxPktSize, ret);
+    }
+    parser.deinit();
+    if (ret != AVERROR_EOF) {
+        LOGE("Error: failed to build packet cache for %s (%d)\n", mInputPath.c_str(), ret);
+        return ret;
+    }
+    mArena.shrink_to_fit();
+
+    LOGI("Packet cache for %s: %zu packets, %zu bytes\n", mInputPath.c_str(), mSizes.size(),
+         mArena.size());
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "SceneDetector.h"
+
+#define HIST_BINS 64
+// Weight of the newest score in the running average.
+#define AVERAGE_WEIGHT 0.125
+
+static uint64_t sadRow(const uint8_t* a, const uint8_t* b, int n) {
+    uint64_t sad = 0;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    sad = lanes[0] + lanes[1];
+#elif defined(__aarch64__)
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        acc = vpadalq_u16(acc, vpaddlq_u8(d));
+    }
+    sad = vaddvq_u32(acc);
+#endif
+    for (; i < n; i++) {
+        sad += abs(a[i] - b[i]);
+    }
+    return sad;
+}
+
+SceneDetector::SceneDetector(std::string sessionId) : mSessionId(sessionId) {}
+
+std::string SceneDetector::id() {
+    return mSessionId;
+}
+
+int SceneDetector::init(std::string method, int threshold, int minInterval) {
+    std::transform(method.begin(), method.end(), method.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (method == "sad") {
+        // Mean absolute luma difference per pixel.
+        mMethod = METHOD_SAD;
+        mThreshold = threshold > 0 ? threshold : 30;
+    } else if (method == "histogram") {
+        // Percentage of pixels whose histogram bin changed.
+        mMethod = METHOD_HISTOGRAM;
+        mThreshold = threshold > 0 ? threshold : 40;
+    } else {
+        LOGE("Error: unknown scene cut method %s\n", method.c_str());
+        return -EINVAL;
+    }
+    mMinInterval = std::max(minInterval, 1);
+    mHasPrev = false;
+    mAverage = 0;
+    mFrameCnt = 0;
+    mLastCut = -mMinInterval;
+    mCutCnt = 0;
+    LOGI("Scene cut detection: %s, threshold %.0f, min interval %d\n", method.c_str(),
+         mThreshold, mMinInterval);
+    return 0;
+}
+
+double SceneDetector::sadScore(const uint8_t* y, int stride, int width, int height) {
+    int rows = (height + 1) / 2;
+    uint64_t sad = 0;
+
+    mPrevRows.resize((size_t)width * rows);
+    for (int r = 0; r < rows; r++) {
+        const uint8_t* src = y + (size_t)(2 * r) * stride;
+        uint8_t* prev = mPrevRows.data() + (size_t)r * width;
+        if (mHasPrev) {
+            sad += sadRow(src, prev, width);
+        }
+        memcpy(prev, src, width);
+    }
+    return mHasPrev ? (double)sad / ((double)width * rows) : 0;
+}
+
+double SceneDetector::histogramScore(const uint8_t* y, int stride, int width, int height) {
+    std::vector<uint32_t> hist(HIST_BINS, 0);
+    uint64_t samples = 0, moved = 0;
+
+    for (int r = 0; r < height; r += 2) {
+        const uint8_t* src = y + (size_t)r * stride;
+        for (int x = 0; x < width; x++) {
+            hist[src[x] >> 2]++;
+        }
+        samples += width;
+    }
+    if (mHasPrev) {
+        for (int i = 0; i < HIST_BINS; i++) {
+            moved += hist[i] > mPrevHist[i] ? hist[i] - mPrevHist[i] : mPrevHist[i] - hist[i];
+        }
+    }
+    mPrevHist.swap(hist);
+    // Every moved pixel leaves one bin and enters another.
+    return mHasPrev && samples ? 100.0 * moved / (2.0 * samples) : 0;
+}
+
+bool SceneDetector::analyze(const uint8_t* y, int stride, int width, int height) {
+    uint32_t frameIdx = mFrameCnt++;
+    bool cut = false;
+
+    if (width != mPrevWidth || height != mPrevHeight) {
+        mHasPrev = false;
+        mPrevWidth = width;
+        mPrevHeight = height;
+    }
+    double score = mMethod == METHOD_SAD ? sadScore(y, stride, width, height)
+                                         : histogramScore(y, stride, width, height);
+    if (mHasPrev) {
+        cut = score >= mThreshold && score >= 2 * mAverage &&
+              (int64_t)frameIdx - mLastCut >= mMinInterval;
+        if (cut) {
+            LOGI("Scene cut at frame %u: score %.2f, average %.2f\n", frameIdx, score,
+                 mAverage);
+            mLastCut = frameIdx;
+            mCutCnt++;
+        } else {
+            // Cuts stay out of the average so one does not mask the next.
+            mAverage = mFrameCnt > 2 ? mAverage + AVERAGE_WEIGHT * (score - mAverage) : score;
+        }
+    }
+    mHasPrev = true;
+    return cut;
+}
@@ -0,0 +1,313 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "SyntheticSource.h"
+
+#define ALIGN(num, to) (((num) + (to - 1)) & (~(to - 1)))
+
+// Textures repeat every TILE luma pixels in both directions, so panning is a
+// wrapped row copy and never needs a frame-sized texture.
+#define TILE 512
+#define TILE_MASK (TILE - 1)
+#define GRAIN_SPAN 65536
+
+#define GLYPH_W 5
+#define GLYPH_H 7
+
+// 5x7 glyphs for ' ', '0'-'9' and 'A'-'Z', one byte per row, MSB on the left.
+static const uint8_t sFont[37][GLYPH_H] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},
+    {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},
+    {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+    {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},
+    {0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E},
+    {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}, {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C},
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}, {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10},
+    {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}, {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},
+    {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C},
+    {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F},
+    {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}, {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},
+    {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10},
+    {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}, {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11},
+    {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}, {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04},
+    {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}, {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11},
+    {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04}, {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F},
+};
+
+static const uint8_t* glyph(char c) {
+    if (c >= '0' && c <= '9') {
+        return sFont[1 + c - '0'];
+    }
+    if (c >= 'A' && c <= 'Z') {
+        return sFont[11 + c - 'A'];
+    }
+    return sFont[0];
+}
+
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Triangle wave over one tile period, 0..255..0.
+static int triangle(int v, int period) {
+    v &= period - 1;
+    int half = period / 2;
+    return (v < half ? v : period - 1 - v) * 255 / (half - 1);
+}
+
+// Copies `count` bytes of a periodic row starting at `offset` into dst.
+static void copyWrapped(uint8_t* dst, const uint8_t* row, int period, int offset, int count) {
+    while (count > 0) {
+        int n = std::min(period - offset, count);
+        memcpy(dst, row + offset, n);
+        dst += n;
+        count -= n;
+        offset = 0;
+    }
+}
+
+// dst = clamp(dst + grain - amp); grain holds values in [0, 2 * amp].
+static void addGrain(uint8_t* dst, const uint8_t* grain, int count, uint8_t amp) {
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i vAmp = _mm_set1_epi8((char)amp);
+    for (; i + 16 <= count; i += 16) {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i g = _mm_loadu_si128((const __m128i*)(grain + i));
+        d = _mm_subs_epu8(_mm_adds_epu8(d, g), vAmp);
+        _mm_storeu_si128((__m128i*)(dst + i), d);
+    }
+#elif defined(__aarch64__)
+    const uint8x16_t vAmp = vdupq_n_u8(amp);
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t d = vld1q_u8(dst + i);
+        uint8x16_t g = vld1q_u8(grain + i);
+        vst1q_u8(dst + i, vqsubq_u8(vqaddq_u8(d, g), vAmp));
+    }
+#endif
+    for (; i < count; i++) {
+        int v = std::min(dst[i] + grain[i], 255) - amp;
+        dst[i] = (uint8_t)std::max(v, 0);
+    }
+}
+
+SyntheticSource::SyntheticSource(std::string sessionId) : mSessionId(sessionId) {}
+
+SyntheticSource::~SyntheticSource() {
+    deinit();
+}
+
+std::string SyntheticSource::id() {
+    return mSessionId;
+}
+
+int SyntheticSource::init(std::string pattern, int width, int height, uint32_t seed, int motion,
+                          int noise) {
+    std::transform(pattern.begin(), pattern.end(), pattern.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (pattern != "gradient" && pattern != "noise" && pattern != "text" && pattern != "mixed") {
+        LOGE("Error: unknown synthetic pattern %s\n", pattern.c_str());
+        return -EINVAL;
+    }
+    if (width <= 0 || height <= 0) {
+        return -EINVAL;
+    }
+    mPattern = pattern;
+    mWidth = width;
+    mHeight = height;
+    mSeed = seed;
+    mMotion = std::max(motion, 0);
+    mNoise = std::min(std::max(noise, 0), 127);
+    mText = pattern == "text" || pattern == "mixed";
+    mFrameIdx = 0;
+
+    buildTextures();
+    LOGI("Synthetic source: %s %dx%d, seed %u, motion %d px/frame, grain %d\n",
+         mPattern.c_str(), mWidth, mHeight, mSeed, mMotion, mNoise);
+    return 0;
+}
+
+void SyntheticSource::deinit() {
+    if (mRetainedPkt) {
+        av_packet_free(&mRetainedPkt);
+    }
+    mLumaTile.clear();
+    mChromaTile.clear();
+    mGrain.clear();
+}
+
+void SyntheticSource::buildTextures() {
+    bool gradient = mPattern != "noise";
+    bool noise = mPattern == "noise" || mPattern == "mixed";
+    uint64_t state = splitmix64(mSeed);
+
+    // Chroma is stored interleaved at half resolution: TILE / 2 rows of TILE bytes.
+    mLumaTile.resize(TILE * TILE);
+    mChromaTile.resize(TILE * TILE / 2);
+    for (int y = 0; y < TILE; y++) {
+        for (int x = 0; x < TILE; x++) {
+            int g = (triangle(x, TILE) + triangle(2 * y + x, TILE)) / 2;
+            int n = 16 + (int)((state = splitmix64(state)) % 220);
+            int v = gradient && noise ? (3 * g + n) / 4 : gradient ? g : n;
+            mLumaTile[y * TILE + x] = (uint8_t)(16 + v * 219 / 255);
+        }
+    }
+    for (int y = 0; y < TILE / 2; y++) {
+        for (int x = 0; x < TILE / 2; x++) {
+            int u = 128, v = 128;
+            if (gradient) {
+                u += (triangle(2 * x, TILE) - 128) / 2;
+                v += (triangle(2 * y + 2 * x, TILE) - 128) / 2;
+            }
+            if (noise) {
+                uint64_t r = (state = splitmix64(state));
+                u += (int)(r & 31) - 16;
+                v += (int)((r >> 8) & 31) - 16;
+            }
+            mChromaTile[y * TILE + 2 * x] = (uint8_t)std::min(std::max(u, 16), 240);
+            mChromaTile[y * TILE + 2 * x + 1] = (uint8_t)std::min(std::max(v, 16), 240);
+        }
+    }
+
+    // Rows pick a hashed window into this table every frame, which keeps
+    // per-frame grain reproducible without generating width * height values.
+    if (mNoise > 0) {
+        mGrain.resize(GRAIN_SPAN + ALIGN(mWidth, 16));
+        for (auto& g : mGrain) {
+            g = (uint8_t)((state = splitmix64(state)) % (2 * mNoise + 1));
+        }
+    }
+}
+
+void SyntheticSource::render(uint8_t* y, uint8_t* uv, int stride, uint32_t frameIdx) {
+    int64_t shift = (int64_t)frameIdx * mMotion;
+    int lumaX = (int)(shift & TILE_MASK), lumaY = (int)((shift / 2) & TILE_MASK);
+    int chromaX = (int)((shift / 2) & (TILE / 2 - 1)) * 2;
+    int chromaY = (int)((shift / 4) & (TILE / 2 - 1));
+    int chromaWidth = ALIGN(mWidth, 2);
+
+    for (int row = 0; row < mHeight; row++) {
+        uint8_t* dst = y + (size_t)row * stride;
+        copyWrapped(dst, &mLumaTile[((row + lumaY) & TILE_MASK) * TILE], TILE, lumaX, mWidth);
+        if (mNoise > 0) {
+            uint64_t h = splitmix64(((uint64_t)mSeed << 32) ^ ((uint64_t)frameIdx << 16) ^ row);
+            addGrain(dst, &mGrain[h % GRAIN_SPAN], mWidth, (uint8_t)mNoise);
+        }
+    }
+    for (int row = 0; row < (mHeight + 1) / 2; row++) {
+        copyWrapped(uv + (size_t)row * stride,
+                    &mChromaTile[((row + chromaY) & (TILE / 2 - 1)) * TILE], TILE, chromaX,
+                    chromaWidth);
+    }
+    if (mText) {
+        drawBanner(y, stride, frameIdx);
+    }
+}
+
+void SyntheticSource::drawBanner(uint8_t* y, int stride, uint32_t frameIdx) {
+    char text[64];
+    snprintf(text, sizeof(text), "  SYNTHETIC %s SEED %u FRAME %06u  ", mPattern.c_str(), mSeed,
+             frameIdx);
+    for (char* c = text; *c; c++) {
+        *c = (char)toupper(*c);
+    }
+
+    int scale = std::max(2, mHeight / 64);
+    int advance = (GLYPH_W + 1) * scale;
+    int textWidth = (int)strlen(text) * advance;
+    int top = mHeight * 2 / 3;
+    if (top + GLYPH_H * scale > mHeight) {
+        return;
+    }
+    // Starts a quarter in and scrolls right to left at twice the background speed.
+    int span = mWidth + textWidth;
+    int left = mWidth / 4 - (int)(((int64_t)frameIdx * std::max(mMotion, 1) * 2) % span);
+    if (left <= -textWidth) {
+        left += span;
+    }
+
+    for (int i = 0; text[i]; i++) {
+        int x0 = left + i * advance;
+        if (x0 + GLYPH_W * scale <= 0 || x0 >= mWidth) {
+            continue;
+        }
+        const uint8_t* g = glyph(text[i]);
+        for (int gy = 0; gy < GLYPH_H; gy++) {
+            for (int gx = 0; gx < GLYPH_W; gx++) {
+                if (!(g[gy] & (0x10 >> gx))) {
+                    continue;
+                }
+                int xs = std::max(x0 + gx * scale, 0);
+                int xe = std::min(x0 + (gx + 1) * scale, mWidth);
+                if (xs >= xe) {
+                    continue;
+                }
+                for (int r = 0; r < scale; r++) {
+                    memset(y + (size_t)(top + gy * scale + r) * stride + xs, 235, xe - xs);
+                }
+            }
+        }
+    }
+}
+
+int SyntheticSource::fillPacketData(void* dst, void* dstUV, int width, int height, int stride,
+                                    int scanline, int colorFormat, bool& eos) {
+    if (colorFormat != V4L2_PIX_FMT_NV12 && colorFormat != V4L2_PIX_FMT_NV12M) {
+        LOGE("Error: synthetic source generates NV12 only\n");
+        return 0;
+    }
+    if (width != mWidth || height != mHeight) {
+        LOGE("Error: synthetic source is %dx%d, buffer wants %dx%d\n", mWidth, mHeight, width,
+             height);
+        return 0;
+    }
+    eos = false;
+
+    int uvScanline = ALIGN((height + 1) >> 1, 16);
+    uint8_t* y = (uint8_t*)dst;
+    uint8_t* uv = dstUV ? (uint8_t*)dstUV : y + (size_t)stride * scanline;
+    render(y, uv, stride, mFrameIdx);
+
+    if (mRetainFrames) {
+        // Packed copy for consumers comparing against the source frame.
+        av_packet_free(&mRetainedPkt);
+        mRetainedPkt = av_packet_alloc();
+        if (mRetainedPkt == nullptr ||
+            av_new_packet(mRetainedPkt, mWidth * mHeight + ALIGN(mWidth, 2) * ((mHeight + 1) / 2))) {
+            av_packet_free(&mRetainedPkt);
+        } else {
+            render(mRetainedPkt->data, mRetainedPkt->data + mWidth * mHeight, mWidth, mFrameIdx);
+        }
+    }
+    mFrameIdx++;
+    return stride * scanline + stride * uvScanline;
+}
+
+AVPacket* SyntheticSource::takeRetainedFrame() {
+    AVPacket* pkt = mRetainedPkt;
+    mRetainedPkt = nullptr;
+    return pkt;
+}
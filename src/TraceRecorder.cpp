@@ -0,0 +1,145 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include <errno.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include <json/json.h>
+
+#include "Log.h"
+#include "TraceRecorder.h"
+
+// Low bits of a flow id are the per-session frame key, high bits the session.
+#define FLOW_KEY_BITS 40
+
+std::atomic_bool TraceRecorder::sEnabled(false);
+
+static thread_local void* tBuffer = nullptr;
+
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+TraceRecorder& TraceRecorder::get() {
+    static TraceRecorder sRecorder;
+    return sRecorder;
+}
+
+void TraceRecorder::enable(std::string outputPath) {
+    std::unique_lock<std::mutex> lock(mLock);
+    mOutputPath = outputPath;
+    mStartNs = nowNs();
+    sEnabled = true;
+}
+
+int TraceRecorder::registerSession(const std::string& sessionId) {
+    std::unique_lock<std::mutex> lock(mLock);
+    auto itr = mSessionIds.find(sessionId);
+    if (itr != mSessionIds.end()) {
+        return itr->second;
+    }
+    int session = (int)mSessionNames.size();
+    mSessionIds[sessionId] = session;
+    mSessionNames.push_back(sessionId);
+    return session;
+}
+
+TraceRecorder::ThreadBuffer* TraceRecorder::getThreadBuffer() {
+    if (tBuffer == nullptr) {
+        auto buffer = std::make_unique<ThreadBuffer>();
+        buffer->tid = (int)syscall(SYS_gettid);
+        buffer->events.reserve(4096);
+        std::unique_lock<std::mutex> lock(mLock);
+        tBuffer = buffer.get();
+        mBuffers.push_back(std::move(buffer));
+    }
+    return (ThreadBuffer*)tBuffer;
+}
+
+void TraceRecorder::record(int session, char phase, const char* name, uint64_t id) {
+    if (!isEnabled()) {
+        return;
+    }
+    getThreadBuffer()->events.push_back({nowNs(), name, id, session, phase});
+}
+
+void TraceRecorder::begin(int session, const char* name) {
+    record(session, 'B', name, 0);
+}
+
+void TraceRecorder::end(int session, const char* name) {
+    record(session, 'E', name, 0);
+}
+
+void TraceRecorder::instant(int session, const char* name) {
+    record(session, 'i', name, 0);
+}
+
+void TraceRecorder::flowStart(int session, uint64_t id) {
+    record(session, 's', "frame", ((uint64_t)session << FLOW_KEY_BITS) |
+                                      (id & ((1ULL << FLOW_KEY_BITS) - 1)));
+}
+
+void TraceRecorder::flowEnd(int session, uint64_t id) {
+    record(session, 'f', "frame", ((uint64_t)session << FLOW_KEY_BITS) |
+                                      (id & ((1ULL << FLOW_KEY_BITS) - 1)));
+}
+
+int TraceRecorder::write() {
+    // Threads still recording would race with the dump; stop them first.
+    sEnabled = false;
+    std::unique_lock<std::mutex> lock(mLock);
+    if (mOutputPath.empty()) {
+        return 0;
+    }
+    FILE* file = fopen(mOutputPath.c_str(), "w");
+    if (file == nullptr) {
+        LOGE("Error: failed to open trace file %s\n", mOutputPath.c_str());
+        return -errno;
+    }
+
+    size_t numEvents = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    const char* sep = "";
+    for (size_t i = 0; i < mSessionNames.size(); i++) {
+        fprintf(file,
+                "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%zu,"
+                "\"args\":{\"name\":%s}}",
+                sep, i + 1, Json::valueToQuotedString(mSessionNames[i].c_str()).c_str());
+        sep = ",\n";
+    }
+    for (auto& buffer : mBuffers) {
+        for (auto& event : buffer->events) {
+            double tsUs = (event.tsNs - mStartNs) / 1000.0;
+            fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                    "\"pid\":%d,\"tid\":%d",
+                    sep, event.name, event.phase == 's' || event.phase == 'f' ? "frame" : "v4l2",
+                    event.phase, tsUs, event.session + 1, buffer->tid);
+            if (event.phase == 's' || event.phase == 'f') {
+                fprintf(file, ",\"id\":%llu", (unsigned long long)event.id);
+            }
+            if (event.phase == 'f') {
+                fprintf(file, ",\"bp\":\"e\"");
+            } else if (event.phase == 'i') {
+                fprintf(file, ",\"s\":\"t\"");
+            }
+            fprintf(file, "}");
+            sep = ",\n";
+            numEvents++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    LOGI("Trace: %zu events from %zu threads written to %s\n", numEvents, mBuffers.size(),
+         mOutputPath.c_str());
+    return 0;
+}
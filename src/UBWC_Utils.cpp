@@ -12,6 +12,11 @@
 #include "V4l2Driver.h"
 
 const std::unordered_map<int, BufferLayoutInfo> kBufferLayoutInfoMap = {
+    {V4L2_PIX_FMT_NV12,
+     {{
+         {true, {1, 1, 1, 1, 128}, {1, 1, 1, 1, 32}},    // yPlane
+         {true, {1, 1, 1, 1, 128}, {1, 1, 2, 1, 16}},    // uvPlane
+     }}},
     {V4L2_PIX_FMT_QC08C,
      {{
          {true, {1, 1, 1, 32, 64}, {1, 1, 1, 8, 16}},    // primaryMetaPlane
@@ -5,10 +5,18 @@
  **************************************************************************************************
 */
 
+#include <linux/dma-buf.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <algorithm>
+
+#include "DmaHeapBenchmark.h"
 #include "V4l2Codec.h"
 
+#define ALIGN(num, to) (((num) + (to - 1)) & (~(to - 1)))
+#define COPY_BENCHMARK_ITERATIONS 16
+
 std::unordered_map<std::string, unsigned int> gV4l2KeyCIDMap = {
     //Codec Based
     {"AVC_Level",                    V4L2_CID_MPEG_VIDEO_H264_LEVEL},
@@ -201,12 +209,14 @@ std::unordered_map<std::string, int> gMemoryTypeMap = {
     {"",                            0},
     {"MMAP",                        V4L2_MEMORY_MMAP},
     {"DMA_BUF",                     V4L2_MEMORY_DMABUF},
+    {"USERPTR",                     V4L2_MEMORY_USERPTR},
 };
 
 V4l2Codec::V4l2Codec(unsigned int codec, unsigned int pixel,
                      std::string sessionId)
     : mCodecFmt(codec), mPixelFmt(pixel), mSessionId(sessionId) {
     mV4l2Driver = std::make_shared<V4l2Driver>(mSessionId);
+    mTraceSession = TraceRecorder::get().registerSession(mSessionId);
 }
 
 V4l2Codec::~V4l2Codec() {
@@ -224,31 +234,47 @@ std::string V4l2Codec::id() {
     return mSessionId;
 }
 
+// Appends to a batch, letting a repeated id override the earlier value as
+// back to back VIDIOC_S_CTRL calls would.
+static void addToBatch(std::vector<struct v4l2_ext_control>& batch, unsigned int id,
+                       int value) {
+    for (auto& ctrl : batch) {
+        if (ctrl.id == id) {
+            ctrl.value = value;
+            return;
+        }
+    }
+    struct v4l2_ext_control ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.id = id;
+    ctrl.value = value;
+    batch.push_back(ctrl);
+}
+
 int V4l2Codec::setStaticControls() {
     int ret = 0;
-    while (!mStaticControls.empty()) {
-        auto ctrl = mStaticControls.front();
+    std::vector<struct v4l2_ext_control> batch;
+
+    for (auto ctrl : mStaticControls) {
         LOGI("%s: id: %#x, value: %d\n", __FUNCTION__, ctrl->id, ctrl->value);
-        ret = setControl(ctrl->id, ctrl->value);
-        if (ret) {
-            return ret;
-        }
-        mStaticControls.pop_front();
+        addToBatch(batch, ctrl->id, ctrl->value);
     }
+    ret = setControls(batch);
+    if (ret) {
+        return ret;
+    }
+    mStaticControls.clear();
     return ret;
 }
 
 int V4l2Codec::setDynamicCommands(unsigned int currFrame) {
     int ret = 0;
-    auto itr = mDynamicCommands.begin();
-
-    while (itr != mDynamicCommands.end()) {
-        auto cmd = *itr;
+    auto entry = mDynamicCommands.find(currFrame);
 
-        if (cmd->fnum != currFrame) {
-            itr++;
-            continue;
-        }
+    if (entry == mDynamicCommands.end()) {
+        return ret;
+    }
+    for (auto cmd : entry->second) {
         LOGI("%s: id: %s, value: %s fnum: %u\n", __FUNCTION__, cmd->id.c_str(),
             cmd->value.c_str(), cmd->fnum);
 
@@ -261,36 +287,69 @@ int V4l2Codec::setDynamicCommands(unsigned int currFrame) {
         } else if (cmd->id.compare("RandomSeek") == 0) {
             mRandomSeek[cmd->fnum] = stoi(cmd->value);
         }
-
-        itr = mDynamicCommands.erase(itr);
     }
+    mDynamicCommands.erase(entry);
 
     return ret;
 }
 
 int V4l2Codec::setDynamicControls(unsigned int currFrame) {
     int ret = 0;
-    auto itr = mDynamicControls.begin();
+    auto entry = mDynamicControls.find(currFrame);
 
-    while (itr != mDynamicControls.end()) {
-        auto ctrl = *itr;
+    if (entry == mDynamicControls.end()) {
+        return ret;
+    }
+    for (auto& ctrl : entry->second) {
+        LOGI("%s: id: %#x, value: %d fnum: %u\n", __FUNCTION__, ctrl.id,
+            ctrl.value, currFrame);
+    }
+    ret = setControls(entry->second);
+    if (ret) {
+        return ret;
+    }
+    mDynamicControls.erase(entry);
 
-        if (ctrl->fnum != currFrame) {
-            itr++;
-            continue;
-        }
-        LOGI("%s: id: %#x, value: %d fnum: %d\n", __FUNCTION__, ctrl->id,
-            ctrl->value, ctrl->fnum);
+    return ret;
+}
 
-        ret = setControl(ctrl->id, ctrl->value);
-        if (ret) {
-            return ret;
-        }
+int V4l2Codec::validateControl(unsigned int ctrlId, int value) {
+    auto cached = mCtrlRanges.find(ctrlId);
 
-        itr = mDynamicControls.erase(itr);
+    if (cached == mCtrlRanges.end()) {
+        struct v4l2_query_ext_ctrl query;
+        memset(&query, 0, sizeof(query));
+        query.id = ctrlId;
+        if (mV4l2Driver->queryExtControl(&query)) {
+            // Unknown to the driver; leave the verdict to S_EXT_CTRLS.
+            query.type = 0;
+        }
+        cached = mCtrlRanges.emplace(ctrlId, query).first;
     }
 
-    return ret;
+    const struct v4l2_query_ext_ctrl& range = cached->second;
+    switch (range.type) {
+        case V4L2_CTRL_TYPE_INTEGER:
+        case V4L2_CTRL_TYPE_BOOLEAN:
+        case V4L2_CTRL_TYPE_MENU:
+        case V4L2_CTRL_TYPE_INTEGER_MENU:
+            break;
+        default:
+            // Buttons, bitmasks and compound controls carry no usable range.
+            return 0;
+    }
+    if (range.flags & V4L2_CTRL_FLAG_READ_ONLY) {
+        LOGE("Error: control \"%s\" is read only\n", range.name);
+        return -EINVAL;
+    }
+    if (value < range.minimum || value > range.maximum ||
+        (range.step > 1 && (value - range.minimum) % range.step)) {
+        LOGE("Error: control \"%s\" value %d outside [%lld, %lld] step %llu\n",
+            range.name, value, (long long)range.minimum, (long long)range.maximum,
+            (unsigned long long)range.step);
+        return -EINVAL;
+    }
+    return 0;
 }
 
 bool V4l2Codec::fillCfgCtrls(std::shared_ptr<EventConfig> ctrl,
@@ -352,6 +411,9 @@ int V4l2Codec::populateStaticConfigs(
         bool ret = fillCfgCtrls(ctrl, &sControl->id, &sControl->value);
 
         if (ret) {
+            if (validateControl(sControl->id, sControl->value)) {
+                return -EINVAL;
+            }
             mStaticControls.push_back(sControl);
         }
 
@@ -409,7 +471,11 @@ int V4l2Codec::populateDynamicConfigs(
 
         dControl->fnum = ctrl->fnum;
         if (ret) {
-            mDynamicControls.push_back(dControl);
+            if (validateControl(dControl->id, dControl->value)) {
+                LOGE("Error: dynamic control at frame %u rejected\n", dControl->fnum);
+                return -EINVAL;
+            }
+            addToBatch(mDynamicControls[dControl->fnum], dControl->id, dControl->value);
         }
         eventConfig.pop_front();
     }
@@ -432,7 +498,7 @@ int V4l2Codec::populateDynamicCommands(
         dynCmdInfo->value = dynCmd->valueStr;
         dynCmdInfo->fnum = dynCmd->fnum;
 
-        mDynamicCommands.push_back(dynCmdInfo);
+        mDynamicCommands[dynCmdInfo->fnum].push_back(dynCmdInfo);
     }
     return 0;
 }
@@ -452,6 +518,20 @@ int V4l2Codec::setControl(unsigned int ctrlId, int value) {
     return 0;
 }
 
+int V4l2Codec::setControls(std::vector<struct v4l2_ext_control>& ctrls) {
+    struct v4l2_ext_controls extCtrls;
+
+    if (ctrls.empty()) {
+        return 0;
+    }
+    TraceScope trace(mTraceSession, "controls");
+    memset(&extCtrls, 0, sizeof(extCtrls));
+    extCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+    extCtrls.count = ctrls.size();
+    extCtrls.controls = ctrls.data();
+    return mV4l2Driver->setExtControls(&extCtrls);
+}
+
 int V4l2Codec::setInputSizeOverWrite(int size) {
     LOGW("Client Input Size OverWrite %d\n", size);
     mInputSizeOverWrite = size;
@@ -542,14 +622,42 @@ int V4l2Codec::setOutputBufferData(std::shared_ptr<v4l2_buffer> buf) {
     auto& buffer = itr->second;
     if (mMemoryType == V4L2_MEMORY_DMABUF) {
         auto dmaBuf = std::dynamic_pointer_cast<DMABuffer>(buffer);
-        buf->m.planes[0].bytesused = getOutputSize();
-        buf->m.planes[0].data_offset = 0;
-        buf->m.planes[0].length = getOutputSize();
-        buf->m.planes[0].m.fd = dmaBuf->mFd;
+        for (uint32_t i = 0; i < dmaBuf->mNumPlanes; i++) {
+            buf->m.planes[i].bytesused = dmaBuf->mSize[i];
+            buf->m.planes[i].data_offset = 0;
+            buf->m.planes[i].length = dmaBuf->mSize[i];
+            buf->m.planes[i].m.fd = dmaBuf->mFd[i];
+        }
+    } else if (mMemoryType == V4L2_MEMORY_USERPTR) {
+        auto userPtrBuf = std::dynamic_pointer_cast<UserPtrBuffer>(buffer);
+        for (uint32_t i = 0; i < userPtrBuf->mNumPlanes; i++) {
+            buf->m.planes[i].bytesused = userPtrBuf->mSize[i];
+            buf->m.planes[i].data_offset = 0;
+            buf->m.planes[i].length = userPtrBuf->mSize[i];
+            buf->m.planes[i].m.userptr = (unsigned long)userPtrBuf->mAddr[i];
+        }
     }
     return 0;
 }
 
+void V4l2Codec::updatePlaneInfo(const struct v4l2_format* fmt) {
+    bool isInput = fmt->type == INPUT_MPLANE;
+    int numPlanes = fmt->fmt.pix_mp.num_planes;
+    if (numPlanes < 1 || numPlanes > VIDEO_MAX_PLANES) {
+        numPlanes = 1;
+    }
+    auto& planeSize = isInput ? mInputPlaneSize : mOutputPlaneSize;
+    auto& planeStride = isInput ? mInputPlaneStride : mOutputPlaneStride;
+    (isInput ? mNumInputPlanes : mNumOutputPlanes) = numPlanes;
+    for (int i = 0; i < VIDEO_MAX_PLANES; i++) {
+        planeSize[i] = i < numPlanes ? fmt->fmt.pix_mp.plane_fmt[i].sizeimage : 0;
+        planeStride[i] = i < numPlanes ? fmt->fmt.pix_mp.plane_fmt[i].bytesperline : 0;
+    }
+    LOGD("%s port: %d plane(s), plane0 size %u stride %u, plane1 size %u stride %u\n",
+         isInput ? "Input" : "Output", numPlanes, planeSize[0], planeStride[0],
+         planeSize[1], planeStride[1]);
+}
+
 int V4l2Codec::setDump(std::string inputFile, std::string outputFile) {
     static std::unordered_map<std::string, uint32_t> sNames;
 
@@ -595,6 +703,121 @@ int V4l2Codec::setMemoryType(std::string memoryType) {
     return 0;
 }
 
+int V4l2Codec::setCopyKernel(std::string name) {
+    if (name.empty() || name == "auto") {
+        mCopyKernelAuto = true;
+        return 0;
+    }
+    if (CopyKernel::parseType(name, &mCopyKernel)) {
+        LOGE("Error: unknown copy kernel %s, expected auto, memcpy or stream\n", name.c_str());
+        return -EINVAL;
+    }
+    mCopyKernelAuto = false;
+    return 0;
+}
+
+int V4l2Codec::setDmaHeap(std::string heap) {
+    if (!heap.empty()) {
+        mDmaHeap = heap;
+    }
+    return 0;
+}
+
+void V4l2Codec::configureHeapAccess() {
+    bool uncached = mMemoryType == V4L2_MEMORY_DMABUF &&
+                    V4l2Driver::isUncachedHeap(mV4l2Driver->getHeapName());
+    mDmaSync = !uncached;
+    if (mCopyKernelAuto) {
+        mCopyKernel = uncached ? CopyKernel::COPY_STREAM : CopyKernel::COPY_MEMCPY;
+    }
+    if (mMemoryType == V4L2_MEMORY_DMABUF) {
+        LOGI("DMA heap %s: %s, copy kernel %s\n", mV4l2Driver->getHeapName().c_str(),
+             uncached ? "uncached, no DMA_BUF sync" : "cached", CopyKernel::getName(mCopyKernel));
+    } else {
+        LOGI("Copy kernel: %s\n", CopyKernel::getName(mCopyKernel));
+    }
+}
+
+int V4l2Codec::syncDmaBuf(int fd, uint64_t flags) {
+    if (!mDmaSync) {
+        return 0;
+    }
+    struct dma_buf_sync sync;
+    sync.flags = flags;
+    return ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+int V4l2Codec::benchmarkCopyKernels() {
+    auto itr = mInputBuffersPool.begin();
+    if (itr == mInputBuffersPool.end()) {
+        LOGE("Error: copy benchmark needs allocated input buffers\n");
+        return -EINVAL;
+    }
+    void* addr = nullptr;
+    size_t size = 0;
+    std::unique_ptr<MapBuf> map;
+    if (mMemoryType == V4L2_MEMORY_DMABUF) {
+        auto dmaBuf = std::dynamic_pointer_cast<DMABuffer>(itr->second);
+        map = std::make_unique<MapBuf>(nullptr, dmaBuf->mSize[0], PROT_READ | PROT_WRITE,
+                                       MAP_SHARED, dmaBuf->mFd[0], 0);
+        if (!map->isMapSucess()) {
+            LOGE("Error: failed to mmap input buffer for the copy benchmark\n");
+            return -EINVAL;
+        }
+        addr = map->getMappedAddr();
+        size = dmaBuf->mSize[0];
+    } else if (mMemoryType == V4L2_MEMORY_MMAP) {
+        auto mmapBuf = std::dynamic_pointer_cast<MMAPBuffer>(itr->second);
+        addr = mmapBuf->start[0];
+        size = mmapBuf->length[0];
+    } else if (mMemoryType == V4L2_MEMORY_USERPTR) {
+        auto userPtrBuf = std::dynamic_pointer_cast<UserPtrBuffer>(itr->second);
+        addr = userPtrBuf->mAddr[0];
+        size = userPtrBuf->mSize[0];
+    }
+    if (addr == nullptr || size == 0) {
+        return -EINVAL;
+    }
+
+    // Encoders copy frame rows into a strided plane; decoders copy whole packets.
+    size_t rowBytes = size, dstStride = size;
+    int rows = 1;
+    if (mDomain == V4L2_CODEC_TYPE_ENCODER && mWidth > 0 && mStride >= mWidth) {
+        rowBytes = mWidth;
+        dstStride = mStride;
+        rows = std::min((size_t)mHeight * 3 / 2, size / mStride);
+    }
+
+    std::string target = mMemoryType == V4L2_MEMORY_DMABUF
+                             ? "dma_heap/" + mV4l2Driver->getHeapName()
+                             : std::string(mMemoryType == V4L2_MEMORY_MMAP ? "MMAP" : "USERPTR");
+    double ms[2] = {0};
+    for (int type = CopyKernel::COPY_MEMCPY; type <= CopyKernel::COPY_STREAM; type++) {
+        ms[type] = CopyKernel::benchmark((CopyKernel::Type)type, addr, dstStride, rowBytes, rows,
+                                         COPY_BENCHMARK_ITERATIONS);
+        LOGI("Copy benchmark %s, %s: %zu x %d bytes in %.3f ms (%.2f GB/s)\n", target.c_str(),
+             CopyKernel::getName((CopyKernel::Type)type), rowBytes, rows, ms[type],
+             ms[type] > 0 ? rowBytes * rows / (ms[type] * 1e6) : 0.0);
+    }
+    if (mCopyKernelAuto) {
+        mCopyKernel = ms[CopyKernel::COPY_STREAM] < ms[CopyKernel::COPY_MEMCPY]
+                          ? CopyKernel::COPY_STREAM
+                          : CopyKernel::COPY_MEMCPY;
+        LOGI("Copy kernel: %s, the faster on %s\n", CopyKernel::getName(mCopyKernel),
+             target.c_str());
+        applyCopyKernel();
+    }
+    return 0;
+}
+
+int V4l2Codec::benchmarkDmaHeaps(int iterations) {
+    // The driver layout once the port is configured; the usual Iris NV12 alignment before.
+    int stride = mStride >= mWidth ? mStride : ALIGN(mWidth, 128);
+    int scanline = mScanline >= mHeight ? mScanline : ALIGN(mHeight, 32);
+    DmaHeapBenchmark benchmark(mSessionId);
+    return benchmark.run(mWidth, mHeight, stride, scanline, iterations);
+}
+
 int V4l2Codec::allocateBuffers(port_type port) {
     int bufCount = 0, bufSize = 0, ret = 0;
     std::shared_ptr<v4l2_buffer> buf;
@@ -615,6 +838,20 @@ int V4l2Codec::allocateBuffers(port_type port) {
         bufSize = getOutputSize();
     }
 
+    if (mMemoryType == V4L2_MEMORY_USERPTR) {
+        auto& arena = port == INPUT_PORT ? mInputArena : mOutputArena;
+        size_t perBufSize = 0;
+        int numPlanes = getNumPlanes(port);
+        for (int i = 0; i < numPlanes; i++) {
+            perBufSize += ALIGN(numPlanes == 1 ? bufSize : getPlaneSize(port, i), 4096);
+        }
+        arena = std::make_shared<HugePageArena>(mSessionId);
+        ret = arena->init((size_t)bufCount * perBufSize);
+        if (ret) {
+            return ret;
+        }
+    }
+
     for (int i = 0; i < bufCount; i++) {
         buf = allocateBuffer(i, port, bufSize);
         if (buf == nullptr) {
@@ -661,6 +898,11 @@ int V4l2Codec::freeBuffers(port_type port) {
             pendingBuf.pop_front();
         }
         bufPool.clear();
+        if (port == OUTPUT_PORT) {
+            mOutputArena = nullptr;
+        } else {
+            mInputArena = nullptr;
+        }
     };
 
     if (port == OUTPUT_PORT) {
@@ -695,23 +937,30 @@ std::shared_ptr<v4l2_buffer> V4l2Codec::allocateBuffer(int index, port_type port
     }
     memset(plane, 0, sizeof(struct v4l2_plane) * VIDEO_MAX_PLANES);
 
+    int numPlanes = getNumPlanes(port);
+    // Single-plane buffers keep the caller's size so input overrides still apply;
+    // multi-planar formats take each plane's size from the negotiated format.
+    auto planeSize = [&](int i) -> uint32_t {
+        return numPlanes == 1 ? bufSize : getPlaneSize(port, i);
+    };
+
     buf->type = port == INPUT_PORT ? INPUT_MPLANE : OUTPUT_MPLANE;
     buf->memory = mMemoryType;
     buf->index = index;
-    buf->length = 1;
+    buf->length = numPlanes;
     buf->m.planes = plane;
     buf->flags = 0;
     memset(&buf->timestamp, 0, sizeof(buf->timestamp));
 
     if (mMemoryType == V4L2_MEMORY_DMABUF) {
-        std::shared_ptr<DMABuffer> dmaBuf = nullptr;
-        {
+        std::shared_ptr<DMABuffer> dmaBuf = std::make_shared<DMABuffer>();
+        for (int i = 0; i < numPlanes; i++) {
             int ret, bufFd = -1;
-            ret = mV4l2Driver->AllocDMABuffer(bufSize, &bufFd);
+            ret = mV4l2Driver->AllocDMABuffer(planeSize(i), &bufFd);
             if (ret) {
                 return nullptr;
             }
-            dmaBuf = std::make_shared<DMABuffer>(bufSize, bufFd);
+            dmaBuf->addPlane(planeSize(i), bufFd);
             close(bufFd);
         }
         if (port == INPUT_PORT) {
@@ -732,6 +981,22 @@ std::shared_ptr<v4l2_buffer> V4l2Codec::allocateBuffer(int index, port_type port
         } else {
             mOutputBuffersPool[index] = mmapBuf;
         }
+    } else if (mMemoryType == V4L2_MEMORY_USERPTR) {
+        auto& arena = port == INPUT_PORT ? mInputArena : mOutputArena;
+        auto userPtrBuf = std::make_shared<UserPtrBuffer>();
+        for (int i = 0; i < numPlanes; i++) {
+            void* addr = arena ? arena->carve(planeSize(i)) : nullptr;
+            if (addr == nullptr) {
+                LOGE("Allocate USERPTR buffer failed.\n");
+                return nullptr;
+            }
+            userPtrBuf->addPlane(addr, planeSize(i));
+        }
+        if (port == INPUT_PORT) {
+            mInputBuffersPool[index] = userPtrBuf;
+        } else {
+            mOutputBuffersPool[index] = userPtrBuf;
+        }
     }
 
     return buf;
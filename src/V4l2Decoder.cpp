@@ -11,10 +11,18 @@
 #include <climits>
 
 #include "FFStreamParser.h"
+#include "DecodeCrossCheck.h"
+#include "FrameChecksum.h"
+#include "FramePostProcessor.h"
+#include "FrameQuality.h"
+#include "UBWC_Utils.h"
 #include "V4l2Decoder.h"
 
 #define MAX_COLOR_FMTS 7
 #define INPUT_TIMEOUT INT_MAX
+#define DEFAULT_INPUT_SIZE (2 * 1024 * 1024)
+#define INPUT_SIZE_HEADROOM 25  // percent on top of the largest packet
+#define ALIGN(num, to) (((num) + (to - 1)) & (~(to - 1)))
 
 V4l2Decoder::V4l2Decoder(unsigned int codec, unsigned int pixel,
                          std::string sessionId)
@@ -42,9 +50,9 @@ int V4l2Decoder::init() {
     if (ret) {
         return ret;
     }
-    if (mMemoryType != V4L2_MEMORY_MMAP) {
-        // Only try to open dma_heap when memory type is not set to V4L2_MEMORY_MMAP
-        ret = mV4l2Driver->OpenDMAHeap("system");
+    if (mMemoryType != V4L2_MEMORY_MMAP && mMemoryType != V4L2_MEMORY_USERPTR) {
+        // Only try to open dma_heap when memory type is not set to MMAP or USERPTR
+        ret = mV4l2Driver->OpenDMAHeap(mDmaHeap);
         if (ret && (mMemoryType == V4L2_MEMORY_DMABUF)) {
             LOGE("Error: failed to open dma_heap while V4L2_MEMORY_DMABUF designated.\n");
             return ret;
@@ -54,6 +62,7 @@ int V4l2Decoder::init() {
             setMemoryType("DMA_BUF");
         }
     }
+    configureHeapAccess();
 
     ret = mV4l2Driver->subscribeEvent(V4L2_EVENT_SOURCE_CHANGE);
     if (ret) {
@@ -76,13 +85,20 @@ int V4l2Decoder::init() {
     return 0;
 }
 
-int V4l2Decoder::initFFStreamParser(std::string inputPath) {
+void V4l2Decoder::applyCopyKernel() {
+    if (mStreamParser) {
+        mStreamParser->setCopyKernel(mCopyKernel);
+    }
+}
+
+int V4l2Decoder::initFFStreamParser(std::string inputPath, bool sharedCache) {
     int ret = 0;
-    mStreamParser = std::make_shared<FFStreamParser>(inputPath, mSessionId);
+    mStreamParser = std::make_shared<FFStreamParser>(inputPath, mSessionId, sharedCache);
     ret = mStreamParser->init();
     if (ret) {
         return ret;
     }
+    applyCopyKernel();
     ret = mStreamParser->loopPackets();
     if (ret) {
         return ret;
@@ -90,6 +106,14 @@ int V4l2Decoder::initFFStreamParser(std::string inputPath) {
     return 0;
 }
 
+int V4l2Decoder::getRecommendedInputSize() {
+    int maxPktSize = mStreamParser ? mStreamParser->getMaxPacketSize() : 0;
+    if (maxPktSize <= 0) {
+        return DEFAULT_INPUT_SIZE;
+    }
+    return ALIGN(maxPktSize + maxPktSize * INPUT_SIZE_HEADROOM / 100, 4096);
+}
+
 void V4l2Decoder::deinitFFStreamParser() {
     mStreamParser->deinit();
 }
@@ -102,6 +126,32 @@ void V4l2Decoder::deinit() {
     if (mMemoryType == V4L2_MEMORY_DMABUF){
         mV4l2Driver->CloseDMAHeap();
     }
+    if (mChecksum) {
+        mChecksum->deinit();
+        mChecksum = nullptr;
+    }
+    if (mQuality) {
+        mQuality->deinit();
+        mQuality = nullptr;
+    }
+    if (mPostProcessor) {
+        mPostProcessor->deinit();
+        mPostProcessor = nullptr;
+    }
+    if (mCrossCheck) {
+        mCrossCheck->deinit();
+        mCrossCheck = nullptr;
+    }
+}
+
+int V4l2Decoder::setChecksum(std::string type, std::string outputPath,
+                             std::string referencePath) {
+    mChecksum = std::make_shared<FrameChecksum>(mSessionId);
+    int ret = mChecksum->init(type, outputPath, referencePath);
+    if (ret) {
+        mChecksum = nullptr;
+    }
+    return ret;
 }
 
 int V4l2Decoder::configureInput() {
@@ -120,11 +170,16 @@ int V4l2Decoder::configureInput() {
 
     fmt.fmt.pix_mp.width = mWidth;
     fmt.fmt.pix_mp.height = mHeight;
+    if (mInputSizeOverWrite > 0) {
+        // Coded formats let the client pick sizeimage; driver may round it up.
+        fmt.fmt.pix_mp.plane_fmt[0].sizeimage = mInputSizeOverWrite;
+    }
     ret = mV4l2Driver->setFormat(&fmt);
     if (ret) {
         return ret;
     }
 
+    updatePlaneInfo(&fmt);
     mStride = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
     mInputSize = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
     LOGD("configureInput: width(%d),height(%d),stride(%d),inputSize(%d)\n",
@@ -161,15 +216,10 @@ int V4l2Decoder::configureInput() {
     return 0;
 }
 
-int V4l2Decoder::configureOutput() {
+int V4l2Decoder::setOutputFormat() {
     struct v4l2_format fmt;
-    struct v4l2_frmsizeenum fsize;
-    struct v4l2_requestbuffers reqBufs;
-    struct v4l2_control ctrl;
-    struct v4l2_queryctrl queryctrl;
-    struct v4l2_selection sel;
+    uint32_t maxOutputSize = getMaxOutputSize();
     int ret = 0;
-    LOGD("V4l2Decoder::configureOutput()\n");
 
     /* set output format */
     memset(&fmt, 0, sizeof(fmt));
@@ -180,6 +230,12 @@ int V4l2Decoder::configureOutput() {
     }
     fmt.fmt.pix_mp.width = mWidth;
     fmt.fmt.pix_mp.height = mHeight;
+    for (int i = 0; i < fmt.fmt.pix_mp.num_planes; i++) {
+        uint32_t maxSize = fmt.fmt.pix_mp.num_planes == 1 ? maxOutputSize : getMaxPlaneSize(i);
+        if (fmt.fmt.pix_mp.plane_fmt[i].sizeimage < maxSize) {
+            fmt.fmt.pix_mp.plane_fmt[i].sizeimage = maxSize;
+        }
+    }
 
     auto mOutputMatrixCoeff = fmt.fmt.pix_mp.ycbcr_enc;
     auto mOutputTransferChar = fmt.fmt.pix_mp.xfer_func;
@@ -196,14 +252,35 @@ int V4l2Decoder::configureOutput() {
     if (ret) {
         return ret;
     }
+    updatePlaneInfo(&fmt);
     //mOBufWidth = fmt.fmt.pix_mp.width;
     mOBufHeight = fmt.fmt.pix_mp.height;
     mStride = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
-    mOutputSize = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
+    mOutputSize = std::max({mOutputSize, (int)fmt.fmt.pix_mp.plane_fmt[0].sizeimage,
+                            (int)maxOutputSize});
     mOBufWidth = mStride;
     LOGD("%s: output Buffer(%dx%d), Stride(%d), OutputSize (%d)\n", __func__,
         mOBufWidth, mOBufHeight, mStride, mOutputSize);
 
+    return 0;
+}
+
+int V4l2Decoder::configureOutput() {
+    struct v4l2_frmsizeenum fsize;
+    struct v4l2_requestbuffers reqBufs;
+    struct v4l2_control ctrl;
+    struct v4l2_queryctrl queryctrl;
+    struct v4l2_selection sel;
+    int ret = 0;
+    LOGD("V4l2Decoder::configureOutput()\n");
+
+    /* buffers are (re)allocated after this, so size them from scratch */
+    mOutputSize = 0;
+    ret = setOutputFormat();
+    if (ret) {
+        return ret;
+    }
+
     /* query driver recommended framesizes */
     memset(&fsize, 0, sizeof(fsize));
     fsize.index = 0;
@@ -248,10 +325,46 @@ static inline bool isCompressedColorFmt(unsigned int colorformat) {
 
 static inline bool isLinearColorFmt(unsigned int colorformat) {
     return colorformat == V4L2_PIX_FMT_NV12 || colorformat == V4L2_PIX_FMT_NV21 ||
+           colorformat == V4L2_PIX_FMT_NV12M ||
            // colorformat == V4L2_PIX_FMT_VIDC_P010 ||
            colorformat == V4L2_PIX_FMT_RGBA32;
 }
 
+uint32_t V4l2Decoder::getMaxOutputSize() {
+    uint32_t size = 0;
+
+    if (!isOutputPreallocated()) {
+        return 0;
+    }
+    if (isCompressedColorFmt(mPixelFmt)) {
+        size = getBufferSize(V4L2_PIX_FMT_QC08C, mMaxWidth, mMaxHeight);
+        if (mMaxBitDepth > 8) {
+            size = std::max(size, getBufferSize(V4L2_PIX_FMT_QC10C, mMaxWidth, mMaxHeight));
+        }
+    } else {
+        size = getBufferSize(V4L2_PIX_FMT_NV12, mMaxWidth, mMaxHeight);
+        if (mMaxBitDepth > 8) {
+            // 10-bit linear formats store every sample in 16 bits.
+            size *= 2;
+        }
+    }
+    return size;
+}
+
+uint32_t V4l2Decoder::getMaxPlaneSize(int plane) {
+    uint32_t size = 0;
+
+    if (!isOutputPreallocated() || plane >= PLANE_MAXSIZE) {
+        return 0;
+    }
+    // Multi-plane output is linear only (NV12M).
+    size = ::getPlaneSize(getBufferLayoutInfo(V4L2_PIX_FMT_NV12)[plane], mMaxWidth, mMaxHeight);
+    if (mMaxBitDepth > 8) {
+        size *= 2;
+    }
+    return size;
+}
+
 bool V4l2Decoder::detectBitDepthChange() {
     bool isCompressedFmt, found = false;
     struct v4l2_fmtdesc fmtdesc;
@@ -285,6 +398,26 @@ bool V4l2Decoder::detectBitDepthChange() {
     return true;
 }
 
+bool V4l2Decoder::fitsOutputBuffers(const struct v4l2_format* fmt) {
+    const struct v4l2_pix_format_mplane& pix = fmt->fmt.pix_mp;
+
+    // A bit depth change keeps the plane layout, so the buffers are reusable
+    // as long as every plane still fits its preallocated size.
+    if (pix.num_planes != mNumOutputPlanes ||
+        isCompressedColorFmt(pix.pixelformat) != isCompressedColorFmt(mPixelFmt)) {
+        return false;
+    }
+    for (int i = 0; i < pix.num_planes; i++) {
+        uint32_t allocated = mNumOutputPlanes == 1 ? mOutputSize : getPlaneSize(OUTPUT_PORT, i);
+        if (pix.plane_fmt[i].sizeimage > allocated) {
+            LOGI("%s: plane %d needs %u bytes, preallocated %u\n", __func__, i,
+                 pix.plane_fmt[i].sizeimage, allocated);
+            return false;
+        }
+    }
+    return true;
+}
+
 int V4l2Decoder::detectResolutionChange(bool* hasResolutionChanged) {
     struct v4l2_format fmt;
     int width, height, ret = 0;
@@ -309,6 +442,7 @@ int V4l2Decoder::detectResolutionChange(bool* hasResolutionChanged) {
 }
 
 int V4l2Decoder::reconfigureOutput() {
+    TraceScope trace(mTraceSession, "DRC");
     int ret = 0;
     int latestOutputSize;
     int latestOutputMinCount;
@@ -353,6 +487,31 @@ int V4l2Decoder::reconfigureOutput() {
         if (ret) {
             return ret;
         }
+    } else if (isOutputPreallocated() && latestOutputMinCount <= mActualOutputCount &&
+               fitsOutputBuffers(&fmt)) {
+        // vb2 rejects S_FMT while CAPTURE buffers exist, so take the new
+        // geometry as the driver reports it and keep the buffers.
+        LOGI("reconfigureOutput: reuse %d preallocated output buffers of size %d\n",
+            mActualOutputCount, mOutputSize);
+        ret = stopOutput();
+        if (ret) {
+            return ret;
+        }
+        if (fmt.fmt.pix_mp.pixelformat != mPixelFmt) {
+            LOGI("reconfigureOutput: output colorformat %#x -> %#x\n", mPixelFmt,
+                 fmt.fmt.pix_mp.pixelformat);
+            mPixelFmt = fmt.fmt.pix_mp.pixelformat;
+        }
+        for (int i = 0; i < mNumOutputPlanes; i++) {
+            mOutputPlaneStride[i] = fmt.fmt.pix_mp.plane_fmt[i].bytesperline;
+        }
+        mOBufHeight = fmt.fmt.pix_mp.height;
+        mStride = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+        mOBufWidth = mStride;
+        ret = startOutput();
+        if (ret) {
+            return ret;
+        }
     } else {
         ret = stopOutput();
         if (ret) {
@@ -379,6 +538,7 @@ int V4l2Decoder::reconfigureOutput() {
 
 int V4l2Decoder::feedInputDataToV4l2Buffer(std::shared_ptr<v4l2_buffer> buf,
                                            bool& eos, uint32_t frameCount) {
+    TraceScope trace(mTraceSession, "fill");
     int pktSize = 0;
     void* bufAddr = nullptr;
     auto itr = mInputBuffersPool.find(buf->index);
@@ -390,25 +550,49 @@ int V4l2Decoder::feedInputDataToV4l2Buffer(std::shared_ptr<v4l2_buffer> buf,
 
     if (mMemoryType == V4L2_MEMORY_DMABUF) {
         auto dmaBuf = std::dynamic_pointer_cast<DMABuffer>(buffer);
-        MapBuf map(NULL, dmaBuf->mSize, PROT_READ | PROT_WRITE, MAP_SHARED, dmaBuf->mFd, 0);
+        MapBuf map(NULL, dmaBuf->mSize[0], PROT_READ | PROT_WRITE, MAP_SHARED, dmaBuf->mFd[0], 0);
         if (!map.isMapSucess()) {
             LOGE("Error: failed to mmap output buffer at index: %d\n", buf->index);
             return -EINVAL;
         }
         void* bufAddr = map.getMappedAddr();
         // LOG("%d Mapped input buffer ptr: %p\n", buf->index, bufAddr);
-        pktSize = mStreamParser->fillPacketData(bufAddr, eos);
+        pktSize = mStreamParser->fillPacketData(bufAddr, dmaBuf->mSize[0], eos);
+        if (pktSize < 0) {
+            return pktSize;
+        }
         buf->m.planes[0].bytesused = pktSize;
         buf->m.planes[0].data_offset = 0;
         buf->m.planes[0].length = getInputSize();
-        buf->m.planes[0].m.fd = dmaBuf->mFd;
+        buf->m.planes[0].m.fd = dmaBuf->mFd[0];
     } else if (mMemoryType == V4L2_MEMORY_MMAP) {
         auto mmapBuf = std::dynamic_pointer_cast<MMAPBuffer>(buffer);
         bufAddr = mmapBuf->start[0];
-        pktSize = mStreamParser->fillPacketData(bufAddr, eos);
+        pktSize = mStreamParser->fillPacketData(bufAddr, mmapBuf->length[0], eos);
+        if (pktSize < 0) {
+            return pktSize;
+        }
         buf->m.planes[0].bytesused = pktSize;
         buf->m.planes[0].data_offset = 0;
         buf->m.planes[0].length = getInputSize();
+    } else if (mMemoryType == V4L2_MEMORY_USERPTR) {
+        auto userPtrBuf = std::dynamic_pointer_cast<UserPtrBuffer>(buffer);
+        bufAddr = userPtrBuf->mAddr[0];
+        pktSize = mStreamParser->fillPacketData(bufAddr, userPtrBuf->mSize[0], eos);
+        if (pktSize < 0) {
+            return pktSize;
+        }
+        buf->m.planes[0].bytesused = pktSize;
+        buf->m.planes[0].data_offset = 0;
+        buf->m.planes[0].length = userPtrBuf->mSize[0];
+        buf->m.planes[0].m.userptr = (unsigned long)bufAddr;
+    }
+    if (TraceRecorder::isEnabled() && pktSize) {
+        // The driver copies the timestamp to the CAPTURE buffer of this frame.
+        uint64_t key = ++mTraceFrameCnt;
+        buf->timestamp.tv_sec = key / 1000000;
+        buf->timestamp.tv_usec = key % 1000000;
+        TraceRecorder::get().flowStart(mTraceSession, key);
     }
     // LOG("Filled pkg size: %d, length: %d, fd: %d\n", pktSize,
     // buf->m.planes[0].length, buf->m.planes[0].m.fd);
@@ -518,6 +702,10 @@ int V4l2Decoder::queueBuffers(int maxFrameCnt) {
             LOGE("Error: queueBuffers: draining failed\n");
             return ret;
         }
+        // Ended when the last flag arrives, on this thread.
+        if (TraceRecorder::isEnabled()) {
+            TraceRecorder::get().begin(mTraceSession, "drain");
+        }
         return ret;
     };
 
@@ -666,6 +854,9 @@ int V4l2Decoder::queueBuffers(int maxFrameCnt) {
         setDrainLastFlagReceived(false);
         setDrainSent(false);
         LOGW("queueBuffers: last flag for drain arrived\n");
+        if (TraceRecorder::isEnabled()) {
+            TraceRecorder::get().end(mTraceSession, "drain");
+        }
         ret = start();
         if (ret != 0) {
             LOGE("Error: queueBuffers: resume failed.\n");
@@ -819,30 +1010,32 @@ int V4l2Decoder::queueBuffers(int maxFrameCnt) {
         retry_count = 0;
     }
 
+    if (ret == 0 && mChecksum && mChecksum->isMismatched()) {
+        return -EBADMSG;
+    }
+    if (ret == 0 && mCrossCheck && mCrossCheck->isMismatched()) {
+        return -EBADMSG;
+    }
     return ret;
 }
 
-int V4l2Decoder::writeDumpDataToFile(v4l2_buffer* buf) {
-    std::unique_lock<std::mutex> lock(mOutputBufLock);
-    // Writing one color plane.
-    auto writePlane = [=](const uint8_t* p, uint32_t wBytes, uint32_t strideBytes,
-                          uint32_t nLines) {
-        for (uint32_t i = 0; i < nLines; ++i) {
-            fwrite(p, wBytes, 1, mOutputDumpFile);
-            fflush(mOutputDumpFile);
-            p += strideBytes;
-        }
-    };
-
-    std::uint8_t* pBuffer = nullptr;
-    std::unique_ptr<MapBuf> map = nullptr;
+int V4l2Decoder::mapOutputFrame(v4l2_buffer* buf, OutputFrame* frame) {
+    // Per-plane base addresses; contiguous formats only populate plane 0.
+    uint32_t numPlanes = std::min<uint32_t>(std::max<uint32_t>(buf->length, 1),
+                                            VIDEO_MAX_PLANES);
+    std::uint8_t** planeAddr = frame->planeAddr;
+    frame->numPlanes = numPlanes;
     if (mMemoryType == V4L2_MEMORY_DMABUF) {
-        map = std::make_unique<MapBuf>(nullptr, buf->m.planes[0].length, PROT_READ, MAP_SHARED, buf->m.planes[0].m.fd, 0);
-        if (!map->isMapSucess()) {
-            LOGE("Error: failed to mmap output buffer\n");
-            return -EINVAL;
+        for (uint32_t i = 0; i < numPlanes; i++) {
+            frame->maps[i] = std::make_unique<MapBuf>(nullptr, buf->m.planes[i].length,
+                                                      PROT_READ, MAP_SHARED,
+                                                      buf->m.planes[i].m.fd, 0);
+            if (!frame->maps[i]->isMapSucess()) {
+                LOGE("Error: failed to mmap output buffer plane %u\n", i);
+                return -EINVAL;
+            }
+            planeAddr[i] = (std::uint8_t*)frame->maps[i]->getMappedAddr();
         }
-        pBuffer = (std::uint8_t*)map->getMappedAddr();
     } else if (mMemoryType == V4L2_MEMORY_MMAP) {
         auto itr = mOutputBuffersPool.find(buf->index);
         if (itr == mOutputBuffersPool.end()) {
@@ -851,39 +1044,212 @@ int V4l2Decoder::writeDumpDataToFile(v4l2_buffer* buf) {
         }
         auto& buffer = itr->second;
         auto mmapBuf = std::dynamic_pointer_cast<MMAPBuffer>(buffer);
-        pBuffer = (std::uint8_t*)mmapBuf->start[0];
+        for (uint32_t i = 0; i < numPlanes; i++) {
+            planeAddr[i] = (std::uint8_t*)mmapBuf->start[i];
+        }
+    } else if (mMemoryType == V4L2_MEMORY_USERPTR) {
+        for (uint32_t i = 0; i < numPlanes; i++) {
+            planeAddr[i] = (std::uint8_t*)buf->m.planes[i].m.userptr;
+        }
+    }
+
+    if (getColorFormat() == V4L2_PIX_FMT_NV12 || getColorFormat() == V4L2_PIX_FMT_NV12M) {
+        // NV12 keeps chroma after the padded luma; NV12M has its own plane.
+        int oBufWidth = getOutputBufferWidth(), oBufHeight = getOubputBufferHeight();
+        frame->y = planeAddr[0];
+        frame->yStride = oBufWidth;
+        frame->uv = planeAddr[0] + oBufWidth * oBufHeight;
+        frame->uvStride = oBufWidth;
+        if (numPlanes > 1) {
+            frame->uv = planeAddr[1];
+            frame->uvStride = getPlaneStride(OUTPUT_PORT, 1) ? getPlaneStride(OUTPUT_PORT, 1)
+                                                             : oBufWidth;
+        }
     }
+    return 0;
+}
+
+int V4l2Decoder::checksumOutputFrame(v4l2_buffer* buf, const OutputFrame& frame) {
+    // Only the visible rows are hashed, so stride and scanline padding
+    // never influence the digest.
+    auto hashPlane = [&](const uint8_t* p, uint32_t wBytes, uint32_t strideBytes,
+                         uint32_t nLines) {
+        for (uint32_t i = 0; i < nLines; ++i) {
+            mChecksum->update(p, wBytes);
+            p += strideBytes;
+        }
+    };
+
+    int frameWidth = getFrameWidth(), frameHeight = getFrameHeight();
+    mChecksum->begin();
+    if (frame.y) {
+        hashPlane(frame.y, frameWidth, frame.yStride, frameHeight);
+        hashPlane(frame.uv, frameWidth, frame.uvStride, frameHeight / 2);
+    } else {
+        // UBWC layouts have no addressable visible region; hash the payload.
+        for (uint32_t i = 0; i < frame.numPlanes; i++) {
+            mChecksum->update(frame.planeAddr[i], buf->m.planes[i].bytesused);
+        }
+    }
+    return mChecksum->end();
+}
+
+int V4l2Decoder::setQualityReference(std::string referencePath, std::string logPath,
+                                      int numThreads) {
+    int ret = 0;
+    mQuality = std::make_shared<FrameQuality>(mSessionId);
+    ret = mQuality->init(numThreads, logPath);
+    if (!ret) {
+        ret = mQuality->openReference(referencePath, mWidth, mHeight);
+    }
+    if (ret) {
+        mQuality = nullptr;
+    }
+    return ret;
+}
+
+int V4l2Decoder::measureOutputFrame(const OutputFrame& frame) {
+    if (!frame.y) {
+        LOGW("Quality measurement needs NV12 output, disabled\n");
+        mQuality = nullptr;
+        return -EINVAL;
+    }
+    return mQuality->measure(frame.y, frame.yStride, frame.uv, frame.uvStride, getFrameWidth(),
+                             getFrameHeight());
+}
+
+int V4l2Decoder::setPostProcess(std::string format, int width, int height, std::string filter,
+                                std::string outputPath, int numThreads) {
+    mPostProcessor = std::make_shared<FramePostProcessor>(mSessionId);
+    int ret = mPostProcessor->init(format, width, height, filter, outputPath, numThreads);
+    if (ret) {
+        mPostProcessor = nullptr;
+    }
+    return ret;
+}
+
+int V4l2Decoder::postProcessOutputFrame(const OutputFrame& frame) {
+    if (!frame.y) {
+        LOGW("Post-processing needs NV12 output, disabled\n");
+        mPostProcessor = nullptr;
+        return -EINVAL;
+    }
+    return mPostProcessor->process(frame.y, frame.yStride, frame.uv, frame.uvStride,
+                                   getFrameWidth(), getFrameHeight());
+}
+
+int V4l2Decoder::setCrossCheck(std::string inputPath, int numThreads, std::string cacheDir,
+                               bool stopOnMismatch) {
+    mCrossCheck = std::make_shared<DecodeCrossCheck>(mSessionId);
+    int ret = mCrossCheck->init(inputPath, numThreads, cacheDir, stopOnMismatch);
+    if (ret) {
+        mCrossCheck = nullptr;
+    }
+    return ret;
+}
+
+int V4l2Decoder::setDecodeRange(int start, int end, int keyFrameStride) {
+    // Reference YUVs and decoded cross-checks are compared from frame 0, so
+    // they only line up with output that also starts there.
+    if ((start > 0 || keyFrameStride > 0) && (mQuality || mCrossCheck)) {
+        LOGE("Error: a decode range from frame %d or keyframe-only decode cannot be used "
+             "with a reference YUV or cross-check\n", start);
+        return -EINVAL;
+    }
+    if (keyFrameStride > 0) {
+        if (start > 0 || end >= 0) {
+            LOGW("Keyframe-only decode ignores the decode range\n");
+        }
+        LOGI("Decoding every %d keyframe(s) only\n", keyFrameStride);
+        mStreamParser->setKeyFrameStride(keyFrameStride);
+    } else {
+        int keyFrame = mStreamParser->setDecodeRange(start, end);
+        if (keyFrame < 0) {
+            return keyFrame;
+        }
+        mLeadInFrames = start - keyFrame;
+        LOGI("Decoding frames [%d, %d), %d lead-in frame(s) from keyframe %d\n", start, end,
+             start - keyFrame, keyFrame);
+    }
+    if (mChecksum && keyFrameStride <= 0) {
+        mChecksum->setFirstFrame(start);
+    }
+    return 0;
+}
+
+bool V4l2Decoder::consumeLeadInFrame() {
+    int left = mLeadInFrames.load();
+    while (left > 0) {
+        if (mLeadInFrames.compare_exchange_weak(left, left - 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int V4l2Decoder::crossCheckOutputFrame(const OutputFrame& frame) {
+    if (!frame.y) {
+        LOGW("Cross-check needs linear NV12 output, disabled\n");
+        mCrossCheck = nullptr;
+        return -EINVAL;
+    }
+    return mCrossCheck->checkFrame(frame.y, frame.yStride, frame.uv, frame.uvStride,
+                                   getFrameWidth(), getFrameHeight());
+}
+
+int V4l2Decoder::writeDumpDataToFile(v4l2_buffer* buf) {
+    std::unique_lock<std::mutex> lock(mOutputBufLock);
+    OutputFrame frame;
+    int ret = mapOutputFrame(buf, &frame);
+    if (ret) {
+        return ret;
+    }
+    return dumpOutputFrame(buf, frame);
+}
+
+int V4l2Decoder::dumpOutputFrame(v4l2_buffer* buf, const OutputFrame& frame) {
+    TraceScope trace(mTraceSession, "dump");
+    // Writing one color plane.
+    auto writePlane = [=](const uint8_t* p, uint32_t wBytes, uint32_t strideBytes,
+                          uint32_t nLines) {
+        for (uint32_t i = 0; i < nLines; ++i) {
+            fwrite(p, wBytes, 1, mOutputDumpFile);
+            fflush(mOutputDumpFile);
+            p += strideBytes;
+        }
+    };
 
     int frameWidth = getFrameWidth(), frameHeight = getFrameHeight();
-    int oBufWidth = getOutputBufferWidth(), oBufHeight = getOubputBufferHeight();
     switch (getColorFormat()) {
-        case V4L2_PIX_FMT_NV12: {
-            uint8_t* base = pBuffer;
-            LOGD("Dump file as NV12, frame size(%dx%d), buffer size(%dx%d)\n",
-                frameWidth, frameHeight, oBufWidth, oBufHeight);
-            if (frameWidth == oBufWidth) {
-                // Y Plane
-                fwrite(base, frameWidth * frameHeight, 1, mOutputDumpFile);
-                // UV Plane
-                base += oBufWidth * oBufHeight;
-                fwrite(base, frameWidth * frameHeight / 2, 1, mOutputDumpFile);
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV12M: {
+            LOGD("Dump file as NV12, frame size(%dx%d), buffer size(%dx%d), %u plane(s)\n",
+                frameWidth, frameHeight, getOutputBufferWidth(), getOubputBufferHeight(),
+                frame.numPlanes);
+            // Y Plane
+            if (frameWidth == frame.yStride) {
+                fwrite(frame.y, frameWidth * frameHeight, 1, mOutputDumpFile);
+            } else {
+                writePlane(frame.y, frameWidth, frame.yStride, frameHeight);
+            }
+            // UV Plane
+            if (frameWidth == frame.uvStride) {
+                fwrite(frame.uv, frameWidth * frameHeight / 2, 1, mOutputDumpFile);
             } else {
-                // Y Plane
-                writePlane(base, frameWidth, oBufWidth, frameHeight);
-                // UV Plane
-                base += oBufWidth * oBufHeight;
-                writePlane(base, frameWidth, oBufWidth, frameHeight / 2);
+                writePlane(frame.uv, frameWidth, frame.uvStride, frameHeight / 2);
             }
             break;
         }
         case V4L2_PIX_FMT_QC08C:
         case V4L2_PIX_FMT_QC10C: {
-            fwrite(pBuffer, buf->m.planes[0].bytesused, 1, mOutputDumpFile);
+            fwrite(frame.planeAddr[0], buf->m.planes[0].bytesused, 1, mOutputDumpFile);
             break;
         }
         default: {
             LOGW("unsupport this color format: %x\n", getColorFormat());
-            fwrite(pBuffer, buf->m.planes[0].bytesused, 1, mOutputDumpFile);
+            for (uint32_t i = 0; i < frame.numPlanes; i++) {
+                fwrite(frame.planeAddr[i], buf->m.planes[i].bytesused, 1, mOutputDumpFile);
+            }
             break;
         }
     }
@@ -936,15 +1302,39 @@ int V4l2DecoderCB::onBufferDone(v4l2_buffer* buffer) {
     } else if (buffer->type == OUTPUT_MPLANE) {
         LOGI("%s: DQBUF DONE(output): %d, bytesused: %d\n", __func__,
             buffer->index, buffer->m.planes[0].bytesused);
+        // Frames before the start of a decode range are decoded but not output.
+        // The stages read the frame before the buffer can be queued again.
+        bool hasFrame = buffer->m.planes[0].bytesused && !mDec->consumeLeadInFrame();
+        bool hasStage = mDec->mOutputDumpFile || mDec->mQuality || mDec->mPostProcessor ||
+                        mDec->mChecksum || mDec->mCrossCheck;
+        if (hasFrame && hasStage) {
+            std::unique_lock<std::mutex> lock(mDec->mOutputBufLock);
+            V4l2Decoder::OutputFrame frame;
+            if (mDec->mapOutputFrame(buffer, &frame) == 0) {
+                if (mDec->mOutputDumpFile) {
+                    mDec->dumpOutputFrame(buffer, frame);
+                }
+                if (mDec->mQuality) {
+                    mDec->measureOutputFrame(frame);
+                }
+                if (mDec->mPostProcessor) {
+                    mDec->postProcessOutputFrame(frame);
+                }
+                if (mDec->mChecksum && mDec->checksumOutputFrame(buffer, frame)) {
+                    LOGE("onBufferDone: checksum mismatch, stopping session\n");
+                    mDec->mErrorReceived = true;
+                }
+                if (mDec->mCrossCheck && mDec->crossCheckOutputFrame(frame) == -EBADMSG) {
+                    LOGE("onBufferDone: cross-check mismatch, stopping session\n");
+                    mDec->mErrorReceived = true;
+                }
+            }
+        }
         ret = putOutputBufferLocked(buffer);
         if (ret) {
             return ret;
         }
 
-        if (mDec->mOutputDumpFile && buffer->m.planes[0].bytesused) {
-            mDec->writeDumpDataToFile(buffer);
-        }
-
         if (buffer->flags & V4L2_BUF_FLAG_LAST) {
             buffer->flags &= ~V4L2_BUF_FLAG_LAST;
 
@@ -973,6 +1363,9 @@ int V4l2DecoderCB::onEventDone(v4l2_event* event) {
         LOGI("onEventDone : source change event received\n");
         mDec->setReconfigEventReceived(true);
         mDec->setFirstReconfigReceived(true);
+        if (TraceRecorder::isEnabled()) {
+            TraceRecorder::get().instant(mDec->mTraceSession, "source change");
+        }
     }
     return 0;
 }
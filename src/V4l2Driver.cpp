@@ -5,10 +5,12 @@
  **************************************************************************************************
 */
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include <iostream>
 
 #include <linux/media.h>
@@ -18,6 +20,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
+#include "TraceRecorder.h"
 #include "V4l2Codec.h"
 #include "V4l2Driver.h"
 
@@ -202,7 +205,9 @@ V4l2Driver::V4l2Driver(std::string sessionId)
       mPollThread(nullptr),
       mThreadRunning(false),
       mPollThreadExit(false),
-      mSessionId(sessionId) {}
+      mSessionId(sessionId) {
+    mTraceSession = TraceRecorder::get().registerSession(sessionId);
+}
 
 V4l2Driver::~V4l2Driver() {}
 
@@ -300,6 +305,7 @@ int V4l2Driver::isMatchVideoDevice(int domain, int fd, const char* name) {
 
     while (!ioctl(fd, VIDIOC_ENUM_FMT, &fdesc)) {
         if (fdesc.pixelformat == V4L2_PIX_FMT_NV12 || fdesc.pixelformat == V4L2_PIX_FMT_NV21 ||
+            fdesc.pixelformat == V4L2_PIX_FMT_NV12M ||
             fdesc.pixelformat == V4L2_PIX_FMT_QC08C || fdesc.pixelformat == V4L2_PIX_FMT_QC10C) {
             LOGI("find pixelformat for %s description: %s\n",
                 domain == V4L2_CODEC_TYPE_DECODER ? "decoder output"
@@ -388,12 +394,40 @@ int V4l2Driver::OpenDMAHeap(std::string device) {
     std::string dma_path = dma_dir + device;
     mHeapFd = open(dma_path.c_str(), O_RDWR);
     if (mHeapFd <= 0) {
-        LOGE("Error: Failed to open %s\n", dma_path.c_str());
+        std::string available;
+        for (auto& heap : listDMAHeaps()) {
+            available += " " + heap;
+        }
+        LOGE("Error: Failed to open %s, available heaps:%s\n", dma_path.c_str(),
+             available.empty() ? " none" : available.c_str());
         return -EINVAL;
     }
+    mHeapName = device;
     return 0;
 }
 
+std::vector<std::string> V4l2Driver::listDMAHeaps() {
+    std::vector<std::string> heaps;
+    DIR* dir = opendir("/dev/dma_heap");
+    if (dir == nullptr) {
+        return heaps;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') {
+            heaps.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+    std::sort(heaps.begin(), heaps.end());
+    return heaps;
+}
+
+bool V4l2Driver::isUncachedHeap(const std::string& name) {
+    // e.g. "system-uncached", "qcom,system-uncached"
+    return name.find("uncached") != std::string::npos ||
+           name.find("writecombine") != std::string::npos;
+}
+
 void V4l2Driver::CloseDMAHeap() {
     if (mHeapFd >= 0) {
         close(mHeapFd);
@@ -428,61 +462,64 @@ int V4l2Driver::AllocMMAPBuffer(std::shared_ptr<MMAPBuffer> mmapBuf,
         return ret;
     }
 
-    struct v4l2_exportbuffer expbuf = {
-        .type = buf->type,
-        .index = buf->index,
-        .plane = 0,
-        .flags = O_CLOEXEC | O_RDWR,
-    };
-    ret = ioctl(mFd, VIDIOC_EXPBUF, &expbuf);
-    if (ret < 0) {
-        LOGE("Error: VIDIOC_EXPBUF failed for buffer index %d\n", buf->index);
-        return ret;
-    }
+    // Each plane of a multi-planar format is exported and mapped on its own.
+    for (uint32_t plane = 0; plane < buf->length; plane++) {
+        struct v4l2_exportbuffer expbuf = {
+            .type = buf->type,
+            .index = buf->index,
+            .plane = plane,
+            .flags = O_CLOEXEC | O_RDWR,
+        };
+        ret = ioctl(mFd, VIDIOC_EXPBUF, &expbuf);
+        if (ret < 0) {
+            LOGE("Error: VIDIOC_EXPBUF failed for buffer index %d plane %u\n",
+                 buf->index, plane);
+            return ret;
+        }
 
-    mmapBuf->length[0] = buf->m.planes[0].length;
-    mmapBuf->mFd = expbuf.fd;
+        if (expbuf.fd <= 0) {
+            LOGE("Error: Invalid dma_buf fd: %d\n", expbuf.fd);
+            return -EINVAL;
+        }
+        mmapBuf->length[plane] = buf->m.planes[plane].length;
+        mmapBuf->mFd[plane] = expbuf.fd;
+        mmapBuf->mNumPlanes = plane + 1;
 
-    if (expbuf.fd <= 0) {
-        LOGE("Error: Invalid dma_buf fd: %d\n", expbuf.fd);
-        return -EINVAL;
-    }
+        if (buf->m.planes[plane].length == 0) {
+            LOGE("Error: Invalid buffer length: 0\n");
+            return -EINVAL;
+        }
 
-    if (buf->m.planes[0].length == 0) {
-        LOGE("Error: Invalid buffer length: 0\n");
-        close(expbuf.fd);
-        return -EINVAL;
-    }
+        struct stat buf_stat;
+        if (fstat(expbuf.fd, &buf_stat) < 0) {
+            int stat_errno = errno;
+            LOGE("Error: fstat failed on dma_buf fd %d. Error: %d (%s)\n",
+                 expbuf.fd, stat_errno, strerror(stat_errno));
+            return -stat_errno;
+        }
 
-    struct stat buf_stat;
-    if (fstat(expbuf.fd, &buf_stat) < 0) {
-        int stat_errno = errno;
-        LOGE("Error: fstat failed on dma_buf fd %d. Error: %d (%s)\n",
-             expbuf.fd, stat_errno, strerror(stat_errno));
-        close(expbuf.fd);
-        return -stat_errno;
-    }
+        LOGV("V4l2Driver::AllocMMAPBuffer: plane %u dma_buf stats - size: %lld, blocks: %lld, blksize: %d\n",
+             plane, (long long)buf_stat.st_size, (long long)buf_stat.st_blocks,
+             (int)buf_stat.st_blksize);
 
-    LOGV("V4l2Driver::AllocMMAPBuffer: dma_buf stats - size: %lld, blocks: %lld, blksize: %d\n",
-         (long long)buf_stat.st_size, (long long)buf_stat.st_blocks, (int)buf_stat.st_blksize);
+        void* addr = mmap(NULL, buf->m.planes[plane].length,
+                          PROT_READ | PROT_WRITE,
+                          MAP_SHARED,
+                          expbuf.fd, 0);
 
-    mmapBuf->start[0] = mmap(NULL, buf->m.planes[0].length,
-                            PROT_READ | PROT_WRITE,
-                            MAP_SHARED,
-                            expbuf.fd, 0);
+        if (MAP_FAILED == addr) {
+            int saved_errno = errno;
+            LOGE("Error: mmap failed while allocating mmap buf. Error: %d (%s)\n",
+                 saved_errno, strerror(saved_errno));
 
-    if (MAP_FAILED == mmapBuf->start[0]) {
-        int saved_errno = errno;
-        close(expbuf.fd);
-        LOGE("Error: mmap failed while allocating mmap buf. Error: %d (%s)\n",
-             saved_errno, strerror(saved_errno));
+            if (saved_errno == EINVAL) {
+                LOGE("Possible cause: buffer size mismatch. Requested: %u, dma_buf size: %lld\n",
+                     (unsigned int)buf->m.planes[plane].length, (long long)buf_stat.st_size);
+            }
 
-        if (saved_errno == EINVAL) {
-            LOGE("Possible cause: buffer size mismatch. Requested: %u, dma_buf size: %lld\n",
-                 (unsigned int)buf->m.planes[0].length, (long long)buf_stat.st_size);
+            return -saved_errno;
         }
-
-        return -saved_errno;
+        mmapBuf->start[plane] = addr;
     }
 
     return 0;
@@ -513,7 +550,7 @@ int V4l2Driver::registerCallbacks(std::shared_ptr<V4l2DriverCallback> cb) {
 
 int V4l2Driver::threadLoop() {
     struct v4l2_buffer buffer;
-    struct v4l2_plane plane[INPUT_PLANES];
+    struct v4l2_plane plane[VIDEO_MAX_PLANES];
     struct v4l2_event event;
     struct pollfd pollFds[2];
     LOGV("V4l2Driver::threadLoop() begins.\n");
@@ -548,6 +585,7 @@ int V4l2Driver::threadLoop() {
             memset(&event, 0, sizeof(event));
             if (!ioctl(mFd, VIDIOC_DQEVENT, &event)) {
                 LOGI("V4l2Driver: Received v4l2 event, type %#x\n", event.type);
+                TraceScope trace(mTraceSession, "event");
                 mCb->onV4l2EventDone(&event);
             }
         }
@@ -557,14 +595,25 @@ int V4l2Driver::threadLoop() {
             memset(&plane[0], 0, sizeof(plane));
             buffer.type = OUTPUT_MPLANE;
             buffer.m.planes = plane;
-            buffer.length = 1;
+            buffer.length = VIDEO_MAX_PLANES;
             buffer.memory = mMemoryType;
             do {
-                if (ioctl(mFd, VIDIOC_DQBUF, &buffer)) {
-                    LOGE("Error: Failed to poll output buffer.\n");
-                    break;
+                {
+                    TraceScope trace(mTraceSession, "DQBUF output");
+                    if (ioctl(mFd, VIDIOC_DQBUF, &buffer)) {
+                        LOGE("Error: Failed to poll output buffer.\n");
+                        break;
+                    }
+                    // Codecs stamp each input buffer with a per-session key that
+                    // the driver copies to the CAPTURE buffer it produces.
+                    if (TraceRecorder::isEnabled() && buffer.m.planes[0].bytesused) {
+                        TraceRecorder::get().flowEnd(mTraceSession,
+                                                     buffer.timestamp.tv_sec * 1000000ULL +
+                                                         buffer.timestamp.tv_usec);
+                    }
                 }
 
+                TraceScope trace(mTraceSession, "callback output");
                 if (mCb->onV4l2BufferDone(&buffer)) {
                     mError = true;
                 }
@@ -576,14 +625,18 @@ int V4l2Driver::threadLoop() {
             memset(&plane[0], 0, sizeof(plane));
             buffer.type = INPUT_MPLANE;
             buffer.m.planes = plane;
-            buffer.length = 1;
+            buffer.length = VIDEO_MAX_PLANES;
             buffer.memory = mMemoryType;
             do {
-                if (ioctl(mFd, VIDIOC_DQBUF, &buffer)) {
-                    LOGE("Error: Failed to poll input buffer.\n");
-                    break;
+                {
+                    TraceScope trace(mTraceSession, "DQBUF input");
+                    if (ioctl(mFd, VIDIOC_DQBUF, &buffer)) {
+                        LOGE("Error: Failed to poll input buffer.\n");
+                        break;
+                    }
                 }
                 LOGD("Poll input buffer succeeded.\n");
+                TraceScope trace(mTraceSession, "callback input");
                 if (mCb->onV4l2BufferDone(&buffer)) {
                     mError = true;
                 }
@@ -776,6 +829,24 @@ int V4l2Driver::setControl(v4l2_control* ctrl) {
     return 0;
 }
 
+int V4l2Driver::setExtControls(v4l2_ext_controls* ctrls) {
+    LOGD("setExtControls: %u controls\n", ctrls->count);
+    int ret = ioctl(mFd, VIDIOC_S_EXT_CTRLS, ctrls);
+    if (ret) {
+        // error_idx == count means the batch was rejected before any was applied.
+        if (ctrls->error_idx < ctrls->count) {
+            LOGE("setExtControls failed for \"%s\", value %d\n",
+                ctrl_name(ctrls->controls[ctrls->error_idx].id),
+                ctrls->controls[ctrls->error_idx].value);
+        } else {
+            LOGE("setExtControls failed validating %u controls\n", ctrls->count);
+        }
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
 int V4l2Driver::setMemoryType(unsigned int memoryType) {
     mMemoryType = memoryType;
     return 0;
@@ -801,6 +872,8 @@ int V4l2Driver::queueBuf(v4l2_buffer* buf) {
         return -EINVAL;
     }
 
+    TraceScope trace(mTraceSession,
+                     buf->type == INPUT_MPLANE ? "QBUF input" : "QBUF output");
     int ret = ioctl(mFd, VIDIOC_QBUF, buf);
     if (ret) {
         LOGE("failed to QBUF: %s\n", strerror(ret));
@@ -898,6 +971,18 @@ int V4l2Driver::queryControl(v4l2_queryctrl* ctrl) {
     return 0;
 }
 
+int V4l2Driver::queryExtControl(v4l2_query_ext_ctrl* ctrl) {
+    int ret = ioctl(mFd, VIDIOC_QUERY_EXT_CTRL, ctrl);
+    if (ret) {
+        LOGW("Failed to query ext ctrl: %s\n", ctrl_name(ctrl->id));
+        return -EINVAL;
+    }
+    LOGV("queryExtControl: name: \"%s\", type: %u, min: %lld, max: %lld, step: %llu\n",
+        ctrl->name, ctrl->type, (long long)ctrl->minimum, (long long)ctrl->maximum,
+        (unsigned long long)ctrl->step);
+    return 0;
+}
+
 int V4l2Driver::enumFormat(v4l2_fmtdesc* fmtdesc) {
     int ret = ioctl(mFd, VIDIOC_ENUM_FMT, fmtdesc);
     if (ret) {
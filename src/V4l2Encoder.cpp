@@ -10,7 +10,16 @@
 #include <sys/ioctl.h>
 #include <linux/dma-buf.h>
 
+#include "BitrateController.h"
+#include "BitstreamAnalyzer.h"
+#include "EncoderEvaluator.h"
 #include "FFYUVParser.h"
+#include "FramePacer.h"
+#include "FrameScaler.h"
+#include "LadderSource.h"
+#include "MappedYUVSource.h"
+#include "SceneDetector.h"
+#include "SyntheticSource.h"
 #include "V4l2Encoder.h"
 
 #define ALIGN(num, to) (((num) + (to - 1)) & (~(to - 1)))
@@ -57,9 +66,9 @@ int V4l2Encoder::init() {
     if (ret) {
         return ret;
     }
-    if (mMemoryType != V4L2_MEMORY_MMAP) {
-        // Only try to open dma_heap when memory type is not set to V4L2_MEMORY_MMAP
-        ret = mV4l2Driver->OpenDMAHeap("system");
+    if (mMemoryType != V4L2_MEMORY_MMAP && mMemoryType != V4L2_MEMORY_USERPTR) {
+        // Only try to open dma_heap when memory type is not set to MMAP or USERPTR
+        ret = mV4l2Driver->OpenDMAHeap(mDmaHeap);
         if (ret && (mMemoryType == V4L2_MEMORY_DMABUF)) {
             LOGE("Error: failed to open dma_heap while V4L2_MEMORY_DMABUF designated.\n");
             return ret;
@@ -69,6 +78,7 @@ int V4l2Encoder::init() {
             setMemoryType("DMA_BUF");
         }
     }
+    configureHeapAccess();
     ret = mV4l2Driver->createPollThread();
     if (ret) {
         return ret;
@@ -88,6 +98,65 @@ void V4l2Encoder::deinit() {
     if (mMemoryType == V4L2_MEMORY_DMABUF) {
         mV4l2Driver->CloseDMAHeap();
     }
+    if (mEvaluator) {
+        mEvaluator->deinit();
+        mEvaluator = nullptr;
+    }
+    if (mRateController) {
+        mRateController->deinit();
+        mRateController = nullptr;
+    }
+    if (mAnalyzer) {
+        mAnalyzer->deinit();
+        mAnalyzer = nullptr;
+    }
+    if (mPacer) {
+        mPacer->deinit();
+        mPacer = nullptr;
+    }
+}
+
+int V4l2Encoder::setLoopbackEvaluation(std::string logPath, int numThreads) {
+    int ret = 0;
+    if (mPixelFmt != V4L2_PIX_FMT_NV12 && mPixelFmt != V4L2_PIX_FMT_NV12M) {
+        LOGW("Loopback evaluation needs NV12 input, disabled\n");
+        return 0;
+    }
+    mEvaluator = std::make_shared<EncoderEvaluator>(mSessionId);
+    ret = mEvaluator->init(mCodecFmt, mWidth, mHeight, mFrameRate, numThreads, logPath);
+    if (ret) {
+        mEvaluator = nullptr;
+        return ret;
+    }
+    if (mSyntheticSource) {
+        mSyntheticSource->setRetainFrames(true);
+    } else if (mMappedSource) {
+        mMappedSource->setRetainFrames(true);
+    } else {
+        mYUVParser->setRetainFrames(true);
+    }
+    return 0;
+}
+
+int V4l2Encoder::queryFrameSizes(unsigned int codec, unsigned int pixel,
+                                 std::string sessionId, struct v4l2_frmsizeenum* fsize) {
+    V4l2Driver driver(sessionId);
+    int ret = driver.Open(V4L2_CODEC_TYPE_ENCODER);
+    if (ret) {
+        return ret;
+    }
+    ret = driver.setCodecPixelFmt(OUTPUT_MPLANE, codec);
+    if (!ret) {
+        ret = driver.setCodecPixelFmt(INPUT_MPLANE, pixel);
+    }
+    if (!ret) {
+        memset(fsize, 0, sizeof(*fsize));
+        fsize->index = 0;
+        fsize->pixel_format = pixel;
+        ret = driver.enumFramesize(fsize);
+    }
+    driver.Close();
+    return ret;
 }
 
 int V4l2Encoder::initFFYUVParser(std::string inputPath, int width, int height, std::string pixfmt) {
@@ -100,11 +169,169 @@ int V4l2Encoder::initFFYUVParser(std::string inputPath, int width, int height, s
     if (mYUVParser->init() < 0) {
         return -1;
     }
+    applyCopyKernel();
     return 0;
 }
 
+void V4l2Encoder::applyCopyKernel() {
+    if (mYUVParser) {
+        mYUVParser->setCopyKernel(mCopyKernel);
+    }
+    if (mMappedSource) {
+        mMappedSource->setCopyKernel(mCopyKernel);
+    }
+}
+
+int V4l2Encoder::setBitrateController(std::string trace, int peakPercent, std::string logPath) {
+    uint32_t bitrate = 0, peak = 0;
+    mRateController = std::make_shared<BitrateController>(mSessionId);
+    int ret = mRateController->init(trace, peakPercent, logPath);
+    if (ret) {
+        mRateController = nullptr;
+        return ret;
+    }
+    mRateController->getInitialBitrate(&bitrate, &peak);
+    ret = setControl(V4L2_CID_MPEG_VIDEO_BITRATE, bitrate);
+    if (ret) {
+        return ret;
+    }
+    // Peak only applies to VBR; CBR sessions reject it.
+    if (setControl(V4L2_CID_MPEG_VIDEO_BITRATE_PEAK, peak)) {
+        LOGW("Peak bitrate not accepted, controlling bitrate only\n");
+    }
+    return 0;
+}
+
+int V4l2Encoder::updateBitrate(v4l2_buffer* buf) {
+    uint32_t bitrate = 0, peak = 0;
+    int64_t timestampUs = buf->timestamp.tv_sec * 1000000LL + buf->timestamp.tv_usec;
+    int ret = 0;
+
+    if (!mRateController->onFrameEncoded(timestampUs, buf->m.planes[0].bytesused, &bitrate,
+                                         &peak)) {
+        return 0;
+    }
+    ret = setControl(V4L2_CID_MPEG_VIDEO_BITRATE, bitrate);
+    if (ret) {
+        LOGW("Failed to update bitrate to %u (%d)\n", bitrate, ret);
+        return ret;
+    }
+    setControl(V4L2_CID_MPEG_VIDEO_BITRATE_PEAK, peak);
+    return 0;
+}
+
+int V4l2Encoder::setBitstreamAnalysis(std::string logPath) {
+    if (mCodecFmt != V4L2_PIX_FMT_H264 && mCodecFmt != V4L2_PIX_FMT_HEVC) {
+        LOGW("Bitstream analysis needs H.264 or HEVC output, disabled\n");
+        return 0;
+    }
+    mAnalyzer = std::make_shared<BitstreamAnalyzer>(mSessionId);
+    int ret = mAnalyzer->init(mCodecFmt, isNALEncodingEnabled(), logPath);
+    if (ret) {
+        mAnalyzer = nullptr;
+    }
+    return ret;
+}
+
+int V4l2Encoder::setInputPacing(std::string mode, int jitterUs) {
+    mPacer = std::make_shared<FramePacer>(mSessionId);
+    int ret = mPacer->init(mode, mFrameRate, jitterUs);
+    if (ret) {
+        mPacer = nullptr;
+    }
+    return ret;
+}
+
+int V4l2Encoder::setSceneCutDetection(std::string method, int threshold, int minInterval) {
+    if (mPixelFmt != V4L2_PIX_FMT_NV12 && mPixelFmt != V4L2_PIX_FMT_NV12M) {
+        LOGW("Scene cut detection needs linear NV12 input, disabled\n");
+        return 0;
+    }
+    mSceneDetector = std::make_shared<SceneDetector>(mSessionId);
+    int ret = mSceneDetector->init(method, threshold, minInterval);
+    if (ret) {
+        mSceneDetector = nullptr;
+    }
+    return ret;
+}
+
+void V4l2Encoder::detectSceneCut(const uint8_t* luma, int stride, uint32_t frameCount) {
+    if (!mSceneDetector->analyze(luma, stride, getFrameWidth(), getFrameHeight())) {
+        return;
+    }
+    // Applies to the next buffer queued on the input port, i.e. this frame.
+    int ret = setControl(V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 1);
+    if (ret) {
+        LOGW("Failed to force a keyframe at frame %u (%d)\n", frameCount, ret);
+    }
+}
+
+int V4l2Encoder::initMappedSource(std::string inputPath, int width, int height, bool loop,
+                                  int readaheadFrames, int startFrame) {
+    mMappedSource = std::make_shared<MappedYUVSource>(inputPath, mSessionId);
+    int ret = mMappedSource->init(width, height, mPixelFmt, loop, readaheadFrames);
+    if (!ret && startFrame > 0) {
+        ret = mMappedSource->seekToFrame(startFrame);
+    }
+    if (ret) {
+        mMappedSource = nullptr;
+        return ret;
+    }
+    applyCopyKernel();
+    return 0;
+}
+
+int V4l2Encoder::setInputRegion(int left, int top, int width, int height) {
+    if (!mMappedSource) {
+        LOGE("Error: input regions need a mapped source\n");
+        return -EINVAL;
+    }
+    return mMappedSource->setRegion(left, top, width, height);
+}
+
+int V4l2Encoder::initLadderSource(std::shared_ptr<LadderSource> source, int slot,
+                                  std::string filter) {
+    FrameScaler::Filter unused;
+    if (FrameScaler::parseFilter(filter, &unused)) {
+        LOGE("Error: unknown scale filter %s, expected bilinear or box\n", filter.c_str());
+        return -EINVAL;
+    }
+    mLadderSource = source;
+    mLadderSlot = slot;
+    mLadderFilter = filter;
+    mLadderFrameIdx = 0;
+    return 0;
+}
+
+int V4l2Encoder::initSyntheticSource(std::string pattern, int width, int height, uint32_t seed,
+                                     int motion, int noise) {
+    if (mPixelFmt != V4L2_PIX_FMT_NV12 && mPixelFmt != V4L2_PIX_FMT_NV12M) {
+        LOGE("Error: synthetic input needs an NV12 pixel format\n");
+        return -EINVAL;
+    }
+    mSyntheticSource = std::make_shared<SyntheticSource>(mSessionId);
+    int ret = mSyntheticSource->init(pattern, width, height, seed, motion, noise);
+    if (ret) {
+        mSyntheticSource = nullptr;
+    }
+    return ret;
+}
+
 void V4l2Encoder::deinitFFYUVParser() {
-    mYUVParser->deinit();
+    if (mLadderSource) {
+        std::unique_lock<std::mutex> lock(mLadderLock);
+        mLadderFrames.clear();
+        mLadderScaler = nullptr;
+    }
+    if (mSyntheticSource) {
+        mSyntheticSource->deinit();
+    }
+    if (mMappedSource) {
+        mMappedSource->deinit();
+    }
+    if (mYUVParser) {
+        mYUVParser->deinit();
+    }
 }
 
 static int calc_scanline_aligned(int height, int stride, int imageSize, int colorFormat) {
@@ -113,6 +340,7 @@ static int calc_scanline_aligned(int height, int stride, int imageSize, int colo
     switch (colorFormat) {
         case V4L2_PIX_FMT_QC08C:
         case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV12M:
             scanline = ALIGN(height, 32);
             break;
         case V4L2_PIX_FMT_QC10C:
@@ -290,11 +518,20 @@ int V4l2Encoder::configureInput() {
     mInputMatrixCoeff = fmt.fmt.pix_mp.ycbcr_enc;
     mInputTransferChar = fmt.fmt.pix_mp.xfer_func;
     mInputVideoRange = fmt.fmt.pix_mp.quantization;
+    updatePlaneInfo(&fmt);
     mInputSize = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
     mStride = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
     mScanline = calc_scanline_aligned(mHeight, mStride, mInputSize, mPixelFmt);
     LOGV("%s: WxH(%dx%d), stride(%d), scanline(%d), inputSize(%d)\n", __func__,
         mWidth, mHeight, mStride, mScanline, mInputSize);
+    if (mNumInputPlanes > 1 &&
+        (getPlaneSize(INPUT_PORT, 0) < (uint32_t)(mStride * mScanline) ||
+         getPlaneSize(INPUT_PORT, 1) < (uint32_t)(mStride * ALIGN((mHeight + 1) >> 1, 16)))) {
+        LOGE("%s: plane sizes %u/%u too small for %dx%d stride %d scanline %d\n", __func__,
+            getPlaneSize(INPUT_PORT, 0), getPlaneSize(INPUT_PORT, 1), mWidth, mHeight,
+            mStride, mScanline);
+        return -EINVAL;
+    }
 
     if (mStride > mWidth || mScanline > mHeight) {
         memset(&sel, 0, sizeof(sel));
@@ -357,6 +594,7 @@ int V4l2Encoder::configureOutput() {
     if (ret) {
         return ret;
     }
+    updatePlaneInfo(&fmt);
     mOutputSize = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
 
     ctrl.id = V4L2_CID_MIN_BUFFERS_FOR_CAPTURE;
@@ -390,8 +628,43 @@ int V4l2Encoder::configureOutput() {
     return 0;
 }
 
+int V4l2Encoder::fillFromLadder(int index, void* dst, void* dstUV, bool& eos) {
+    int frmWidth = getFrameWidth(), frmHeight = getFrameHeight();
+    int frmStride = getFrameStride(), frmScanline = getFrameScanline();
+    int srcWidth = mLadderSource->getWidth(), srcHeight = mLadderSource->getHeight();
+
+    if (!mLadderScaler) {
+        FrameScaler::Filter filter = FrameScaler::FILTER_BILINEAR;
+        FrameScaler::parseFilter(mLadderFilter, &filter);
+        mLadderScaler = std::make_shared<FrameScaler>(mSessionId);
+        if (mLadderScaler->init(srcWidth, srcHeight, frmWidth, frmHeight, filter)) {
+            mLadderScaler = nullptr;
+            eos = true;
+            return 0;
+        }
+    }
+    auto frame = mLadderSource->getFrame(mLadderSlot, mLadderFrameIdx);
+    if (!frame) {
+        eos = true;
+        return 0;
+    }
+    mLadderFrameIdx++;
+
+    const uint8_t* srcY = frame->data();
+    uint8_t* y = (uint8_t*)dst;
+    uint8_t* uv = dstUV ? (uint8_t*)dstUV : y + (size_t)frmStride * frmScanline;
+    mLadderScaler->scaleNV12(srcY, srcWidth, srcY + (size_t)srcWidth * srcHeight,
+                             ALIGN(srcWidth, 2), y, frmStride, uv, frmStride);
+    {
+        std::unique_lock<std::mutex> lock(mLadderLock);
+        mLadderFrames[index] = frame;
+    }
+    return frmStride * frmScanline + frmStride * ALIGN((frmHeight + 1) >> 1, 16);
+}
+
 int V4l2Encoder::feedInputDataToV4l2Buffer(std::shared_ptr<v4l2_buffer> buf,
                                            bool& eos, uint32_t frameCount) {
+    TraceScope trace(mTraceSession, "fill");
     int ret = 0, pkt_size = 0;
     void* bufAddr = nullptr;
     int frmWidth = getFrameWidth(), frmHeight = getFrameHeight();
@@ -403,54 +676,127 @@ int V4l2Encoder::feedInputDataToV4l2Buffer(std::shared_ptr<v4l2_buffer> buf,
     }
     auto& buffer = itr->second;
 
+    // Multi-planar formats get their chroma plane filled in place; otherwise it
+    // follows luma inside plane 0.
+    int numPlanes = getNumPlanes(INPUT_PORT);
+    void* planeAddr[VIDEO_MAX_PLANES] = {nullptr};
+    auto fillPlanes = [&]() -> int {
+        void* uvAddr = numPlanes > 1 ? planeAddr[1] : nullptr;
+        int size = 0;
+        if (mLadderSource) {
+            size = fillFromLadder(buf->index, planeAddr[0], uvAddr, eos);
+        } else if (mSyntheticSource) {
+            size = mSyntheticSource->fillPacketData(planeAddr[0], uvAddr, frmWidth, frmHeight,
+                                                    frmStride, frmScanline, mPixelFmt, eos);
+        } else if (mMappedSource) {
+            size = mMappedSource->fillPacketData(planeAddr[0], uvAddr, frmWidth, frmHeight,
+                                                 frmStride, frmScanline, mPixelFmt, eos);
+        } else {
+            size = mYUVParser->fillPacketData(planeAddr[0], uvAddr, frmWidth, frmHeight,
+                                              frmStride, frmScanline, mPixelFmt, eos);
+        }
+        // Runs while the buffer is still mapped, before it is queued.
+        if (mSceneDetector && size > 0) {
+            detectSceneCut((const uint8_t*)planeAddr[0], frmStride, frameCount);
+        }
+        return size;
+    };
+    auto planeBytesUsed = [&](int i) -> uint32_t {
+        if (numPlanes == 1) {
+            return pkt_size;
+        }
+        return pkt_size ? getPlaneSize(INPUT_PORT, i) : 0;
+    };
+
     if (mMemoryType == V4L2_MEMORY_DMABUF) {
         auto dmaBuf = std::dynamic_pointer_cast<DMABuffer>(buffer);
-        struct dma_buf_sync sync;
-        MapBuf map(NULL, dmaBuf->mSize, PROT_READ | PROT_WRITE, MAP_SHARED, dmaBuf->mFd, 0);
-        if (!map.isMapSucess()) {
-            LOGE("Error: failed to mmap output buffer\n");
-            return -EINVAL;
-        }
-        bufAddr = map.getMappedAddr();
-        // LOG("%d Mapped input buffer ptr: %p\n", buf->index, bufAddr);
+        std::unique_ptr<MapBuf> maps[VIDEO_MAX_PLANES];
+        for (uint32_t i = 0; i < dmaBuf->mNumPlanes; i++) {
+            maps[i] = std::make_unique<MapBuf>(nullptr, dmaBuf->mSize[i], PROT_READ | PROT_WRITE,
+                                               MAP_SHARED, dmaBuf->mFd[i], 0);
+            if (!maps[i]->isMapSucess()) {
+                LOGE("Error: failed to mmap output buffer\n");
+                return -EINVAL;
+            }
+            planeAddr[i] = maps[i]->getMappedAddr();
+            // LOG("%d Mapped input buffer ptr: %p\n", buf->index, planeAddr[i]);
 
-        memset(bufAddr, 0, getInputSize());
-        sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE;
-        ret = ioctl(dmaBuf->mFd, DMA_BUF_IOCTL_SYNC, &sync);
-        if (ret) {
-            LOGD("input read DMA_BUF_SYNC_START failed with err = %d\n", ret);
-        }
-        pkt_size = mYUVParser->fillPacketData(bufAddr, frmWidth, frmHeight, frmStride, frmScanline,
-                                                mPixelFmt, eos);
-        sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
-        ret = ioctl(dmaBuf->mFd, DMA_BUF_IOCTL_SYNC, &sync);
-        if (ret) {
-            LOGD("input read DMA_BUF_SYNC_END failed with err = %d\n", ret);
+            CopyKernel::zero(mCopyKernel, planeAddr[i], dmaBuf->mSize[i]);
+            ret = syncDmaBuf(dmaBuf->mFd[i], DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+            if (ret) {
+                LOGD("input read DMA_BUF_SYNC_START failed with err = %d\n", ret);
+            }
         }
+        bufAddr = planeAddr[0];
+        pkt_size = fillPlanes();
+        for (uint32_t i = 0; i < dmaBuf->mNumPlanes; i++) {
+            ret = syncDmaBuf(dmaBuf->mFd[i], DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+            if (ret) {
+                LOGD("input read DMA_BUF_SYNC_END failed with err = %d\n", ret);
+            }
 
-        buf->m.planes[0].bytesused = pkt_size;
-        buf->m.planes[0].data_offset = 0;
-        buf->m.planes[0].length = getInputSize();
-        buf->m.planes[0].m.fd = dmaBuf->mFd;
+            buf->m.planes[i].bytesused = planeBytesUsed(i);
+            buf->m.planes[i].data_offset = 0;
+            buf->m.planes[i].length = dmaBuf->mSize[i];
+            buf->m.planes[i].m.fd = dmaBuf->mFd[i];
+        }
     } else if (mMemoryType == V4L2_MEMORY_MMAP) {
         auto mmapBuf = std::dynamic_pointer_cast<MMAPBuffer>(buffer);
-        bufAddr = mmapBuf->start[0];
-        pkt_size = mYUVParser->fillPacketData(bufAddr, frmWidth, frmHeight, frmStride, frmScanline,
-                                                mPixelFmt, eos);
-        buf->m.planes[0].bytesused = pkt_size;
-        buf->m.planes[0].data_offset = 0;
-        buf->m.planes[0].length = getInputSize();
+        for (uint32_t i = 0; i < mmapBuf->mNumPlanes; i++) {
+            planeAddr[i] = mmapBuf->start[i];
+        }
+        bufAddr = planeAddr[0];
+        pkt_size = fillPlanes();
+        for (uint32_t i = 0; i < mmapBuf->mNumPlanes; i++) {
+            buf->m.planes[i].bytesused = planeBytesUsed(i);
+            buf->m.planes[i].data_offset = 0;
+            buf->m.planes[i].length = mmapBuf->length[i];
+        }
+    } else if (mMemoryType == V4L2_MEMORY_USERPTR) {
+        auto userPtrBuf = std::dynamic_pointer_cast<UserPtrBuffer>(buffer);
+        for (uint32_t i = 0; i < userPtrBuf->mNumPlanes; i++) {
+            planeAddr[i] = userPtrBuf->mAddr[i];
+        }
+        bufAddr = planeAddr[0];
+        pkt_size = fillPlanes();
+        for (uint32_t i = 0; i < userPtrBuf->mNumPlanes; i++) {
+            buf->m.planes[i].bytesused = planeBytesUsed(i);
+            buf->m.planes[i].data_offset = 0;
+            buf->m.planes[i].length = userPtrBuf->mSize[i];
+            buf->m.planes[i].m.userptr = (unsigned long)planeAddr[i];
+        }
     }
 
     auto timePerFrame =  (float)(1000000.0 / (1.0 * mFrameRate));
     buf->timestamp.tv_sec = frameCount * (long)(timePerFrame / 1000000);
     buf->timestamp.tv_usec = frameCount * ((long)timePerFrame % 1000000);
+    if (TraceRecorder::isEnabled() && pkt_size) {
+        TraceRecorder::get().flowStart(mTraceSession, buf->timestamp.tv_sec * 1000000ULL +
+                                                          buf->timestamp.tv_usec);
+    }
+
+    if (mEvaluator && pkt_size) {
+        AVPacket* source = mLadderSource    ? nullptr
+                           : mSyntheticSource ? mSyntheticSource->takeRetainedFrame()
+                           : mMappedSource  ? mMappedSource->takeRetainedFrame()
+                                            : mYUVParser->takeRetainedFrame();
+        if (source) {
+            mEvaluator->pushSource(buf->timestamp.tv_sec * 1000000LL + buf->timestamp.tv_usec,
+                                   source);
+        }
+    }
 
     // LOG("Filled pkg size: %d, length: %d, fd: %d\n", pkt_size,
     // buf->m.planes[0].length, buf->m.planes[0].m.fd); int bufferSz = frmStride
     // * frmScanline + frmStride * ALIGN((frmHeight + 1) >> 1, 16);
     if (mInputDumpFile != nullptr && pkt_size) {
-        fwrite(bufAddr, pkt_size, 1, mInputDumpFile);
+        if (numPlanes > 1) {
+            for (int i = 0; i < numPlanes; i++) {
+                fwrite(planeAddr[i], buf->m.planes[i].bytesused, 1, mInputDumpFile);
+            }
+        } else {
+            fwrite(bufAddr, pkt_size, 1, mInputDumpFile);
+        }
         fflush(mInputDumpFile);
     }
 
@@ -523,6 +869,9 @@ int V4l2Encoder::queueBuffers(int maxFrameCnt) {
         setDrainLastFlagReceived(false);
         setDrainSent(false);
         LOGW("queueBuffers: last flag for drain arrived\n");
+        if (TraceRecorder::isEnabled()) {
+            TraceRecorder::get().end(mTraceSession, "drain");
+        }
         ret = start();
         if (ret != 0) {
             LOGE("Error: queueBuffers: resume failed.\n");
@@ -538,6 +887,10 @@ int V4l2Encoder::queueBuffers(int maxFrameCnt) {
             LOGE("Error: queueBuffers: draining failed\n");
             return ret;
         }
+        // Ended when the last flag arrives, on this thread.
+        if (TraceRecorder::isEnabled()) {
+            TraceRecorder::get().begin(mTraceSession, "drain");
+        }
         return ret;
     };
 
@@ -584,7 +937,15 @@ int V4l2Encoder::queueBuffers(int maxFrameCnt) {
             return ret;
         }
         if (!isEndReached(eosReached, frameCounter)) {
-            usleep(1 * 1000);
+            int64_t timestampUs = input->timestamp.tv_sec * 1000000LL + input->timestamp.tv_usec;
+            if (mPacer) {
+                mPacer->onQueued(frameCounter, timestampUs);
+            } else {
+                usleep(1 * 1000);
+            }
+            if (mAnalyzer) {
+                mAnalyzer->onQueued(timestampUs);
+            }
             ret = queueBuffer(input);
             if (ret) {
                 LOGE("Error: queueBuffer input failed.\n");
@@ -667,6 +1028,11 @@ int V4l2Encoder::queueBuffers(int maxFrameCnt) {
             return -ENOMEM;
         }
 
+        // Wait in short slices so output buffers keep being recycled.
+        if (mPacer && !mPacer->waitForFrame(frameCounter, 2 * 1000)) {
+            continue;
+        }
+
         ret = prepareAndQueueInputBuffer();
         if (ret) {
             return ret;
@@ -719,61 +1085,93 @@ void V4l2Encoder::logV4l2BufferDataToFile(std::uint8_t* buffer, int buffer_len,
 #endif
 }
 
-int V4l2Encoder::writeDumpDataToFile(v4l2_buffer* buf) {
-    std::unique_lock<std::mutex> lock(mOutputBufLock);
+std::uint8_t* V4l2Encoder::mapOutputBuffer(v4l2_buffer* buf, std::unique_ptr<MapBuf>& map) {
     std::uint8_t* pBuffer = nullptr;
-    std::unique_ptr<MapBuf> map = nullptr;
-    int ret = 0;
 
     if (mMemoryType == V4L2_MEMORY_DMABUF) {
         map = std::make_unique<MapBuf>(nullptr, buf->m.planes[0].length, PROT_READ, MAP_SHARED, buf->m.planes[0].m.fd, 0);
         if (!map->isMapSucess()) {
             LOGE("Error: failed to mmap output buffer\n");
-            return -EINVAL;
+            return nullptr;
         }
         pBuffer = (std::uint8_t*)map->getMappedAddr();
     } else if (mMemoryType == V4L2_MEMORY_MMAP) {
         auto itr = mOutputBuffersPool.find(buf->index);
-        if (itr == mInputBuffersPool.end()) {
+        if (itr == mOutputBuffersPool.end()) {
             LOGE("Error: no mmap buffer found for buffer index: %d\n", buf->index);
-            return -EINVAL;
+            return nullptr;
         }
         auto& buffer = itr->second;
         auto mmapBuf = std::dynamic_pointer_cast<MMAPBuffer>(buffer);
         pBuffer = (std::uint8_t*)mmapBuf->start[0];
+    } else if (mMemoryType == V4L2_MEMORY_USERPTR) {
+        pBuffer = (std::uint8_t*)buf->m.planes[0].m.userptr;
     }
+    return pBuffer;
+}
 
-    LOGD("Writing %d bytes to output, first 8 bytes: [%x %x %x %x %x %x %x "
-        "%x]\n",
-        buf->m.planes[0].bytesused, pBuffer[0], pBuffer[1], pBuffer[2],
-        pBuffer[3], pBuffer[4], pBuffer[5], pBuffer[6], pBuffer[7]);
-    if (isNALEncodingEnabled()) {
-        ret = replaceNalSizeWAndWrite(pBuffer, buf->m.planes[0].bytesused);
-        if (ret != 0) {
-            return ret;
-        }
-        return 0;
-    }
+int V4l2Encoder::processOutputBuffer(v4l2_buffer* buf) {
+    std::unique_ptr<MapBuf> map = nullptr;
+    std::uint8_t* pBuffer = mapOutputBuffer(buf, map);
+    int64_t timestampUs = buf->timestamp.tv_sec * 1000000LL + buf->timestamp.tv_usec;
+    int ret = 0;
 
+    if (pBuffer == nullptr) {
+        return -EINVAL;
+    }
     if (mMemoryType == V4L2_MEMORY_DMABUF) {
-        struct dma_buf_sync sync;
-        sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
-        ret = ioctl(buf->m.planes[0].m.fd, DMA_BUF_IOCTL_SYNC, &sync);
+        ret = syncDmaBuf(buf->m.planes[0].m.fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
         if (ret) {
-            LOGD("Save encode DMA_BUF_SYNC_START failed with err = %d\n",
-                ret);
+            LOGD("Output DMA_BUF_SYNC_START failed with err = %d\n", ret);
         }
-        fwrite(pBuffer, buf->m.planes[0].bytesused, 1, mOutputDumpFile);
-        logV4l2BufferDataToFile(pBuffer, buf->m.planes[0].bytesused, mEncodedBufferReceieved);
-        sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
-        ret = ioctl(buf->m.planes[0].m.fd, DMA_BUF_IOCTL_SYNC, &sync);
-        if (ret) {
-            LOGD("Save encode DMA_BUF_SYNC_END failed with err = %d\n", ret);
+    }
+    if (mOutputDumpFile) {
+        ret |= writeOutputPayload(buf, pBuffer);
+    }
+    if (mEvaluator) {
+        ret |= mEvaluator->pushEncoded(pBuffer, buf->m.planes[0].bytesused, timestampUs);
+    }
+    if (mAnalyzer) {
+        ret |= mAnalyzer->analyze(pBuffer, buf->m.planes[0].bytesused, timestampUs);
+    }
+    if (mMemoryType == V4L2_MEMORY_DMABUF) {
+        if (syncDmaBuf(buf->m.planes[0].m.fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ)) {
+            LOGD("Output DMA_BUF_SYNC_END failed\n");
         }
-    } else if (mMemoryType == V4L2_MEMORY_MMAP) {
-        fwrite(pBuffer, buf->m.planes[0].bytesused, 1, mOutputDumpFile);
-        logV4l2BufferDataToFile(pBuffer, buf->m.planes[0].bytesused, mEncodedBufferReceieved);
     }
+    return ret;
+}
+
+int V4l2Encoder::writeDumpDataToFile(v4l2_buffer* buf) {
+    std::unique_lock<std::mutex> lock(mOutputBufLock);
+    std::unique_ptr<MapBuf> map = nullptr;
+    std::uint8_t* pBuffer = mapOutputBuffer(buf, map);
+    int ret = 0;
+
+    if (pBuffer == nullptr) {
+        return -EINVAL;
+    }
+    if (mMemoryType == V4L2_MEMORY_DMABUF) {
+        syncDmaBuf(buf->m.planes[0].m.fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+    }
+    ret = writeOutputPayload(buf, pBuffer);
+    if (mMemoryType == V4L2_MEMORY_DMABUF) {
+        syncDmaBuf(buf->m.planes[0].m.fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+    }
+    return ret;
+}
+
+int V4l2Encoder::writeOutputPayload(v4l2_buffer* buf, std::uint8_t* pBuffer) {
+    TraceScope trace(mTraceSession, "dump");
+    LOGD("Writing %d bytes to output, first 8 bytes: [%x %x %x %x %x %x %x "
+        "%x]\n",
+        buf->m.planes[0].bytesused, pBuffer[0], pBuffer[1], pBuffer[2],
+        pBuffer[3], pBuffer[4], pBuffer[5], pBuffer[6], pBuffer[7]);
+    if (isNALEncodingEnabled()) {
+        return replaceNalSizeWAndWrite(pBuffer, buf->m.planes[0].bytesused);
+    }
+    fwrite(pBuffer, buf->m.planes[0].bytesused, 1, mOutputDumpFile);
+    logV4l2BufferDataToFile(pBuffer, buf->m.planes[0].bytesused, mEncodedBufferReceieved);
     return 0;
 }
 
@@ -815,15 +1213,30 @@ int V4l2EncoderCB::onBufferDone(v4l2_buffer* buffer) {
         if (ret) {
             return ret;
         }
+        if (mEnc->mLadderSource) {
+            std::unique_lock<std::mutex> lock(mEnc->mLadderLock);
+            mEnc->mLadderFrames.erase(buffer->index);
+        }
     } else if (buffer->type == OUTPUT_MPLANE) {
         LOGD("DQBUF DONE(Output): %d, bytesused: %d\n", buffer->index,
             buffer->m.planes[0].bytesused);
+        // The payload is read before the buffer goes back to the queue thread,
+        // which may queue it to the driver again straight away.
+        if ((mEnc->mOutputDumpFile || mEnc->mEvaluator || mEnc->mAnalyzer) &&
+            buffer->m.planes[0].bytesused) {
+            std::unique_lock<std::mutex> lock(mEnc->mOutputBufLock);
+            mEnc->processOutputBuffer(buffer);
+        }
         ret = putOutputBufferLocked(buffer);
         if (ret) {
             return ret;
         }
-        if (mEnc->mOutputDumpFile && buffer->m.planes[0].bytesused) {
-            mEnc->writeDumpDataToFile(buffer);
+        if (mEnc->mRateController && buffer->m.planes[0].bytesused) {
+            mEnc->updateBitrate(buffer);
+        }
+        if (mEnc->mPacer && buffer->m.planes[0].bytesused) {
+            mEnc->mPacer->onFrameEncoded(buffer->timestamp.tv_sec * 1000000LL +
+                                         buffer->timestamp.tv_usec);
         }
         if (buffer->flags & V4L2_BUF_FLAG_LAST) {
             buffer->flags &= ~V4L2_BUF_FLAG_LAST;
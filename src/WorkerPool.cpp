@@ -0,0 +1,80 @@
+/*
+ **************************************************************************************************
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ **************************************************************************************************
+*/
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(int numThreads) {
+    for (int i = 1; i < numThreads; i++) {
+        mThreads.push_back(std::make_shared<std::thread>(&WorkerPool::threadLoop, this));
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::unique_lock<std::mutex> lock(mLock);
+        mExit = true;
+    }
+    mWakeUp.notify_all();
+    for (auto& thread : mThreads) {
+        thread->join();
+    }
+}
+
+void WorkerPool::runJobs() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (mJob != nullptr && mNextJob < mJobCount) {
+        int index = mNextJob++;
+        auto job = mJob;
+        lock.unlock();
+        (*job)(index);
+        lock.lock();
+        if (++mFinishedJobs == mJobCount) {
+            mDone.notify_all();
+        }
+    }
+}
+
+void WorkerPool::threadLoop() {
+    uint64_t seen = 0;
+    while (1) {
+        {
+            std::unique_lock<std::mutex> lock(mLock);
+            mWakeUp.wait(lock, [&]() { return mExit || mGeneration != seen; });
+            if (mExit) {
+                return;
+            }
+            seen = mGeneration;
+        }
+        runJobs();
+    }
+}
+
+void WorkerPool::parallelFor(int count, const std::function<void(int)>& job) {
+    if (count <= 0) {
+        return;
+    }
+    if (mThreads.empty() || count == 1) {
+        for (int i = 0; i < count; i++) {
+            job(i);
+        }
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mLock);
+        mJob = &job;
+        mJobCount = count;
+        mNextJob = 0;
+        mFinishedJobs = 0;
+        mGeneration++;
+    }
+    mWakeUp.notify_all();
+    runJobs();
+
+    std::unique_lock<std::mutex> lock(mLock);
+    mDone.wait(lock, [&]() { return mFinishedJobs == mJobCount; });
+    mJob = nullptr;
+}